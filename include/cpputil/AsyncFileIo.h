@@ -0,0 +1,611 @@
+#pragma once
+
+#ifdef _WIN32
+  #error "AsyncFileIo.h requires POSIX file I/O (pread, pwrite, fdatasync)"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <boost/asio/error.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <glog/logging.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "Buffer.h"
+
+#if defined(__linux__) && !defined(CPPUTIL_NO_IO_URING)
+  #define CPPUTIL_USE_IO_URING
+  #include <linux/io_uring.h>
+  #include <poll.h>
+  #include <sys/eventfd.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+#endif
+
+/// The operation of a FileIoRequest
+enum FileIoOp
+{
+  FIO_READ,
+  FIO_WRITE,
+  /// flushes the data of the file to the device. The buffer and offset are ignored.
+  FIO_DATASYNC
+};
+
+/// Called with the result of a request and the number of bytes transferred
+typedef boost::function<void (const boost::system::error_code&, size_t)> FileIoHandler_t;
+
+/// A read or write of a Buffer at an absolute file offset
+struct FileIoRequest
+{
+  FileIoRequest()
+    :eOp(FIO_READ),
+    fd(-1),
+    uiOffset(0)
+  {
+
+  }
+
+  FileIoRequest(FileIoOp op, int fileDescriptor, uint64_t offset, const Buffer& data, FileIoHandler_t handler)
+    :eOp(op),
+    fd(fileDescriptor),
+    uiOffset(offset),
+    buffer(data),
+    onComplete(handler)
+  {
+
+  }
+
+  FileIoOp eOp;
+  int fd;
+  uint64_t uiOffset;
+  /// the data to write or the memory to read into. Its size is the number of bytes transferred.
+  Buffer buffer;
+  FileIoHandler_t onComplete;
+};
+
+/**
+ * @brief Asynchronous file I/O service.
+ *
+ * Requests can be submitted from any thread, singly or in batches. Completion handlers are
+ * posted to the io_service passed to the constructor, so callers such as ServiceController
+ * workers never block on the disk. The buffer of a request is kept alive until its handler
+ * has been posted. Writes that complete partially are continued until all data is written;
+ * reads complete early at the end of the file.
+ *
+ * On Linux the requests are executed with io_uring, using the raw system calls. If io_uring is
+ * not available, or on other POSIX platforms, a pool of threads executes the requests with pread/pwrite.
+ * Windows is not supported.
+ *
+ * AsyncFileIo is a ServiceThread implementation:
+ *   ServiceThread<AsyncFileIo> fileIo(boost::in_place_init, boost::ref(ioService), 128, 2);
+ *   fileIo.start();
+ *   fileIo.get()->submit(FileIoRequest(FIO_WRITE, fd, 0, buffer, onWritten));
+ * Requests that were submitted before stop() are completed before the service thread exits;
+ * requests submitted afterwards complete with operation_aborted.
+ */
+class AsyncFileIo : public boost::noncopyable
+{
+public:
+  /**
+   * @brief AsyncFileIo
+   * @param ioService The io_service the completion handlers are posted to
+   * @param uiQueueDepth The maximum number of requests in flight in the kernel
+   * @param uiThreads The number of threads executing requests if io_uring is not used
+   * @param bUseIoUring If false, the thread pool is used even if io_uring is available
+   */
+  explicit AsyncFileIo(boost::asio::io_service& ioService, uint32_t uiQueueDepth = 128, uint32_t uiThreads = 2, bool bUseIoUring = true)
+    :m_rIoService(ioService),
+    m_uiQueueDepth(uiQueueDepth > 0 ? uiQueueDepth : 1),
+    m_uiThreads(uiThreads > 0 ? uiThreads : 1),
+    m_bUseIoUring(bUseIoUring),
+    m_bShutdown(false),
+    m_iEventFd(-1)
+  {
+
+  }
+
+  ~AsyncFileIo()
+  {
+    closeRing();
+  }
+
+  /// returns true if the requests are executed with io_uring. Valid once the service has been started.
+  bool isUsingIoUring() const
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_iEventFd >= 0;
+  }
+
+  /// can be called from any thread
+  void submit(const FileIoRequest& request)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_bShutdown)
+    {
+      abort(request);
+      return;
+    }
+    m_dqPending.push_back(request);
+    wake(false);
+  }
+
+  /// submits all requests with a single wakeup of the service. vRequests is cleared.
+  void submit(std::vector<FileIoRequest>& vRequests)
+  {
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      for (FileIoRequest& request : vRequests)
+      {
+        if (m_bShutdown) abort(request);
+        else m_dqPending.push_back(std::move(request));
+      }
+      wake(true);
+    }
+    vRequests.clear();
+  }
+
+  boost::system::error_code onStart()
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_bShutdown = false;
+#ifdef CPPUTIL_USE_IO_URING
+    if (m_bUseIoUring && m_ring.fd < 0)
+    {
+      boost::system::error_code ec = openRing();
+      if (ec)
+      {
+        LOG(WARNING) << "io_uring not available, using thread pool: " << ec.message();
+      }
+    }
+#endif
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code start()
+  {
+#ifdef CPPUTIL_USE_IO_URING
+    if (m_ring.fd >= 0)
+    {
+      boost::system::error_code ec = runRing();
+      closeRing();
+      if (!ec) return ec;
+      // the requests that were in flight are failed, queued requests are executed by the thread pool
+      for (uint32_t i = 0; i < m_vSlots.size(); ++i)
+      {
+        if (m_vSlots[i].request.fd >= 0) releaseSlot(i, ec);
+      }
+      LOG(WARNING) << "io_uring failed, using thread pool: " << ec.message();
+    }
+#endif
+    boost::thread_group workers;
+    for (uint32_t i = 1; i < m_uiThreads; ++i)
+    {
+      workers.create_thread(boost::bind(&AsyncFileIo::runWorker, this));
+    }
+    runWorker();
+    workers.join_all();
+    VLOG(15) << "Async file I/O complete";
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code stop()
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_bShutdown = true;
+    wake(true);
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code onComplete()
+  {
+    return boost::system::error_code();
+  }
+
+private:
+  /// Must be called with m_mutex held
+  void abort(const FileIoRequest& request)
+  {
+    complete(request, boost::asio::error::operation_aborted, 0);
+  }
+
+  void complete(const FileIoRequest& request, const boost::system::error_code& ec, size_t uiBytes)
+  {
+    if (request.onComplete)
+    {
+      m_rIoService.post(boost::bind(request.onComplete, ec, uiBytes));
+    }
+  }
+
+  /**
+   * Must be called with m_mutex held: closeRing only closes the eventfd with m_mutex held, so
+   * the descriptor cannot be closed or reused by another open while it is written to.
+   */
+  void wake(bool bAll)
+  {
+    if (m_iEventFd >= 0)
+    {
+      uint64_t uiValue = 1;
+      ssize_t iRes = ::write(m_iEventFd, &uiValue, sizeof(uiValue));
+      (void)iRes;
+    }
+    else if (bAll)
+    {
+      m_condition.notify_all();
+    }
+    else
+    {
+      m_condition.notify_one();
+    }
+  }
+
+  /// executes requests with blocking system calls until the service is stopped and no requests are left
+  void runWorker()
+  {
+    for (;;)
+    {
+      FileIoRequest request;
+      {
+        boost::mutex::scoped_lock lock(m_mutex);
+        while (m_dqPending.empty() && !m_bShutdown)
+        {
+          m_condition.wait(lock);
+        }
+        if (m_dqPending.empty()) return;
+        request = std::move(m_dqPending.front());
+        m_dqPending.pop_front();
+      }
+      size_t uiBytes = 0;
+      boost::system::error_code ec = execute(request, uiBytes);
+      complete(request, ec, uiBytes);
+    }
+  }
+
+  static boost::system::error_code execute(FileIoRequest& request, size_t& uiBytes)
+  {
+    uiBytes = 0;
+    if (request.eOp == FIO_DATASYNC)
+    {
+#if defined(__linux__)
+      int iRes = fdatasync(request.fd);
+#else
+      int iRes = fsync(request.fd);
+#endif
+      return (iRes < 0) ? boost::system::error_code(errno, boost::system::system_category()) : boost::system::error_code();
+    }
+
+    size_t uiSize = request.buffer.getSize();
+    while (uiBytes < uiSize)
+    {
+      uint8_t* pData = &request.buffer[0] + uiBytes;
+      off_t iOffset = static_cast<off_t>(request.uiOffset + uiBytes);
+      ssize_t iRes = (request.eOp == FIO_READ) ? pread(request.fd, pData, uiSize - uiBytes, iOffset)
+                                               : pwrite(request.fd, pData, uiSize - uiBytes, iOffset);
+      if (iRes < 0)
+      {
+        if (errno == EINTR) continue;
+        return boost::system::error_code(errno, boost::system::system_category());
+      }
+      // end of file
+      if (iRes == 0) break;
+      uiBytes += static_cast<size_t>(iRes);
+    }
+    return boost::system::error_code();
+  }
+
+#ifdef CPPUTIL_USE_IO_URING
+  /// user data of the poll request on the eventfd that wakes the service thread
+  static const uint64_t WAKEUP_TAG = UINT64_MAX;
+
+  struct Ring
+  {
+    Ring()
+      :fd(-1),
+      pSqRing(nullptr),
+      uiSqRingSize(0),
+      pCqRing(nullptr),
+      uiCqRingSize(0),
+      pSqes(nullptr),
+      uiSqesSize(0)
+    {
+
+    }
+
+    int fd;
+    void* pSqRing;
+    size_t uiSqRingSize;
+    void* pCqRing;
+    size_t uiCqRingSize;
+    struct io_uring_sqe* pSqes;
+    size_t uiSqesSize;
+
+    unsigned* pSqHead;
+    unsigned* pSqTail;
+    unsigned uiSqMask;
+    unsigned uiSqEntries;
+    unsigned* pSqArray;
+
+    unsigned* pCqHead;
+    unsigned* pCqTail;
+    unsigned uiCqMask;
+    struct io_uring_cqe* pCqes;
+  };
+
+  /// a request in flight in the kernel
+  struct Slot
+  {
+    FileIoRequest request;
+    struct iovec iov;
+    size_t uiDone;
+  };
+
+  template <typename T>
+  static T* offsetPtr(void* pBase, uint32_t uiOffset)
+  {
+    return reinterpret_cast<T*>(static_cast<char*>(pBase) + uiOffset);
+  }
+
+  /// Must be called with m_mutex held
+  boost::system::error_code openRing()
+  {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // one additional entry for the wakeup poll
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, m_uiQueueDepth + 1, &params));
+    if (fd < 0)
+    {
+      return boost::system::error_code(errno, boost::system::system_category());
+    }
+
+    Ring ring;
+    ring.fd = fd;
+    ring.uiSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.uiCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool bSingleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (bSingleMmap)
+    {
+      ring.uiSqRingSize = ring.uiCqRingSize = std::max(ring.uiSqRingSize, ring.uiCqRingSize);
+    }
+    ring.pSqRing = mmap(nullptr, ring.uiSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring.pSqRing == MAP_FAILED)
+    {
+      boost::system::error_code ec(errno, boost::system::system_category());
+      ::close(fd);
+      return ec;
+    }
+    ring.pCqRing = bSingleMmap ? ring.pSqRing
+                               : mmap(nullptr, ring.uiCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    ring.uiSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* pSqes = (ring.pCqRing == MAP_FAILED) ? MAP_FAILED
+                                               : mmap(nullptr, ring.uiSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    int iEventFd = (pSqes == MAP_FAILED) ? -1 : eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (iEventFd < 0)
+    {
+      boost::system::error_code ec(errno, boost::system::system_category());
+      if (pSqes != MAP_FAILED) munmap(pSqes, ring.uiSqesSize);
+      if (!bSingleMmap && ring.pCqRing != MAP_FAILED) munmap(ring.pCqRing, ring.uiCqRingSize);
+      munmap(ring.pSqRing, ring.uiSqRingSize);
+      ::close(fd);
+      return ec;
+    }
+    ring.pSqes = static_cast<struct io_uring_sqe*>(pSqes);
+
+    ring.pSqHead = offsetPtr<unsigned>(ring.pSqRing, params.sq_off.head);
+    ring.pSqTail = offsetPtr<unsigned>(ring.pSqRing, params.sq_off.tail);
+    ring.uiSqMask = *offsetPtr<unsigned>(ring.pSqRing, params.sq_off.ring_mask);
+    ring.uiSqEntries = *offsetPtr<unsigned>(ring.pSqRing, params.sq_off.ring_entries);
+    ring.pSqArray = offsetPtr<unsigned>(ring.pSqRing, params.sq_off.array);
+    ring.pCqHead = offsetPtr<unsigned>(ring.pCqRing, params.cq_off.head);
+    ring.pCqTail = offsetPtr<unsigned>(ring.pCqRing, params.cq_off.tail);
+    ring.uiCqMask = *offsetPtr<unsigned>(ring.pCqRing, params.cq_off.ring_mask);
+    ring.pCqes = offsetPtr<struct io_uring_cqe>(ring.pCqRing, params.cq_off.cqes);
+
+    m_ring = ring;
+    m_iEventFd = iEventFd;
+    m_vSlots.resize(m_uiQueueDepth);
+    m_vFreeSlots.clear();
+    for (uint32_t i = 0; i < m_uiQueueDepth; ++i)
+    {
+      m_vFreeSlots.push_back(m_uiQueueDepth - 1 - i);
+    }
+    VLOG(15) << "io_uring created with " << ring.uiSqEntries << " entries";
+    return boost::system::error_code();
+  }
+
+  /// Called by the service thread once the event loop has exited
+  void closeRing()
+  {
+    {
+      // wake() writes to the eventfd with m_mutex held
+      boost::mutex::scoped_lock lock(m_mutex);
+      if (m_iEventFd >= 0) ::close(m_iEventFd);
+      m_iEventFd = -1;
+    }
+    if (m_ring.fd < 0) return;
+    munmap(m_ring.pSqes, m_ring.uiSqesSize);
+    if (m_ring.pCqRing != m_ring.pSqRing) munmap(m_ring.pCqRing, m_ring.uiCqRingSize);
+    munmap(m_ring.pSqRing, m_ring.uiSqRingSize);
+    ::close(m_ring.fd);
+    m_ring = Ring();
+  }
+
+  /// returns the next free submission entry. The ring has room for all slots and the wakeup poll.
+  struct io_uring_sqe* nextSqe()
+  {
+    unsigned uiTail = *m_ring.pSqTail;
+    unsigned uiIndex = uiTail & m_ring.uiSqMask;
+    struct io_uring_sqe* pSqe = &m_ring.pSqes[uiIndex];
+    memset(pSqe, 0, sizeof(*pSqe));
+    m_ring.pSqArray[uiIndex] = uiIndex;
+    return pSqe;
+  }
+
+  void commitSqe()
+  {
+    // publishes the entry to the kernel
+    __atomic_store_n(m_ring.pSqTail, *m_ring.pSqTail + 1, __ATOMIC_RELEASE);
+  }
+
+  void prepareWakeup()
+  {
+    struct io_uring_sqe* pSqe = nextSqe();
+    pSqe->opcode = IORING_OP_POLL_ADD;
+    pSqe->fd = m_iEventFd;
+    pSqe->poll_events = POLLIN;
+    pSqe->user_data = WAKEUP_TAG;
+    commitSqe();
+  }
+
+  void prepareSlot(uint32_t uiSlot)
+  {
+    Slot& slot = m_vSlots[uiSlot];
+    struct io_uring_sqe* pSqe = nextSqe();
+    pSqe->fd = slot.request.fd;
+    pSqe->user_data = uiSlot;
+    if (slot.request.eOp == FIO_DATASYNC)
+    {
+      pSqe->opcode = IORING_OP_FSYNC;
+      pSqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    }
+    else
+    {
+      pSqe->opcode = (slot.request.eOp == FIO_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+      slot.iov.iov_base = &slot.request.buffer[0] + slot.uiDone;
+      slot.iov.iov_len = slot.request.buffer.getSize() - slot.uiDone;
+      pSqe->addr = reinterpret_cast<uint64_t>(&slot.iov);
+      pSqe->len = 1;
+      pSqe->off = slot.request.uiOffset + slot.uiDone;
+    }
+    commitSqe();
+  }
+
+  void releaseSlot(uint32_t uiSlot, const boost::system::error_code& ec)
+  {
+    Slot& slot = m_vSlots[uiSlot];
+    complete(slot.request, ec, slot.uiDone);
+    // release the buffer
+    slot.request = FileIoRequest();
+    m_vFreeSlots.push_back(uiSlot);
+  }
+
+  /// the event loop of the service thread in io_uring mode
+  boost::system::error_code runRing()
+  {
+    uint32_t uiInFlight = 0;
+    uint32_t uiToSubmit = 0;
+    prepareWakeup();
+    ++uiToSubmit;
+
+    std::vector<uint32_t> vReady;
+    for (;;)
+    {
+      bool bShutdown = false;
+      {
+        boost::mutex::scoped_lock lock(m_mutex);
+        while (!m_dqPending.empty() && !m_vFreeSlots.empty())
+        {
+          uint32_t uiSlot = m_vFreeSlots.back();
+          m_vFreeSlots.pop_back();
+          m_vSlots[uiSlot].request = std::move(m_dqPending.front());
+          m_vSlots[uiSlot].uiDone = 0;
+          m_dqPending.pop_front();
+          vReady.push_back(uiSlot);
+        }
+        bShutdown = m_bShutdown && m_dqPending.empty();
+      }
+      for (uint32_t uiSlot : vReady)
+      {
+        const FileIoRequest& request = m_vSlots[uiSlot].request;
+        if (request.eOp != FIO_DATASYNC && request.buffer.getSize() == 0)
+        {
+          releaseSlot(uiSlot, boost::system::error_code());
+          continue;
+        }
+        prepareSlot(uiSlot);
+        ++uiToSubmit;
+        ++uiInFlight;
+      }
+      vReady.clear();
+
+      if (bShutdown && uiInFlight == 0) break;
+
+      int iRes = static_cast<int>(syscall(__NR_io_uring_enter, m_ring.fd, uiToSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0));
+      if (iRes < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+        boost::system::error_code ec(errno, boost::system::system_category());
+        LOG(ERROR) << "io_uring_enter failed: " << ec.message();
+        return ec;
+      }
+      uiToSubmit -= static_cast<uint32_t>(iRes);
+
+      // reap completions
+      unsigned uiHead = *m_ring.pCqHead;
+      unsigned uiTail = __atomic_load_n(m_ring.pCqTail, __ATOMIC_ACQUIRE);
+      for (; uiHead != uiTail; ++uiHead)
+      {
+        const struct io_uring_cqe& cqe = m_ring.pCqes[uiHead & m_ring.uiCqMask];
+        if (cqe.user_data == WAKEUP_TAG)
+        {
+          uint64_t uiValue = 0;
+          ssize_t iRead = ::read(m_iEventFd, &uiValue, sizeof(uiValue));
+          (void)iRead;
+          prepareWakeup();
+          ++uiToSubmit;
+          continue;
+        }
+        uint32_t uiSlot = static_cast<uint32_t>(cqe.user_data);
+        Slot& slot = m_vSlots[uiSlot];
+        if (cqe.res < 0)
+        {
+          --uiInFlight;
+          releaseSlot(uiSlot, boost::system::error_code(-cqe.res, boost::system::system_category()));
+          continue;
+        }
+        slot.uiDone += static_cast<size_t>(cqe.res);
+        if (slot.request.eOp != FIO_DATASYNC && cqe.res > 0 && slot.uiDone < slot.request.buffer.getSize())
+        {
+          // partial transfer: continue with the remainder
+          prepareSlot(uiSlot);
+          ++uiToSubmit;
+          continue;
+        }
+        --uiInFlight;
+        releaseSlot(uiSlot, boost::system::error_code());
+      }
+      __atomic_store_n(m_ring.pCqHead, uiHead, __ATOMIC_RELEASE);
+    }
+    VLOG(15) << "Async file I/O complete";
+    return boost::system::error_code();
+  }
+
+  Ring m_ring;
+  /// only accessed by the service thread once started
+  std::vector<Slot> m_vSlots;
+  std::vector<uint32_t> m_vFreeSlots;
+#else
+  void closeRing() {}
+#endif
+
+  boost::asio::io_service& m_rIoService;
+  const uint32_t m_uiQueueDepth;
+  const uint32_t m_uiThreads;
+  const bool m_bUseIoUring;
+
+  mutable boost::mutex m_mutex;
+  boost::condition_variable m_condition;
+  std::deque<FileIoRequest> m_dqPending;
+  bool m_bShutdown;
+  /// wakes the service thread in io_uring mode, -1 otherwise
+  int m_iEventFd;
+};
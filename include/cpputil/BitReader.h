@@ -9,7 +9,7 @@
 class BitReader
 {
 public:
-  BitReader(const uint8_t* pStream, uint32_t uiLength)
+  BitReader(const uint8_t* pStream, uint64_t uiLength)
     :m_pBitStream(pStream),
       m_uiLength(uiLength),
       m_uiBitsRemaining(uiLength << 3),
@@ -19,8 +19,8 @@ public:
 
   }
 
-  uint32_t getBitsRemaining() const { return m_uiBitsRemaining; }
-  uint32_t getBytesRemaining() const { return (m_uiBitsRemaining >> 3); }
+  uint64_t getBitsRemaining() const { return m_uiBitsRemaining; }
+  uint64_t getBytesRemaining() const { return (m_uiBitsRemaining >> 3); }
 
   bool read(uint32_t& uiValue, uint32_t uiBits)
   {
@@ -121,9 +121,9 @@ public:
   }
 
   // this method can only be called on byte boundaries
-  bool readBytes(uint8_t*& rDestination, uint32_t uiBytes)
+  bool readBytes(uint8_t*& rDestination, uint64_t uiBytes)
   {
-    uint32_t uiBits = uiBytes << 3;
+    uint64_t uiBits = uiBytes << 3;
     if ((m_uiBitsInCurrentByte != 8) ||
         (uiBits > m_uiBitsRemaining)
        )
@@ -131,40 +131,31 @@ public:
       return false;
     }
 
-    memcpy(rDestination, &m_pBitStream[m_uiCurrentBytePos], uiBytes);
+    memcpy(rDestination, &m_pBitStream[m_uiCurrentBytePos], static_cast<size_t>(uiBytes));
     // update total
     m_uiBitsRemaining -= uiBits;
     m_uiCurrentBytePos += uiBytes;
     return true;
   }
 
-  bool skipBits(uint32_t uiBits)
+  bool skipBits(uint64_t uiBits)
   {
     if (uiBits > m_uiBitsRemaining)
     {
       return false;
     }
 
-    uint32_t uiBitsRemaining = uiBits;
-    while (uiBitsRemaining)
-    {
-      uint32_t uiBitsToReadInCurrentByte = std::min(m_uiBitsInCurrentByte, uiBitsRemaining);
-      // preserve old value
-      m_uiBitsInCurrentByte -= uiBitsToReadInCurrentByte;
-      if (m_uiBitsInCurrentByte == 0)
-      {
-        m_uiBitsInCurrentByte = 8;
-        ++m_uiCurrentBytePos;
-      }
-      uiBitsRemaining -= uiBitsToReadInCurrentByte;
-    }
+    // bit offset from the start of the current byte after skipping
+    uint64_t uiBitOffset = (8 - m_uiBitsInCurrentByte) + uiBits;
+    m_uiCurrentBytePos += uiBitOffset >> 3;
+    m_uiBitsInCurrentByte = 8 - static_cast<uint32_t>(uiBitOffset & 7);
     m_uiBitsRemaining -= uiBits;
     return true;
   }
 
-  bool skipBytes(uint32_t uiBytes)
+  bool skipBytes(uint64_t uiBytes)
   {
-    uint32_t uiBits = uiBytes << 3;
+    uint64_t uiBits = uiBytes << 3;
     if ((m_uiBitsInCurrentByte != 8) ||
       (uiBits > m_uiBitsRemaining)
       )
@@ -184,9 +175,9 @@ public:
 
 private:
   const uint8_t* m_pBitStream;
-  uint32_t m_uiLength;
+  uint64_t m_uiLength;
 
-  uint32_t m_uiBitsRemaining;
+  uint64_t m_uiBitsRemaining;
   uint32_t m_uiBitsInCurrentByte;
-  uint32_t m_uiCurrentBytePos;
+  uint64_t m_uiCurrentBytePos;
 };
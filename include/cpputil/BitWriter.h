@@ -18,13 +18,13 @@ class BitWriter
 {
 public:
 
-  BitWriter(uint8_t* pDestination, uint32_t uiLength)
+  BitWriter(uint8_t* pDestination, uint64_t uiLength)
     :m_uiBufferSize(uiLength),
     m_pDestination(pDestination),
     m_uiBitsLeft(8),
     m_uiCurrentBytePos(0)
   {
-    memset(m_pDestination, 0, m_uiBufferSize);
+    memset(m_pDestination, 0, static_cast<size_t>(m_uiBufferSize));
   }
 
   /**
@@ -36,7 +36,7 @@ public:
   {
     m_uiBitsLeft = 8;
     m_uiCurrentBytePos = 0;
-    memset(m_pDestination, 0, m_uiBufferSize);
+    memset(m_pDestination, 0, static_cast<size_t>(m_uiBufferSize));
   }
 
   bool write8Bits(uint8_t uiValue)
@@ -148,13 +148,13 @@ public:
   }
 
   // this method can only be called on byte boundaries
-  bool writeBytes(const uint8_t*& rSrc, uint32_t uiBytes)
+  bool writeBytes(const uint8_t*& rSrc, uint64_t uiBytes)
   {
     if ((m_uiBitsLeft != 8) || // check byte boundary
         ((m_uiBufferSize - m_uiCurrentBytePos) < uiBytes) // check buffer size
        )
          return false;
-    memcpy(&m_pDestination[m_uiCurrentBytePos], rSrc, uiBytes);
+    memcpy(&m_pDestination[m_uiCurrentBytePos], rSrc, static_cast<size_t>(uiBytes));
     m_uiCurrentBytePos += uiBytes;
     return true;
   }
@@ -174,9 +174,9 @@ public:
           LOG(WARNING) << "WARN: Byte pos: " << m_uiCurrentBytePos << " Size: " << m_uiBufferSize;
       }
       assert (m_uiCurrentBytePos <= m_uiBufferSize);
-      uint32_t uiBytesLeft = m_uiBufferSize - m_uiCurrentBytePos;
+      uint64_t uiBytesLeft = m_uiBufferSize - m_uiCurrentBytePos;
 
-      uint32_t uiBytesToCopy = in.getBytesRemaining();
+      uint64_t uiBytesToCopy = in.getBytesRemaining();
       if (uiBytesToCopy > uiBytesLeft)
       {
         return false;
@@ -191,7 +191,7 @@ public:
 
   // this method writes all bytes remaining in the IBitStream to the output stream
   // TODO: make this method handle non-byte boundary data
-  bool write(IBitStream& in, uint32_t uiBytesToCopy)
+  bool write(IBitStream& in, uint64_t uiBytesToCopy)
   {
 #if 0
       VLOG(5) << "bits left: " << m_uiBitsLeft << " bits remaining: " << in.m_uiBitsRemaining << " Bytes: " << in.getBytesRemaining() << " To copy: " << uiBytesToCopy;
@@ -207,7 +207,7 @@ public:
           LOG(WARNING) << "WARN: Byte pos: " << m_uiCurrentBytePos << " Size: " << m_uiBufferSize;
       }
       assert (m_uiCurrentBytePos <= m_uiBufferSize);
-      uint32_t uiBytesLeft = m_uiBufferSize - m_uiCurrentBytePos;
+      uint64_t uiBytesLeft = m_uiBufferSize - m_uiCurrentBytePos;
 
       if (uiBytesToCopy > uiBytesLeft)
       {
@@ -220,12 +220,12 @@ public:
       return bRes;
   }
 
-  uint32_t bytesUsed() const
+  uint64_t bytesUsed() const
   {
     return m_uiCurrentBytePos + (m_uiBitsLeft == 8 ? 0 : 1);
   }
 
-  uint32_t totalBitsLeft() const
+  uint64_t totalBitsLeft() const
   {
     return  m_uiBitsLeft + 8 * (m_uiBufferSize - m_uiCurrentBytePos - 1);
   }
@@ -235,11 +235,11 @@ public:
     // copy all bits to a buffer
     Buffer buffer;
     // first calculate size of buffer required
-    uint32_t uiSize = bytesUsed();
+    uint64_t uiSize = bytesUsed();
     if (uiSize)
     {
       buffer.setData(new uint8_t[uiSize], uiSize);
-      memcpy(&buffer[0], &m_pDestination[0], uiSize);
+      memcpy(&buffer[0], &m_pDestination[0], static_cast<size_t>(uiSize));
     }
     return buffer;
   }
@@ -291,12 +291,12 @@ private:
     }
   }
 
-  uint32_t m_uiBufferSize;
+  uint64_t m_uiBufferSize;
   uint8_t* m_pDestination;
   ///< Bits left in current byte
   uint32_t m_uiBitsLeft;
   ///< Current position in the buffer
-  uint32_t m_uiCurrentBytePos;
+  uint64_t m_uiCurrentBytePos;
 };
 
 
@@ -0,0 +1,557 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "Buffer.h"
+#include "ChunkedIBitStream.h"
+#include "ExceptionBase.h"
+
+/**
+ * @brief Fast LZ block compression for recorded data.
+ *
+ * Data is compressed in independent blocks. Each block is preceded by a 12 byte header: the
+ * magic "CPLZ", the uncompressed size and the stored size, both 32-bit big-endian. If the
+ * highest bit of the stored size is set, the block is stored uncompressed because it did not
+ * compress. Since every block is self-describing, the output of consecutive compress() calls
+ * can be appended to the same file and is read back as one stream.
+ *
+ * The block format is a sequence of LZ77 sequences: a token with the literal length in the
+ * high and the match length minus 4 in the low nibble, length extension bytes if a nibble is 15,
+ * the literals, a 16-bit little-endian match offset and the match length extension bytes.
+ * The last sequence consists of literals only. The compressor is a greedy single-probe hash
+ * matcher that skips faster through incompressible data, which trades compression ratio for speed.
+ *
+ * Usage:
+ *   FileUtil::writeFile(sFile, BlockCodec::compress(buffer), true);
+ *   ChunkedIBitStream ib(boost::make_shared<BlockDecompressorSource>(boost::make_shared<FileChunkSource>(sFile)));
+ */
+class BlockCodec
+{
+public:
+  static const uint32_t DEFAULT_BLOCK_SIZE = 1 << 16;
+  /// upper bound of the uncompressed block size accepted by the decoder
+  static const uint32_t MAX_BLOCK_SIZE = 1 << 26;
+  static const uint32_t HEADER_SIZE = 12;
+  /// set in the stored size of a block stored uncompressed
+  static const uint32_t STORED_RAW = 0x80000000;
+
+  /// returns the maximum size of a compressed block of uiSize bytes, excluding the block header
+  static size_t getMaxCompressedSize(size_t uiSize)
+  {
+    return uiSize + uiSize / 255 + 16;
+  }
+
+  /**
+   * @brief compressBlock compresses uiSize bytes into pDestination without a block header
+   * @param pDestination Must provide getMaxCompressedSize(uiSize) bytes
+   * @return the compressed size
+   */
+  static size_t compressBlock(const uint8_t* pSource, size_t uiSize, uint8_t* pDestination)
+  {
+    const uint8_t* const pEnd = pSource + uiSize;
+    const uint8_t* pAnchor = pSource;
+    uint8_t* pOut = pDestination;
+    if (uiSize > MIN_INPUT_SIZE)
+    {
+      // matches must leave the last bytes as literals, the last match can start at pMatchLimit
+      const uint8_t* const pMatchEnd = pEnd - LAST_LITERALS;
+      const uint8_t* const pMatchLimit = pMatchEnd - MIN_MATCH;
+      HashTable& table = getHashTable(uiSize);
+      uint32_t* pTable = &table.vEntries[0];
+      // positions are stored relative to the base of the block: older entries are below the base
+      const uint32_t uiBase = table.uiBase;
+      const uint8_t* pCurrent = pSource + 1;
+      while (pCurrent <= pMatchLimit)
+      {
+        uint32_t uiSequence = read32(pCurrent);
+        uint32_t uiHash = hash(uiSequence);
+        uint32_t uiEntry = pTable[uiHash];
+        pTable[uiHash] = uiBase + static_cast<uint32_t>(pCurrent - pSource);
+        // an entry of an earlier block is treated like a miss
+        const uint8_t* pCandidate = (uiEntry >= uiBase) ? pSource + (uiEntry - uiBase) : pCurrent;
+        if (pCandidate >= pCurrent || pCurrent - pCandidate > MAX_OFFSET || read32(pCandidate) != uiSequence)
+        {
+          // step faster the longer no match has been found
+          pCurrent += 1 + ((pCurrent - pAnchor) >> SKIP_SHIFT);
+          continue;
+        }
+        // extend the match backwards into the pending literals
+        while (pCurrent > pAnchor && pCandidate > pSource && pCurrent[-1] == pCandidate[-1])
+        {
+          --pCurrent;
+          --pCandidate;
+        }
+        size_t uiMatchLength = MIN_MATCH + countMatching(pCurrent + MIN_MATCH, pCandidate + MIN_MATCH, pMatchEnd);
+        pOut = writeSequence(pOut, pAnchor, static_cast<size_t>(pCurrent - pAnchor),
+                             static_cast<uint32_t>(pCurrent - pCandidate), uiMatchLength);
+        pCurrent += uiMatchLength;
+        pAnchor = pCurrent;
+        if (pCurrent <= pMatchLimit)
+        {
+          // index a position within the match to find repetitions
+          pTable[hash(read32(pCurrent - 2))] = uiBase + static_cast<uint32_t>(pCurrent - 2 - pSource);
+        }
+      }
+      table.uiBase += static_cast<uint32_t>(uiSize);
+    }
+    return static_cast<size_t>(writeLiterals(pOut, pAnchor, static_cast<size_t>(pEnd - pAnchor)) - pDestination);
+  }
+
+  /**
+   * @brief decompressBlock decompresses a block without block header.
+   * The input is fully validated, corrupt data cannot cause reads or writes out of bounds.
+   * @return false if the data is corrupt or does not decompress to exactly uiSize bytes
+   */
+  static bool decompressBlock(const uint8_t* pSource, size_t uiCompressedSize, uint8_t* pDestination, size_t uiSize)
+  {
+    const uint8_t* pIn = pSource;
+    const uint8_t* const pInEnd = pSource + uiCompressedSize;
+    uint8_t* pOut = pDestination;
+    uint8_t* const pOutEnd = pDestination + uiSize;
+    while (pIn < pInEnd)
+    {
+      uint32_t uiToken = *pIn++;
+      size_t uiLiterals = uiToken >> 4;
+      if (uiLiterals == 15 && !readLength(pIn, pInEnd, uiLiterals)) return false;
+      if (uiLiterals > static_cast<size_t>(pInEnd - pIn) || uiLiterals > static_cast<size_t>(pOutEnd - pOut)) return false;
+      if (uiLiterals + WILD_COPY <= static_cast<size_t>(pInEnd - pIn) && uiLiterals + WILD_COPY <= static_cast<size_t>(pOutEnd - pOut))
+      {
+        wildCopy(pOut, pIn, uiLiterals);
+      }
+      else
+      {
+        memcpy(pOut, pIn, uiLiterals);
+      }
+      pIn += uiLiterals;
+      pOut += uiLiterals;
+      // the last sequence has no match
+      if (pIn == pInEnd) break;
+
+      if (pInEnd - pIn < 2) return false;
+      size_t uiOffset = pIn[0] | (static_cast<size_t>(pIn[1]) << 8);
+      pIn += 2;
+      if (uiOffset == 0 || uiOffset > static_cast<size_t>(pOut - pDestination)) return false;
+      size_t uiMatchLength = uiToken & 15;
+      if (uiMatchLength == 15 && !readLength(pIn, pInEnd, uiMatchLength)) return false;
+      uiMatchLength += MIN_MATCH;
+      if (uiMatchLength > static_cast<size_t>(pOutEnd - pOut)) return false;
+
+      const uint8_t* pMatch = pOut - uiOffset;
+      if (uiOffset >= WILD_COPY && uiMatchLength + WILD_COPY <= static_cast<size_t>(pOutEnd - pOut))
+      {
+        // each word is read from output that has already been written
+        wildCopy(pOut, pMatch, uiMatchLength);
+        pOut += uiMatchLength;
+      }
+      else if (uiOffset >= uiMatchLength)
+      {
+        memcpy(pOut, pMatch, uiMatchLength);
+        pOut += uiMatchLength;
+      }
+      else
+      {
+        // overlapping match, e.g. a run of a repeated pattern
+        for (size_t i = 0; i < uiMatchLength; ++i) *pOut++ = *pMatch++;
+      }
+    }
+    return pOut == pOutEnd;
+  }
+
+  /**
+   * @brief compress compresses the buffer into framed blocks
+   * @param buffer The data to be compressed
+   * @param uiBlockSize The uncompressed size of a block. Larger blocks compress better,
+   * smaller blocks make seeking in the decompressed stream cheaper.
+   * @return the framed blocks. The unused capacity is kept as post buffer.
+   */
+  static Buffer compress(const Buffer& buffer, uint32_t uiBlockSize = DEFAULT_BLOCK_SIZE)
+  {
+    size_t uiSize = buffer.getSize();
+    if (uiSize == 0) return Buffer();
+    if (uiBlockSize == 0) uiBlockSize = DEFAULT_BLOCK_SIZE;
+    if (uiBlockSize > MAX_BLOCK_SIZE) uiBlockSize = MAX_BLOCK_SIZE;
+    size_t uiBlocks = (uiSize + uiBlockSize - 1) / uiBlockSize;
+    size_t uiCapacity = uiBlocks * HEADER_SIZE + getMaxCompressedSize(uiSize) + uiBlocks * 16;
+    uint8_t* pOut = new uint8_t[uiCapacity];
+
+    const uint8_t* pIn = buffer.data();
+    size_t uiUsed = 0;
+    for (size_t uiPos = 0; uiPos < uiSize; uiPos += uiBlockSize)
+    {
+      uint32_t uiRawSize = static_cast<uint32_t>(std::min<size_t>(uiBlockSize, uiSize - uiPos));
+      uint8_t* pHeader = pOut + uiUsed;
+      uint8_t* pBlock = pHeader + HEADER_SIZE;
+      uint32_t uiStoredSize = static_cast<uint32_t>(compressBlock(pIn + uiPos, uiRawSize, pBlock));
+      if (uiStoredSize >= uiRawSize)
+      {
+        memcpy(pBlock, pIn + uiPos, uiRawSize);
+        uiStoredSize = uiRawSize | STORED_RAW;
+      }
+      writeHeader(pHeader, uiRawSize, uiStoredSize);
+      uiUsed += HEADER_SIZE + (uiStoredSize & ~STORED_RAW);
+    }
+    return Buffer(pOut, uiCapacity, 0, uiCapacity - uiUsed);
+  }
+
+  /**
+   * @brief decompress decompresses all blocks of the buffer
+   * @return false if the data is corrupt or truncated
+   */
+  static bool decompress(const Buffer& compressed, Buffer& decompressed)
+  {
+    const uint8_t* pIn = compressed.data();
+    size_t uiSize = compressed.getSize();
+    // the headers are parsed first to allocate the output once. readHeader bounds the raw size
+    // of each block by its stored size, so the allocation is bounded by the size of the input.
+    size_t uiTotal = 0;
+    for (size_t uiPos = 0; uiPos < uiSize; )
+    {
+      uint32_t uiRawSize = 0;
+      uint32_t uiStoredSize = 0;
+      if (uiSize - uiPos < HEADER_SIZE || !readHeader(pIn + uiPos, uiRawSize, uiStoredSize)) return false;
+      uiPos += HEADER_SIZE + (uiStoredSize & ~STORED_RAW);
+      if (uiPos > uiSize) return false;
+      uiTotal += uiRawSize;
+    }
+
+    decompressed = (uiTotal > 0) ? Buffer(new uint8_t[uiTotal], uiTotal) : Buffer();
+    uint8_t* pOut = decompressed.getBuffer().get();
+    for (size_t uiPos = 0; uiPos < uiSize; )
+    {
+      uint32_t uiRawSize = 0;
+      uint32_t uiStoredSize = 0;
+      readHeader(pIn + uiPos, uiRawSize, uiStoredSize);
+      if (!decodeBlock(pIn + uiPos + HEADER_SIZE, uiStoredSize, pOut, uiRawSize)) return false;
+      uiPos += HEADER_SIZE + (uiStoredSize & ~STORED_RAW);
+      pOut += uiRawSize;
+    }
+    return true;
+  }
+
+  /**
+   * @brief readHeader parses and validates a block header
+   * @return false if the header is invalid
+   */
+  static bool readHeader(const uint8_t* pHeader, uint32_t& uiRawSize, uint32_t& uiStoredSize)
+  {
+    if (memcmp(pHeader, "CPLZ", 4) != 0) return false;
+    uiRawSize = readBigEndian32(pHeader + 4);
+    uiStoredSize = readBigEndian32(pHeader + 8);
+    if (uiRawSize == 0 || uiRawSize > MAX_BLOCK_SIZE) return false;
+    if (uiStoredSize & STORED_RAW) return (uiStoredSize & ~STORED_RAW) == uiRawSize;
+    // a compressed byte decodes to at most MAX_EXPANSION bytes, so a corrupt header cannot
+    // claim more output than the stored data can produce
+    if (static_cast<uint64_t>(uiStoredSize) * MAX_EXPANSION < uiRawSize) return false;
+    return uiStoredSize <= getMaxCompressedSize(uiRawSize);
+  }
+
+  /// decodes the payload of a block with the stored size from its header
+  static bool decodeBlock(const uint8_t* pSource, uint32_t uiStoredSize, uint8_t* pDestination, uint32_t uiRawSize)
+  {
+    if (uiStoredSize & STORED_RAW)
+    {
+      memcpy(pDestination, pSource, uiRawSize);
+      return true;
+    }
+    return decompressBlock(pSource, uiStoredSize, pDestination, uiRawSize);
+  }
+
+private:
+  static const uint32_t MIN_MATCH = 4;
+  static const uint32_t LAST_LITERALS = 5;
+  static const uint32_t MIN_INPUT_SIZE = 12;
+  static const uint32_t MAX_OFFSET = 65535;
+  static const uint32_t HASH_BITS = 14;
+  static const uint32_t HASH_SIZE = 1 << HASH_BITS;
+  static const uint32_t SKIP_SHIFT = 6;
+  /// maximum ratio of decompressed to compressed size: each length extension byte adds at most 255 bytes
+  static const uint32_t MAX_EXPANSION = 255;
+  /// granularity of wildCopy
+  static const uint32_t WILD_COPY = 8;
+
+  static uint32_t read32(const uint8_t* p)
+  {
+    uint32_t uiValue;
+    memcpy(&uiValue, p, sizeof(uiValue));
+    return uiValue;
+  }
+
+  static uint64_t read64(const uint8_t* p)
+  {
+    uint64_t uiValue;
+    memcpy(&uiValue, p, sizeof(uiValue));
+    return uiValue;
+  }
+
+  /// copies uiLength bytes in words and may write up to WILD_COPY - 1 bytes beyond
+  static void wildCopy(uint8_t* pDestination, const uint8_t* pSource, size_t uiLength)
+  {
+    uint8_t* const pEnd = pDestination + uiLength;
+    do
+    {
+      memcpy(pDestination, pSource, WILD_COPY);
+      pDestination += WILD_COPY;
+      pSource += WILD_COPY;
+    } while (pDestination < pEnd);
+  }
+
+  /// Hash table of the compressor. It is reused by all blocks compressed in a thread.
+  struct HashTable
+  {
+    HashTable()
+      :vEntries(HASH_SIZE, 0),
+      uiBase(1)
+    {
+
+    }
+
+    std::vector<uint32_t> vEntries;
+    /// added to the positions of the current block. Entries below the base belong to earlier blocks.
+    uint32_t uiBase;
+  };
+
+  /// returns the table of the calling thread with room for the positions of a block of uiSize bytes
+  static HashTable& getHashTable(size_t uiSize)
+  {
+    static thread_local HashTable table;
+    if (table.uiBase > UINT32_MAX - uiSize)
+    {
+      // the base wraps around about every 4 GiB of input: clear the table instead
+      std::fill(table.vEntries.begin(), table.vEntries.end(), 0);
+      table.uiBase = 1;
+    }
+    return table;
+  }
+
+  static uint32_t hash(uint32_t uiSequence)
+  {
+    return (uiSequence * 2654435761U) >> (32 - HASH_BITS);
+  }
+
+  /// returns the number of equal bytes at p1 and p2, p1 is compared up to pLimit
+  static size_t countMatching(const uint8_t* p1, const uint8_t* p2, const uint8_t* pLimit)
+  {
+    const uint8_t* pStart = p1;
+    while (p1 + 8 <= pLimit && read64(p1) == read64(p2))
+    {
+      p1 += 8;
+      p2 += 8;
+    }
+    while (p1 < pLimit && *p1 == *p2)
+    {
+      ++p1;
+      ++p2;
+    }
+    return static_cast<size_t>(p1 - pStart);
+  }
+
+  static uint8_t* writeLength(uint8_t* pOut, size_t uiLength)
+  {
+    while (uiLength >= 255)
+    {
+      *pOut++ = 255;
+      uiLength -= 255;
+    }
+    *pOut++ = static_cast<uint8_t>(uiLength);
+    return pOut;
+  }
+
+  static bool readLength(const uint8_t*& pIn, const uint8_t* pInEnd, size_t& uiLength)
+  {
+    for (;;)
+    {
+      if (pIn == pInEnd) return false;
+      uint8_t uiByte = *pIn++;
+      uiLength += uiByte;
+      if (uiByte != 255) return true;
+    }
+  }
+
+  static uint8_t* writeLiterals(uint8_t* pOut, const uint8_t* pLiterals, size_t uiLiterals)
+  {
+    uint8_t* pToken = pOut++;
+    if (uiLiterals >= 15)
+    {
+      *pToken = 15 << 4;
+      pOut = writeLength(pOut, uiLiterals - 15);
+    }
+    else
+    {
+      *pToken = static_cast<uint8_t>(uiLiterals << 4);
+    }
+    memcpy(pOut, pLiterals, uiLiterals);
+    return pOut + uiLiterals;
+  }
+
+  static uint8_t* writeSequence(uint8_t* pOut, const uint8_t* pLiterals, size_t uiLiterals, uint32_t uiOffset, size_t uiMatchLength)
+  {
+    uint8_t* pToken = pOut;
+    pOut = writeLiterals(pOut, pLiterals, uiLiterals);
+    *pOut++ = static_cast<uint8_t>(uiOffset);
+    *pOut++ = static_cast<uint8_t>(uiOffset >> 8);
+    size_t uiLength = uiMatchLength - MIN_MATCH;
+    if (uiLength >= 15)
+    {
+      *pToken |= 15;
+      pOut = writeLength(pOut, uiLength - 15);
+    }
+    else
+    {
+      *pToken |= static_cast<uint8_t>(uiLength);
+    }
+    return pOut;
+  }
+
+  static void writeHeader(uint8_t* pHeader, uint32_t uiRawSize, uint32_t uiStoredSize)
+  {
+    memcpy(pHeader, "CPLZ", 4);
+    writeBigEndian32(pHeader + 4, uiRawSize);
+    writeBigEndian32(pHeader + 8, uiStoredSize);
+  }
+
+  static void writeBigEndian32(uint8_t* p, uint32_t uiValue)
+  {
+    p[0] = static_cast<uint8_t>(uiValue >> 24);
+    p[1] = static_cast<uint8_t>(uiValue >> 16);
+    p[2] = static_cast<uint8_t>(uiValue >> 8);
+    p[3] = static_cast<uint8_t>(uiValue);
+  }
+
+  static uint32_t readBigEndian32(const uint8_t* p)
+  {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+        (static_cast<uint32_t>(p[2]) << 8) | p[3];
+  }
+};
+
+/**
+ * @brief Streaming decompressor that feeds a ChunkedIBitStream from a source of framed blocks
+ * e.g. a FileChunkSource. Only the current block is kept decompressed, so memory use is bounded
+ * by the block size. The block headers seen so far are indexed: seeking backwards decompresses
+ * only the block containing the target, seeking forwards skips blocks by their headers without
+ * decompressing them. Corrupt or truncated data causes an ExceptionBase to be thrown.
+ */
+class BlockDecompressorSource : public ChunkSource
+{
+public:
+  explicit BlockDecompressorSource(boost::shared_ptr<ChunkSource> pSource)
+    :m_pSource(pSource),
+    m_uiCurrentBlock(NO_BLOCK),
+    m_bEnd(false)
+  {
+
+  }
+
+  virtual uint32_t read(uint64_t uiOffset, uint8_t* pDestination, uint32_t uiBytes)
+  {
+    uint32_t uiCopied = 0;
+    while (uiCopied < uiBytes)
+    {
+      size_t uiBlock = 0;
+      if (!findBlock(uiOffset + uiCopied, uiBlock)) break;
+      loadBlock(uiBlock);
+      const BlockInfo& block = m_vBlocks[uiBlock];
+      uint32_t uiPosInBlock = static_cast<uint32_t>(uiOffset + uiCopied - block.uiRawOffset);
+      uint32_t uiAvailable = std::min(block.uiRawSize - uiPosInBlock, uiBytes - uiCopied);
+      memcpy(pDestination + uiCopied, &m_vBlock[uiPosInBlock], uiAvailable);
+      uiCopied += uiAvailable;
+    }
+    return uiCopied;
+  }
+
+private:
+  static const size_t NO_BLOCK = static_cast<size_t>(-1);
+
+  struct BlockInfo
+  {
+    BlockInfo(uint64_t rawOffset, uint64_t sourceOffset, uint32_t rawSize, uint32_t storedSize)
+      :uiRawOffset(rawOffset),
+      uiSourceOffset(sourceOffset),
+      uiRawSize(rawSize),
+      uiStoredSize(storedSize)
+    {
+
+    }
+
+    /// offset of the decompressed data of the block
+    uint64_t uiRawOffset;
+    /// offset of the block header in the source
+    uint64_t uiSourceOffset;
+    uint32_t uiRawSize;
+    /// stored size including the STORED_RAW flag
+    uint32_t uiStoredSize;
+  };
+
+  static bool compareOffset(uint64_t uiOffset, const BlockInfo& block)
+  {
+    return uiOffset < block.uiRawOffset;
+  }
+
+  /// finds the block containing uiOffset, reading block headers as required. Returns false at the end of the data.
+  bool findBlock(uint64_t uiOffset, size_t& uiBlock)
+  {
+    while (m_vBlocks.empty() || uiOffset >= m_vBlocks.back().uiRawOffset + m_vBlocks.back().uiRawSize)
+    {
+      if (!readNextHeader()) return false;
+    }
+    std::vector<BlockInfo>::const_iterator it = std::upper_bound(m_vBlocks.begin(), m_vBlocks.end(), uiOffset, compareOffset);
+    uiBlock = static_cast<size_t>(it - m_vBlocks.begin()) - 1;
+    return true;
+  }
+
+  bool readNextHeader()
+  {
+    if (m_bEnd) return false;
+    uint64_t uiSourceOffset = 0;
+    uint64_t uiRawOffset = 0;
+    if (!m_vBlocks.empty())
+    {
+      const BlockInfo& last = m_vBlocks.back();
+      uiSourceOffset = last.uiSourceOffset + BlockCodec::HEADER_SIZE + (last.uiStoredSize & ~BlockCodec::STORED_RAW);
+      uiRawOffset = last.uiRawOffset + last.uiRawSize;
+    }
+    uint8_t header[BlockCodec::HEADER_SIZE];
+    uint32_t uiRead = m_pSource->read(uiSourceOffset, header, BlockCodec::HEADER_SIZE);
+    if (uiRead == 0)
+    {
+      m_bEnd = true;
+      return false;
+    }
+    uint32_t uiRawSize = 0;
+    uint32_t uiStoredSize = 0;
+    if (uiRead < BlockCodec::HEADER_SIZE || !BlockCodec::readHeader(header, uiRawSize, uiStoredSize))
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("Invalid compressed block header"));
+    }
+    m_vBlocks.push_back(BlockInfo(uiRawOffset, uiSourceOffset, uiRawSize, uiStoredSize));
+    return true;
+  }
+
+  void loadBlock(size_t uiBlock)
+  {
+    if (uiBlock == m_uiCurrentBlock) return;
+    const BlockInfo& block = m_vBlocks[uiBlock];
+    uint32_t uiStoredSize = block.uiStoredSize & ~BlockCodec::STORED_RAW;
+    m_vBlock.resize(block.uiRawSize);
+    m_vCompressed.resize(uiStoredSize);
+    m_uiCurrentBlock = NO_BLOCK;
+    uint8_t* pCompressed = m_vCompressed.empty() ? nullptr : &m_vCompressed[0];
+    if (m_pSource->read(block.uiSourceOffset + BlockCodec::HEADER_SIZE, pCompressed, uiStoredSize) != uiStoredSize ||
+        !BlockCodec::decodeBlock(pCompressed, block.uiStoredSize, m_vBlock.empty() ? nullptr : &m_vBlock[0], block.uiRawSize))
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("Corrupt compressed block"));
+    }
+    m_uiCurrentBlock = uiBlock;
+  }
+
+  boost::shared_ptr<ChunkSource> m_pSource;
+  /// the blocks whose headers have been read
+  std::vector<BlockInfo> m_vBlocks;
+  size_t m_uiCurrentBlock;
+  std::vector<uint8_t> m_vBlock;
+  std::vector<uint8_t> m_vCompressed;
+  bool m_bEnd;
+};
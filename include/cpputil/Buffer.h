@@ -30,6 +30,21 @@ public:
     m_uiPrebuffer(0),
     m_uiPostbuffer(0)
   {}
+  /**
+   * @brief Buffer Constructor that takes ownership of the passed in buffer
+   * and releases it with the specified deleter instead of delete[]
+   * e.g. for memory-mapped or externally allocated memory.
+   * @param ptr The buffer that will be managed by this class
+   * @param size The size of the buffer to be managed
+   * @param deleter The callable invoked with ptr once the last copy of the buffer is destroyed
+   */
+  template <typename Deleter>
+  explicit Buffer(uint8_t* ptr, size_t size, Deleter deleter)
+    :m_buffer( DataBuffer_t(ptr, deleter) ),
+    m_uiSize(size),
+    m_uiPrebuffer(0),
+    m_uiPostbuffer(0)
+  {}
   /**
    * @brief Buffer Constructor that takes ownership of the passed in buffer.
    * The buffer contains prebuffer space to write data ahead of the data
@@ -0,0 +1,377 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include "ExceptionBase.h"
+#include "FileUtil.h"
+
+#ifndef _WIN32
+  #include <cerrno>
+  #include <fcntl.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+/**
+ * @brief Source of the data read by a ChunkedIBitStream.
+ * Data is read by absolute byte offset so that the stream can seek.
+ */
+class ChunkSource : public boost::noncopyable
+{
+public:
+  static const uint64_t UNKNOWN_SIZE = UINT64_MAX;
+
+  virtual ~ChunkSource() {}
+
+  /**
+   * @brief read copies up to uiBytes starting at uiOffset into pDestination
+   * @return the number of bytes copied. Fewer bytes than requested are only returned at the end of the data.
+   */
+  virtual uint32_t read(uint64_t uiOffset, uint8_t* pDestination, uint32_t uiBytes) = 0;
+
+  /// returns the total size of the data in bytes or UNKNOWN_SIZE
+  virtual uint64_t getSize() const { return UNKNOWN_SIZE; }
+};
+
+/**
+ * @brief Reads chunks from a file with positional reads. The file is kept open for the lifetime of the source.
+ */
+class FileChunkSource : public ChunkSource
+{
+public:
+  explicit FileChunkSource(const std::string& sFile)
+    :m_sFile(sFile),
+    m_uiSize(0)
+  {
+    open();
+  }
+
+  /**
+   * @brief FileChunkSource for a file that is read once from start to end. The kernel reads
+   * ahead of the cursor and the pages that have been read are dropped from the page cache as
+   * specified by the policy, see SequentialReadahead. Seeking is still supported.
+   * The chunk size of the ChunkedIBitStream should match policy.uiChunkSize.
+   */
+  FileChunkSource(const std::string& sFile, const ReadaheadPolicy& policy)
+    :m_sFile(sFile),
+    m_uiSize(0)
+  {
+    open();
+#ifndef _WIN32
+    m_pReadahead.reset(new SequentialReadahead(m_fd, m_uiSize, policy));
+#else
+    { policy; }
+#endif
+  }
+
+  ~FileChunkSource()
+  {
+#ifndef _WIN32
+    ::close(m_fd);
+#endif
+  }
+
+  virtual uint32_t read(uint64_t uiOffset, uint8_t* pDestination, uint32_t uiBytes)
+  {
+    if (uiOffset >= m_uiSize) return 0;
+    uiBytes = static_cast<uint32_t>(std::min<uint64_t>(uiBytes, m_uiSize - uiOffset));
+#ifdef _WIN32
+    m_in.clear();
+    m_in.seekg(static_cast<std::streamoff>(uiOffset), std::ios::beg);
+    m_in.read(reinterpret_cast<char*>(pDestination), uiBytes);
+    return static_cast<uint32_t>(m_in.gcount());
+#else
+    uint32_t uiRead = 0;
+    while (uiRead < uiBytes)
+    {
+      ssize_t iRes = pread(m_fd, pDestination + uiRead, uiBytes - uiRead, static_cast<off_t>(uiOffset + uiRead));
+      if (iRes < 0)
+      {
+        if (errno == EINTR) continue;
+        BOOST_THROW_EXCEPTION(ExceptionBase("Failed to read file " + m_sFile + ": " + strerror(errno)));
+      }
+      if (iRes == 0) break;
+      uiRead += static_cast<uint32_t>(iRes);
+    }
+    if (m_pReadahead) m_pReadahead->onRead(uiOffset, uiRead);
+    return uiRead;
+#endif
+  }
+
+  virtual uint64_t getSize() const { return m_uiSize; }
+
+private:
+  void open()
+  {
+#ifdef _WIN32
+    m_in.open(m_sFile.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!m_in.is_open())
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("Failed to open file " + m_sFile));
+    }
+    m_in.seekg(0, std::ios::end);
+    m_uiSize = static_cast<uint64_t>(m_in.tellg());
+#else
+    m_fd = ::open(m_sFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("Failed to open file " + m_sFile + ": " + strerror(errno)));
+    }
+    struct stat fileStat;
+    if (fstat(m_fd, &fileStat) < 0)
+    {
+      int iError = errno;
+      ::close(m_fd);
+      BOOST_THROW_EXCEPTION(ExceptionBase("Failed to stat file " + m_sFile + ": " + strerror(iError)));
+    }
+    m_uiSize = static_cast<uint64_t>(fileStat.st_size);
+#endif
+  }
+
+  std::string m_sFile;
+  uint64_t m_uiSize;
+#ifdef _WIN32
+  std::ifstream m_in;
+#else
+  int m_fd;
+  /// set in sequential mode
+  boost::scoped_ptr<SequentialReadahead> m_pReadahead;
+#endif
+};
+
+/**
+ * @brief Adapts a callback e.g. a network or decompression stream to a ChunkSource
+ */
+class CallbackChunkSource : public ChunkSource
+{
+public:
+  /// Same semantics as ChunkSource::read
+  typedef boost::function<uint32_t (uint64_t, uint8_t*, uint32_t)> ReadCallback_t;
+
+  explicit CallbackChunkSource(ReadCallback_t onRead, uint64_t uiSize = UNKNOWN_SIZE)
+    :m_onRead(onRead),
+    m_uiSize(uiSize)
+  {
+
+  }
+
+  virtual uint32_t read(uint64_t uiOffset, uint8_t* pDestination, uint32_t uiBytes)
+  {
+    return m_onRead(uiOffset, pDestination, uiBytes);
+  }
+
+  virtual uint64_t getSize() const { return m_uiSize; }
+
+private:
+  ReadCallback_t m_onRead;
+  uint64_t m_uiSize;
+};
+
+/**
+ * @brief Bit reader over data that does not fit into memory.
+ * The data is pulled from a ChunkSource one chunk at a time, so memory use is bounded by the
+ * chunk size. Fields may straddle chunk boundaries. Positions are 64-bit bit offsets.
+ * The read methods mirror IBitStream: if a field cannot be read completely, false is returned
+ * and the position is unchanged.
+ */
+class ChunkedIBitStream : public boost::noncopyable
+{
+public:
+  /**
+   * @brief ChunkedIBitStream
+   * @param pSource The source of the data
+   * @param uiChunkSize The number of bytes read from the source at a time
+   */
+  explicit ChunkedIBitStream(boost::shared_ptr<ChunkSource> pSource, uint32_t uiChunkSize = 1 << 20)
+    :m_pSource(pSource),
+    m_vChunk(std::max<uint32_t>(uiChunkSize, 8)),
+    m_uiChunkOffset(0),
+    m_uiChunkLength(0),
+    m_uiCurrentBytePos(0),
+    m_uiBitsInCurrentByte(8)
+  {
+
+  }
+
+  /// returns the size of the data in bits or ChunkSource::UNKNOWN_SIZE
+  uint64_t getSizeInBits() const
+  {
+    uint64_t uiSize = m_pSource->getSize();
+    return (uiSize == ChunkSource::UNKNOWN_SIZE) ? uiSize : (uiSize << 3);
+  }
+
+  /// returns the number of bits left or ChunkSource::UNKNOWN_SIZE if the size of the source is unknown
+  uint64_t getBitsRemaining() const
+  {
+    uint64_t uiSize = getSizeInBits();
+    return (uiSize == ChunkSource::UNKNOWN_SIZE) ? uiSize : uiSize - tell();
+  }
+
+  /// returns the current position in bits
+  uint64_t tell() const
+  {
+    return ((m_uiChunkOffset + m_uiCurrentBytePos) << 3) + (8 - m_uiBitsInCurrentByte);
+  }
+
+  /// returns true if the end of the data has been reached
+  bool isEof()
+  {
+    return !ensureData();
+  }
+
+  /**
+   * @brief seek moves to the specified bit position
+   * @return false if the position is beyond the end of a source of known size
+   */
+  bool seek(uint64_t uiBitPos)
+  {
+    uint64_t uiSize = getSizeInBits();
+    if (uiSize != ChunkSource::UNKNOWN_SIZE && uiBitPos > uiSize) return false;
+    uint64_t uiBytePos = uiBitPos >> 3;
+    if (uiBytePos >= m_uiChunkOffset && uiBytePos < m_uiChunkOffset + m_uiChunkLength)
+    {
+      // within the current chunk
+      m_uiCurrentBytePos = static_cast<uint32_t>(uiBytePos - m_uiChunkOffset);
+    }
+    else
+    {
+      // the chunk is loaded on the next read
+      m_uiChunkOffset = uiBytePos;
+      m_uiChunkLength = 0;
+      m_uiCurrentBytePos = 0;
+    }
+    m_uiBitsInCurrentByte = 8 - static_cast<uint32_t>(uiBitPos & 7);
+    return true;
+  }
+
+  bool skipBits(uint64_t uiBits)
+  {
+    return seek(tell() + uiBits);
+  }
+
+  // this method can only be called on byte boundaries
+  bool skipBytes(uint64_t uiBytes)
+  {
+    if (m_uiBitsInCurrentByte != 8) return false;
+    return seek(tell() + (uiBytes << 3));
+  }
+
+  bool read(uint64_t& uiValue, uint32_t uiBits)
+  {
+    if (uiBits > 64) return false;
+    return readBits(uiValue, uiBits);
+  }
+
+  bool read(uint32_t& uiValue, uint32_t uiBits)
+  {
+    return readAs(uiValue, uiBits);
+  }
+
+  // This method can only read 16 bits at a time
+  bool read(uint16_t& uiValue, uint32_t uiBits)
+  {
+    return readAs(uiValue, uiBits);
+  }
+
+  // This method can only read 8 bits at a time
+  bool read(uint8_t& uiValue, uint32_t uiBits)
+  {
+    return readAs(uiValue, uiBits);
+  }
+
+  // this method can only be called on byte boundaries
+  bool readBytes(uint8_t*& rDestination, uint32_t uiBytes)
+  {
+    if (m_uiBitsInCurrentByte != 8) return false;
+    uint64_t uiStart = tell();
+    uint32_t uiCopied = 0;
+    while (uiCopied < uiBytes)
+    {
+      if (!ensureData())
+      {
+        seek(uiStart);
+        return false;
+      }
+      uint32_t uiAvailable = std::min(m_uiChunkLength - m_uiCurrentBytePos, uiBytes - uiCopied);
+      memcpy(rDestination + uiCopied, &m_vChunk[m_uiCurrentBytePos], uiAvailable);
+      m_uiCurrentBytePos += uiAvailable;
+      uiCopied += uiAvailable;
+    }
+    return true;
+  }
+
+private:
+  template <typename T>
+  bool readAs(T& uiValue, uint32_t uiBits)
+  {
+    if (uiBits > sizeof(T) * 8) return false;
+    uint64_t uiValue64 = 0;
+    if (!readBits(uiValue64, uiBits)) return false;
+    uiValue = static_cast<T>(uiValue64);
+    return true;
+  }
+
+  /// makes sure that the current byte is loaded. Returns false at the end of the data.
+  bool ensureData()
+  {
+    if (m_uiCurrentBytePos < m_uiChunkLength) return true;
+    m_uiChunkOffset += m_uiChunkLength;
+    m_uiCurrentBytePos = 0;
+    m_uiChunkLength = m_pSource->read(m_uiChunkOffset, &m_vChunk[0], static_cast<uint32_t>(m_vChunk.size()));
+    return m_uiChunkLength > 0;
+  }
+
+  bool readBits(uint64_t& uiValue, uint32_t uiBits)
+  {
+    uint64_t uiBitsRemaining = getBitsRemaining();
+    if (uiBitsRemaining != ChunkSource::UNKNOWN_SIZE && uiBits > uiBitsRemaining)
+    {
+      return false;
+    }
+
+    uint64_t uiStart = tell();
+    uiValue = 0;
+    uint32_t uiBitsToRead = uiBits;
+    while (uiBitsToRead > 0)
+    {
+      if (!ensureData())
+      {
+        // the source ended in the middle of the field
+        seek(uiStart);
+        return false;
+      }
+      uint32_t uiBitsToReadInCurrentByte = std::min(m_uiBitsInCurrentByte, uiBitsToRead);
+      // preserve old value
+      uiValue <<= uiBitsToReadInCurrentByte;
+      // bits to shift by
+      uint32_t uiBitsToShiftBy = m_uiBitsInCurrentByte - uiBitsToReadInCurrentByte;
+      uint8_t uiMask = (2 << (uiBitsToReadInCurrentByte - 1)) - 1;
+      uiValue |= ((m_vChunk[m_uiCurrentBytePos] >> uiBitsToShiftBy) & uiMask);
+
+      m_uiBitsInCurrentByte -= uiBitsToReadInCurrentByte;
+      if (m_uiBitsInCurrentByte == 0)
+      {
+        m_uiBitsInCurrentByte = 8;
+        ++m_uiCurrentBytePos;
+      }
+      uiBitsToRead -= uiBitsToReadInCurrentByte;
+    }
+    return true;
+  }
+
+  boost::shared_ptr<ChunkSource> m_pSource;
+  std::vector<uint8_t> m_vChunk;
+  /// byte offset of the current chunk in the source
+  uint64_t m_uiChunkOffset;
+  uint32_t m_uiChunkLength;
+  uint32_t m_uiCurrentBytePos;
+  uint32_t m_uiBitsInCurrentByte;
+};
@@ -1,5 +1,9 @@
 #pragma once
+#include <atomic>
+#include <cstdint>
+#include <boost/asio/basic_deadline_timer.hpp>
 #include <boost/chrono.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 /** 
  * Timer based on boost chrono
@@ -23,3 +27,141 @@ public:
 typedef Timer<boost::chrono::system_clock> SystemClock_t;
 typedef Timer<boost::chrono::steady_clock> SteadyClock_t;
 typedef Timer<boost::chrono::high_resolution_clock> HighResolutionClock_t;
+
+/**
+ * @brief boost::chrono compatible clock that can be switched to virtual time.
+ * In real mode now() follows the steady clock. In simulated mode time only moves when it is
+ * advanced explicitly, or when the simulated event loop of the ServiceController jumps to the
+ * next timer deadline, so long-running scenarios complete as fast as the work allows.
+ * Virtual time continues from the steady clock when simulation is enabled, so timers that are
+ * already pending keep their deadlines; they fire once virtual time has been advanced to them.
+ */
+class SimulatedClock
+{
+public:
+  typedef boost::chrono::nanoseconds duration;
+  typedef duration::rep rep;
+  typedef duration::period period;
+  typedef boost::chrono::time_point<SimulatedClock> time_point;
+  static const bool is_steady = true;
+
+  static time_point now()
+  {
+    return time_point(duration(isSimulated() ? virtualNs().load() : realNs()));
+  }
+
+  /// switches between real and virtual time. Virtual time starts at the current real time.
+  static void setSimulated(bool bSimulated)
+  {
+    if (bSimulated)
+    {
+      virtualNs() = realNs();
+      nextDeadlineNs() = 0;
+    }
+    simulated() = bSimulated;
+  }
+
+  static bool isSimulated() { return simulated().load(std::memory_order_relaxed); }
+
+  /// moves virtual time forward by d
+  static void advance(duration d)
+  {
+    if (d.count() > 0) virtualNs() += d.count();
+  }
+
+  /// moves virtual time forward to tp. Virtual time never moves backwards.
+  static void advanceTo(time_point tp)
+  {
+    int64_t iNs = virtualNs().load();
+    while (iNs < tp.time_since_epoch().count() && !virtualNs().compare_exchange_weak(iNs, tp.time_since_epoch().count()))
+    {
+    }
+  }
+
+  /// registers a pending timer deadline so that advanceToNextDeadline() can jump to it
+  static void noteDeadline(time_point tp)
+  {
+    int64_t iDeadlineNs = tp.time_since_epoch().count();
+    int64_t iNext = nextDeadlineNs().load();
+    // replace the registered deadline if it has already passed or if the new deadline is earlier
+    while ((iNext <= virtualNs().load() || iDeadlineNs < iNext) && !nextDeadlineNs().compare_exchange_weak(iNext, iDeadlineNs))
+    {
+    }
+  }
+
+  /**
+   * @brief advanceToNextDeadline jumps virtual time to the earliest registered deadline
+   * @return false if no deadline later than the current virtual time is registered
+   */
+  static bool advanceToNextDeadline()
+  {
+    int64_t iNext = nextDeadlineNs().load();
+    if (iNext <= virtualNs().load()) return false;
+    advanceTo(time_point(duration(iNext)));
+    return true;
+  }
+
+private:
+  static int64_t realNs()
+  {
+    return boost::chrono::duration_cast<duration>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static std::atomic<bool>& simulated()
+  {
+    static std::atomic<bool> bSimulated(false);
+    return bSimulated;
+  }
+
+  static std::atomic<int64_t>& virtualNs()
+  {
+    static std::atomic<int64_t> iNs(0);
+    return iNs;
+  }
+
+  static std::atomic<int64_t>& nextDeadlineNs()
+  {
+    static std::atomic<int64_t> iNs(0);
+    return iNs;
+  }
+};
+
+typedef Timer<SimulatedClock> SimulatedClock_t;
+
+/**
+ * @brief Time traits for boost::asio::basic_deadline_timer that follow the SimulatedClock.
+ * Times are SimulatedClock times expressed as a ptime since 1970-01-01 in both modes, i.e. they
+ * follow the steady clock in real mode rather than wall-clock time, and a timer armed before
+ * simulation is enabled fires once virtual time reaches its deadline.
+ * In simulated mode the reactor is told not to wait for a timer; instead the deadline
+ * is registered with the SimulatedClock, which the event loop advances once it is idle.
+ */
+struct SimulatedTimeTraits
+{
+  typedef boost::posix_time::ptime time_type;
+  typedef boost::posix_time::time_duration duration_type;
+
+  static time_type now()
+  {
+    int64_t iUs = SimulatedClock::now().time_since_epoch().count() / 1000;
+    return time_type(boost::gregorian::date(1970, 1, 1)) + boost::posix_time::microseconds(iUs);
+  }
+
+  static time_type add(const time_type& t, const duration_type& d) { return t + d; }
+  static duration_type subtract(const time_type& t1, const time_type& t2) { return t1 - t2; }
+  static bool less_than(const time_type& t1, const time_type& t2) { return t1 < t2; }
+
+  /// called by the reactor with the time until the earliest deadline
+  static boost::posix_time::time_duration to_posix_duration(const duration_type& d)
+  {
+    if (!SimulatedClock::isSimulated()) return d;
+    if (d.total_microseconds() > 0)
+    {
+      SimulatedClock::noteDeadline(SimulatedClock::now() + boost::chrono::microseconds(d.total_microseconds()));
+    }
+    return boost::posix_time::time_duration(0, 0, 0, 0);
+  }
+};
+
+/// Deadline timer used by the ServiceController and ServiceManager so that they support simulated time
+typedef boost::asio::basic_deadline_timer<boost::posix_time::ptime, SimulatedTimeTraits> SimulatedDeadlineTimer_t;
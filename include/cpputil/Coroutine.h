@@ -0,0 +1,321 @@
+#pragma once
+
+#if !defined(__cpp_impl_coroutine) || __cplusplus < 202002L
+  #error "Coroutine.h requires a C++20 compiler with coroutine support (e.g. -std=c++20)"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/system/error_code.hpp>
+#include <glog/logging.h>
+#include "Clock.h"
+#include "ServiceController.h"
+
+/**
+ * C++20 coroutine support for services running on a ServiceController.
+ *
+ * A service coroutine returns coro::ServiceTask and starts executing in the calling thread.
+ * It typically hops onto the controller's io_service first:
+ *
+ *   coro::ServiceTask receiveLoop(ServiceController& controller)
+ *   {
+ *     co_await coro::schedule(controller);
+ *     SimulatedDeadlineTimer_t timer(controller.getIoService());
+ *     while (controller.isRunning())
+ *     {
+ *       co_await coro::sleepFor(timer, boost::posix_time::milliseconds(20));
+ *       ...
+ *       co_await coro::yield(controller);
+ *     }
+ *   }
+ *
+ * Coroutine frames are allocated from a thread-local frame pool and the awaiters live inside the frame,
+ * so a coroutine on the hot path does not allocate per await.
+ */
+namespace coro {
+
+/**
+ * @brief Thread-local, size-class based free list for coroutine frames.
+ * Frames up to MAX_POOLED_SIZE bytes are recycled; larger frames use the global heap.
+ * A frame freed on a different thread is recycled by that thread.
+ */
+class FrameAllocator
+{
+public:
+  static const std::size_t GRANULARITY = 64;
+  static const std::size_t MAX_POOLED_SIZE = 4096;
+  static const std::size_t SIZE_CLASSES = MAX_POOLED_SIZE / GRANULARITY;
+  /// upper bound of cached frames per size class and thread
+  static const uint32_t MAX_CACHED_PER_CLASS = 256;
+
+  static void* allocate(std::size_t uiSize)
+  {
+    if (uiSize > MAX_POOLED_SIZE) return ::operator new(uiSize);
+    FreeList& list = getPool().lists[sizeClass(uiSize)];
+    if (list.pHead)
+    {
+      Node* pNode = list.pHead;
+      list.pHead = pNode->pNext;
+      --list.uiCount;
+      return pNode;
+    }
+    return ::operator new((sizeClass(uiSize) + 1) * GRANULARITY);
+  }
+
+  static void deallocate(void* p, std::size_t uiSize)
+  {
+    if (uiSize > MAX_POOLED_SIZE)
+    {
+      ::operator delete(p);
+      return;
+    }
+    FreeList& list = getPool().lists[sizeClass(uiSize)];
+    if (list.uiCount >= MAX_CACHED_PER_CLASS)
+    {
+      ::operator delete(p);
+      return;
+    }
+    Node* pNode = static_cast<Node*>(p);
+    pNode->pNext = list.pHead;
+    list.pHead = pNode;
+    ++list.uiCount;
+  }
+
+private:
+  struct Node
+  {
+    Node* pNext;
+  };
+
+  struct FreeList
+  {
+    Node* pHead = nullptr;
+    uint32_t uiCount = 0;
+  };
+
+  struct Pool
+  {
+    FreeList lists[SIZE_CLASSES];
+
+    ~Pool()
+    {
+      for (FreeList& list : lists)
+      {
+        while (list.pHead)
+        {
+          Node* pNode = list.pHead;
+          list.pHead = pNode->pNext;
+          ::operator delete(pNode);
+        }
+      }
+    }
+  };
+
+  static std::size_t sizeClass(std::size_t uiSize)
+  {
+    return (uiSize == 0) ? 0 : (uiSize - 1) / GRANULARITY;
+  }
+
+  static Pool& getPool()
+  {
+    static thread_local Pool pool;
+    return pool;
+  }
+};
+
+/**
+ * @brief Return type of fire-and-forget service coroutines.
+ * The coroutine starts eagerly and its frame is released when it completes.
+ * Exceptions escaping the coroutine are logged in the same way ServiceController logs handler exceptions.
+ */
+class ServiceTask
+{
+public:
+  struct promise_type
+  {
+    ServiceTask get_return_object() { return ServiceTask(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+
+    void unhandled_exception()
+    {
+      try
+      {
+        throw;
+      }
+      catch(boost::exception& e)
+      {
+        LOG(ERROR) << "Boost Exception: " << boost::diagnostic_information(e);
+      }
+      catch(std::exception& e)
+      {
+        LOG(ERROR) << "Std Exception: " << e.what();
+      }
+      catch(...)
+      {
+        LOG(ERROR) << "Unknown exception in service coroutine";
+      }
+    }
+
+    static void* operator new(std::size_t uiSize)
+    {
+      return FrameAllocator::allocate(uiSize);
+    }
+
+    static void operator delete(void* p, std::size_t uiSize)
+    {
+      FrameAllocator::deallocate(p, uiSize);
+    }
+  };
+};
+
+namespace details {
+
+  /// Handler that resumes a suspended coroutine. Small enough for asio's recycled handler memory.
+  struct Resumer
+  {
+    std::coroutine_handle<> handle;
+
+    void operator()() const
+    {
+      handle.resume();
+    }
+  };
+
+  /// Timer handler that stores the error code in the awaiter before resuming
+  struct TimerResumer
+  {
+    std::coroutine_handle<> handle;
+    boost::system::error_code* pEc;
+
+    void operator()(const boost::system::error_code& ec) const
+    {
+      *pEc = ec;
+      handle.resume();
+    }
+  };
+
+  class PostAwaiter
+  {
+  public:
+    explicit PostAwaiter(boost::asio::io_service& ioService)
+      :m_ioService(ioService)
+    {
+
+    }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) { m_ioService.post(Resumer{handle}); }
+    void await_resume() const noexcept {}
+
+  private:
+    boost::asio::io_service& m_ioService;
+  };
+
+  /// Timer awaiter for boost::asio::deadline_timer and SimulatedDeadlineTimer_t
+  template <typename TimerType>
+  class TimerAwaiter
+  {
+  public:
+    TimerAwaiter(TimerType& timer, boost::posix_time::time_duration duration)
+      :m_timer(timer),
+      m_duration(duration)
+    {
+
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      m_timer.expires_from_now(m_duration);
+      m_timer.async_wait(TimerResumer{handle, &m_ec});
+    }
+
+    boost::system::error_code await_resume() const noexcept { return m_ec; }
+
+  private:
+    TimerType& m_timer;
+    boost::posix_time::time_duration m_duration;
+    boost::system::error_code m_ec;
+  };
+
+  /// Timer awaiter that owns its timer. The awaiter lives in the coroutine frame so no allocation is required.
+  /// The timer follows the SimulatedClock like the timers of the ServiceController.
+  class OwningTimerAwaiter
+  {
+  public:
+    OwningTimerAwaiter(boost::asio::io_service& ioService, boost::posix_time::time_duration duration)
+      :m_timer(ioService),
+      m_awaiter(m_timer, duration)
+    {
+
+    }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) { m_awaiter.await_suspend(handle); }
+    boost::system::error_code await_resume() const noexcept { return m_awaiter.await_resume(); }
+
+  private:
+    SimulatedDeadlineTimer_t m_timer;
+    TimerAwaiter<SimulatedDeadlineTimer_t> m_awaiter;
+  };
+
+} // namespace details
+
+/// Resumes the coroutine on a thread running the io_service
+inline details::PostAwaiter schedule(boost::asio::io_service& ioService)
+{
+  return details::PostAwaiter(ioService);
+}
+
+/// Resumes the coroutine on one of the controller's worker threads
+inline details::PostAwaiter schedule(ServiceController& controller)
+{
+  return details::PostAwaiter(controller.getIoService());
+}
+
+/// Lets other queued handlers run before the coroutine continues
+inline details::PostAwaiter yield(boost::asio::io_service& ioService)
+{
+  return details::PostAwaiter(ioService);
+}
+
+inline details::PostAwaiter yield(ServiceController& controller)
+{
+  return details::PostAwaiter(controller.getIoService());
+}
+
+/**
+ * @brief sleepFor suspends the coroutine until the timer expires.
+ * Reusing the same timer across awaits avoids re-registering a timer per await.
+ * Use a SimulatedDeadlineTimer_t to support simulated time.
+ * @return the error code of the wait, e.g. operation_aborted if the timer was cancelled
+ */
+inline details::TimerAwaiter<boost::asio::deadline_timer> sleepFor(boost::asio::deadline_timer& timer, boost::posix_time::time_duration duration)
+{
+  return details::TimerAwaiter<boost::asio::deadline_timer>(timer, duration);
+}
+
+inline details::TimerAwaiter<SimulatedDeadlineTimer_t> sleepFor(SimulatedDeadlineTimer_t& timer, boost::posix_time::time_duration duration)
+{
+  return details::TimerAwaiter<SimulatedDeadlineTimer_t>(timer, duration);
+}
+
+inline details::OwningTimerAwaiter sleepFor(boost::asio::io_service& ioService, boost::posix_time::time_duration duration)
+{
+  return details::OwningTimerAwaiter(ioService, duration);
+}
+
+inline details::OwningTimerAwaiter sleepFor(ServiceController& controller, boost::posix_time::time_duration duration)
+{
+  return details::OwningTimerAwaiter(controller.getIoService(), duration);
+}
+
+} // namespace coro
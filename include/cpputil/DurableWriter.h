@@ -0,0 +1,313 @@
+#pragma once
+
+#ifdef _WIN32
+  #error "DurableWriter.h requires POSIX file I/O (open, writev, fsync)"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <boost/asio/error.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <glog/logging.h>
+// POSIX
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "Buffer.h"
+#include "FileUtil.h"
+#include "ServiceThread.h"
+
+/// DurableWriter counters
+struct DurableWriterStats
+{
+  DurableWriterStats()
+    :uiRequests(0),
+    uiBytes(0),
+    uiGroups(0)
+  {
+
+  }
+
+  uint64_t uiRequests;
+  uint64_t uiBytes;
+  /// number of groups written, each with a single fdatasync
+  uint64_t uiGroups;
+};
+
+/**
+ * @brief Appends buffers to a file and completes each write only once it is durable.
+ *
+ * Writes from any number of threads are collected into groups. The service thread writes a
+ * group with writev and makes it durable with a single fdatasync, so the cost of the sync is
+ * shared by all writes of the group. While a group is being synced, new writes accumulate in
+ * the next group, so the group size adapts to the write rate and the sync latency of the disk.
+ * The buffers of a group are written in the order the writes were submitted.
+ *
+ * DurableWriter is a ServiceThread implementation:
+ *   ServiceThread<DurableWriter> writer(boost::in_place_init, "journal.dat");
+ *   writer.start();
+ *   boost::system::error_code ec = writer.get()->write(buffer);
+ * The completion handlers are called on the service thread and must not block. Writes
+ * submitted before stop() are completed before the service thread exits.
+ *
+ * Once a writev or fdatasync fails, the state of the file is unknown: a failed fdatasync may
+ * drop the dirty pages of the group and a failed writev may leave a torn record. The first
+ * error is therefore latched and all later writes fail with it until the service is restarted.
+ *
+ * DurableWriter uses POSIX file I/O and is not available on Windows. fdatasync is used on
+ * Linux, fsync elsewhere.
+ */
+class DurableWriter : public boost::noncopyable
+{
+public:
+  /**
+   * @brief DurableWriter
+   * @param sFile The file the buffers are appended to. It is created if it does not exist.
+   * @param bTruncate If true, the file is truncated when the service is started
+   */
+  explicit DurableWriter(const std::string& sFile, bool bTruncate = false)
+    :m_sFile(sFile),
+    m_bTruncate(bTruncate),
+    m_fd(-1),
+    m_bShutdown(true)
+  {
+
+  }
+
+  ~DurableWriter()
+  {
+    if (m_fd >= 0) ::close(m_fd);
+  }
+
+  /**
+   * @brief write queues the buffer to be appended. Can be called from any thread.
+   * @param buffer The data. It must not be modified until the handler has been called.
+   * @param onComplete Called on the service thread once the data is durable or has failed.
+   * If the writer is stopped or has failed, it is called in the calling thread.
+   */
+  void write(const Buffer& buffer, CompletionHandler_t onComplete)
+  {
+    boost::system::error_code ec = boost::asio::error::operation_aborted;
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      if (m_ecFailed)
+      {
+        ec = m_ecFailed;
+      }
+      else if (!m_bShutdown)
+      {
+        m_vPending.push_back(Request(buffer, onComplete));
+        m_condition.notify_one();
+        return;
+      }
+    }
+    if (onComplete) onComplete(ec);
+  }
+
+  /// appends the buffer and blocks until it is durable
+  boost::system::error_code write(const Buffer& buffer)
+  {
+    Waiter waiter;
+    write(buffer, boost::bind(&Waiter::onComplete, &waiter, boost::asio::placeholders::error));
+    return waiter.wait();
+  }
+
+  DurableWriterStats getStats() const
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_stats;
+  }
+
+  /// returns the latched error that fails all writes, or no error. It is reset when the service is started.
+  boost::system::error_code getError() const
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_ecFailed;
+  }
+
+  boost::system::error_code onStart()
+  {
+    if (m_fd >= 0)
+      return boost::system::error_code(boost::system::errc::operation_not_permitted, boost::system::generic_category());
+    bool bExists = boost::filesystem::exists(m_sFile);
+    int fd = ::open(m_sFile.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (m_bTruncate ? O_TRUNC : 0), 0644);
+    if (fd < 0)
+    {
+      boost::system::error_code ec(errno, boost::system::system_category());
+      LOG(WARNING) << "Failed to open " << m_sFile << ": " << ec.message();
+      return ec;
+    }
+    if (!bExists)
+    {
+      // the directory entry of a new file must be durable as well
+      syncDirectory();
+    }
+    m_fd = fd;
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_ecFailed = boost::system::error_code();
+    m_bShutdown = false;
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code start()
+  {
+    std::vector<Request> vGroup;
+    std::vector<struct iovec> vIov;
+    for (;;)
+    {
+      {
+        boost::mutex::scoped_lock lock(m_mutex);
+        while (m_vPending.empty() && !m_bShutdown)
+        {
+          m_condition.wait(lock);
+        }
+        if (m_vPending.empty()) break;
+        vGroup.swap(m_vPending);
+      }
+
+      // groups queued before the first error was latched fail without being written
+      boost::system::error_code ec = getError();
+      if (!ec)
+      {
+        uint64_t uiBytes = 0;
+        ec = writeGroup(vGroup, vIov, uiBytes);
+        if (!ec && syncData() < 0)
+        {
+          ec = boost::system::error_code(errno, boost::system::system_category());
+        }
+        boost::mutex::scoped_lock lock(m_mutex);
+        if (ec)
+        {
+          LOG(WARNING) << "Durable write to " << m_sFile << " failed, failing all further writes: " << ec.message();
+          m_ecFailed = ec;
+        }
+        m_stats.uiRequests += vGroup.size();
+        m_stats.uiBytes += uiBytes;
+        ++m_stats.uiGroups;
+      }
+      for (Request& request : vGroup)
+      {
+        if (request.onComplete) request.onComplete(ec);
+      }
+      vGroup.clear();
+    }
+    ::close(m_fd);
+    m_fd = -1;
+    VLOG(15) << "Durable writer complete";
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code stop()
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_bShutdown = true;
+    m_condition.notify_one();
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code onComplete()
+  {
+    return boost::system::error_code();
+  }
+
+private:
+  struct Request
+  {
+    Request(const Buffer& data, CompletionHandler_t handler)
+      :buffer(data),
+      onComplete(handler)
+    {
+
+    }
+
+    Buffer buffer;
+    CompletionHandler_t onComplete;
+  };
+
+  /// blocks a caller of write until its group has been synced
+  class Waiter
+  {
+  public:
+    Waiter() : m_bDone(false) {}
+
+    void onComplete(const boost::system::error_code& ec)
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_ec = ec;
+      m_bDone = true;
+      m_condition.notify_one();
+    }
+
+    boost::system::error_code wait()
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      while (!m_bDone) m_condition.wait(lock);
+      return m_ec;
+    }
+
+  private:
+    boost::mutex m_mutex;
+    boost::condition_variable m_condition;
+    bool m_bDone;
+    boost::system::error_code m_ec;
+  };
+
+  boost::system::error_code writeGroup(const std::vector<Request>& vGroup, std::vector<struct iovec>& vIov, uint64_t& uiBytes)
+  {
+    vIov.clear();
+    for (const Request& request : vGroup)
+    {
+      if (request.buffer.getSize() == 0) continue;
+      struct iovec iov;
+      iov.iov_base = const_cast<uint8_t*>(request.buffer.data());
+      iov.iov_len = request.buffer.getSize();
+      vIov.push_back(iov);
+    }
+
+    uint64_t uiCalls = 0;
+    return FileUtil::writevAll(m_fd, vIov, uiBytes, uiCalls);
+  }
+
+  int syncData()
+  {
+#if defined(__linux__)
+    return fdatasync(m_fd);
+#else
+    return fsync(m_fd);
+#endif
+  }
+
+  void syncDirectory()
+  {
+    boost::filesystem::path directory = boost::filesystem::absolute(m_sFile).parent_path();
+    int fd = ::open(directory.string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return;
+    if (fsync(fd) < 0)
+    {
+      LOG(WARNING) << "Failed to sync directory " << directory.string() << ": " << strerror(errno);
+    }
+    ::close(fd);
+  }
+
+  const std::string m_sFile;
+  const bool m_bTruncate;
+  /// only accessed by the service thread once started
+  int m_fd;
+
+  mutable boost::mutex m_mutex;
+  boost::condition_variable m_condition;
+  std::vector<Request> m_vPending;
+  bool m_bShutdown;
+  /// the first write or sync error, latched until the service is restarted
+  boost::system::error_code m_ecFailed;
+  DurableWriterStats m_stats;
+};
@@ -1,18 +1,43 @@
 #pragma once
 
 // STL
+#include <algorithm>
 #include <cassert>
+#include <ctime>
+#include <deque>
 #include <limits>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #ifndef _WIN32
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
 	#include <sys/statvfs.h>
+	#include <sys/uio.h>
+	#include <unistd.h>
+	#include <cerrno>
+	#include <climits>
+	#include <cstring>
+#endif
+#ifdef __linux__
+	#include <dirent.h>
+	#include <sys/syscall.h>
 #endif
 
 // boost
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/regex.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <glog/logging.h>
 
 // RTVC
 #include "Buffer.h"
@@ -20,6 +45,123 @@
 
 namespace bfs = boost::filesystem;
 
+/// A file found by FileUtil::scanDirectory
+struct FileInfo
+{
+  FileInfo()
+    :uiSize(0),
+    tModified(0)
+  {
+
+  }
+
+  FileInfo(const std::string& path, uint64_t size, std::time_t modified)
+    :sPath(path),
+    uiSize(size),
+    tModified(modified)
+  {
+
+  }
+
+  /// path relative to the scanned directory
+  std::string sPath;
+  uint64_t uiSize;
+  /// time of the last modification
+  std::time_t tModified;
+};
+
+/// Tuning of sequential file reads, see FileUtil::readFileSequentially and FileChunkSource
+struct ReadaheadPolicy
+{
+  ReadaheadPolicy(uint32_t chunkSize = 1 << 20, uint32_t ioDepth = 8, bool dropConsumed = true)
+    :uiChunkSize(chunkSize),
+    uiIoDepth(ioDepth),
+    bDropConsumed(dropConsumed)
+  {
+
+  }
+
+  /// number of bytes read at a time
+  uint32_t uiChunkSize;
+  /// number of chunks the kernel is asked to read ahead of the cursor. 0 disables the read-ahead hints.
+  uint32_t uiIoDepth;
+  /// if true, pages that have been read are dropped from the page cache
+  bool bDropConsumed;
+};
+
+/**
+ * @brief Issues page cache hints for a file that is read once from start to end.
+ * Pages up to uiIoDepth chunks ahead of the cursor are requested in the background with
+ * POSIX_FADV_WILLNEED, so the disk is kept busy while the data is processed. Pages behind the
+ * cursor are released with POSIX_FADV_DONTNEED, so a batch job does not evict the page cache
+ * of other processes. The hints are only issued in batches of at least half the window or one
+ * chunk to keep the number of system calls low. Failures only cost performance and are ignored.
+ * The hints are no-ops on platforms without posix_fadvise.
+ */
+class SequentialReadahead : public boost::noncopyable
+{
+public:
+  SequentialReadahead(int fd, uint64_t uiSize, const ReadaheadPolicy& policy)
+    :m_fd(fd),
+    m_uiSize(uiSize),
+    m_uiWindow(static_cast<uint64_t>(policy.uiChunkSize) * policy.uiIoDepth),
+    m_uiChunkSize(std::max<uint32_t>(policy.uiChunkSize, 1)),
+    m_bDropConsumed(policy.bDropConsumed),
+    m_uiAdvisedEnd(0),
+    m_uiDroppedEnd(0)
+  {
+#ifdef __linux__
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+
+  /// to be called after [uiOffset, uiOffset + uiLength) has been read
+  void onRead(uint64_t uiOffset, uint64_t uiLength)
+  {
+#ifdef __linux__
+    uint64_t uiCursor = std::min(uiOffset + uiLength, m_uiSize);
+    if (m_uiWindow > 0)
+    {
+      // restart the window after a seek
+      if (m_uiAdvisedEnd < uiCursor || uiCursor + m_uiWindow < m_uiAdvisedEnd) m_uiAdvisedEnd = uiCursor;
+      uint64_t uiTarget = std::min(uiCursor + m_uiWindow, m_uiSize);
+      if (uiTarget > m_uiAdvisedEnd && (uiTarget - m_uiAdvisedEnd >= std::max<uint64_t>(m_uiWindow / 2, m_uiChunkSize) || uiTarget == m_uiSize))
+      {
+        posix_fadvise(m_fd, static_cast<off_t>(m_uiAdvisedEnd), static_cast<off_t>(uiTarget - m_uiAdvisedEnd), POSIX_FADV_WILLNEED);
+        m_uiAdvisedEnd = uiTarget;
+      }
+    }
+    if (m_bDropConsumed)
+    {
+      // only whole pages can be dropped, the end of the file is dropped completely
+      uint64_t uiPageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+      // after a seek backwards, dropping continues from the new position
+      if (uiOffset < m_uiDroppedEnd) m_uiDroppedEnd = uiOffset - uiOffset % uiPageSize;
+      uint64_t uiDropEnd = (uiCursor == m_uiSize) ? m_uiSize : uiCursor - uiCursor % uiPageSize;
+      if (uiDropEnd > m_uiDroppedEnd && (uiDropEnd - m_uiDroppedEnd >= m_uiChunkSize || uiDropEnd == m_uiSize))
+      {
+        posix_fadvise(m_fd, static_cast<off_t>(m_uiDroppedEnd), static_cast<off_t>(uiDropEnd - m_uiDroppedEnd), POSIX_FADV_DONTNEED);
+        m_uiDroppedEnd = uiDropEnd;
+      }
+    }
+#else
+    { uiOffset; uiLength; }
+#endif
+  }
+
+private:
+  int m_fd;
+  uint64_t m_uiSize;
+  /// number of bytes read ahead of the cursor
+  uint64_t m_uiWindow;
+  uint32_t m_uiChunkSize;
+  bool m_bDropConsumed;
+  /// end of the range for which read-ahead has been requested
+  uint64_t m_uiAdvisedEnd;
+  /// end of the range that has been dropped from the page cache
+  uint64_t m_uiDroppedEnd;
+};
+
 /**
  * File utility functions
  */
@@ -39,16 +181,11 @@ public:
       std::streamoff length = in1.tellg();
       in1.seekg (0, std::ios::beg);
 
-      // Just in case
-      assert(length < UINT_MAX);
-      unsigned uiSize = static_cast<unsigned>(length);
-      char* szBuffer = new char[uiSize];
-      // read data as a block:
-      in1.read (szBuffer, length);
+      size_t uiSize = static_cast<size_t>(length);
+      // read data as a block directly into the string
+      std::string sFileContent(uiSize, '\0');
+      if (uiSize > 0) in1.read (&sFileContent[0], length);
       in1.close();
-
-      std::string sFileContent(szBuffer, uiSize);
-      delete[] szBuffer;
       return sFileContent;
     }
     else
@@ -70,9 +207,7 @@ public:
       std::streamoff length = in1.tellg();
       in1.seekg (0, std::ios::beg);
 
-      // Just in case
-      assert(length < UINT_MAX);
-      unsigned uiSize = static_cast<unsigned>(length);
+      size_t uiSize = static_cast<size_t>(length);
       uint8_t* pBuffer = new uint8_t[uiSize];
       Buffer buffer(pBuffer, uiSize);
       // read data as a block:
@@ -87,6 +222,130 @@ public:
     }
   }
 
+  /// Access pattern hint for memory-mapped files
+  enum MapAdvice
+  {
+    MA_NORMAL,
+    /// pages are read ahead aggressively and can be freed soon after they were read
+    MA_SEQUENTIAL,
+    /// read-ahead is disabled
+    MA_RANDOM,
+    /// the whole file is read ahead
+    MA_WILLNEED
+  };
+
+  /**
+   * @brief mapFileIntoBuffer maps the file into memory instead of reading it.
+   * Pages are only loaded when they are accessed, so parsing a large file touches only
+   * the pages that are read. The mapping is private: writes to the buffer are not written
+   * back to the file. The mapping is released when the last copy of the buffer is destroyed.
+   * On platforms without mmap the file is read into memory.
+   * @param sFile The file to be mapped
+   * @param eAdvice The expected access pattern
+   * @return the buffer, empty if the file is empty
+   */
+  static Buffer mapFileIntoBuffer(const std::string& sFile, MapAdvice eAdvice = MA_SEQUENTIAL)
+  {
+#ifdef _WIN32
+    { eAdvice; }
+    return readFileIntoBuffer(sFile, true);
+#else
+    int fd = ::open(sFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("Failed to open file " + sFile + ": " + strerror(errno)));
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0)
+    {
+      int iError = errno;
+      ::close(fd);
+      BOOST_THROW_EXCEPTION(ExceptionBase("Failed to stat file " + sFile + ": " + strerror(iError)));
+    }
+    size_t uiSize = static_cast<size_t>(fileStat.st_size);
+    if (uiSize == 0)
+    {
+      ::close(fd);
+      return Buffer();
+    }
+    void* pData = mmap(nullptr, uiSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    int iError = errno;
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+    if (pData == MAP_FAILED)
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("Failed to map file " + sFile + ": " + strerror(iError)));
+    }
+    adviseMapping(pData, uiSize, eAdvice);
+    return Buffer(static_cast<uint8_t*>(pData), uiSize, MunmapDeleter(uiSize));
+#endif
+  }
+
+  /// Receives the data of readFileSequentially. Returning false stops reading.
+  typedef boost::function<bool (const uint8_t*, size_t)> DataHandler_t;
+
+  /**
+   * @brief readFileSequentially reads the file once from start to end in chunks of
+   * policy.uiChunkSize bytes and passes each chunk to onData. The kernel is asked to read
+   * ahead of the cursor and, unless disabled in the policy, to drop the pages that have been
+   * read so that batch processing does not evict the page cache of other processes.
+   * @param sFile The file to be read
+   * @param onData Called for each chunk. The data is only valid during the call.
+   * @param policy The chunk size, read-ahead depth and cache behaviour
+   * @return the number of bytes passed to onData
+   */
+  static uint64_t readFileSequentially(const std::string& sFile, DataHandler_t onData, const ReadaheadPolicy& policy = ReadaheadPolicy())
+  {
+    std::vector<uint8_t> vChunk(std::max<uint32_t>(policy.uiChunkSize, 1));
+    uint64_t uiTotal = 0;
+#ifdef _WIN32
+    std::ifstream in1(sFile.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!in1.is_open())
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("Failed to open file " + sFile));
+    }
+    for (;;)
+    {
+      in1.read(reinterpret_cast<char*>(&vChunk[0]), vChunk.size());
+      size_t uiRead = static_cast<size_t>(in1.gcount());
+      if (uiRead == 0) break;
+      uiTotal += uiRead;
+      if (!onData(&vChunk[0], uiRead)) break;
+    }
+#else
+    int fd = ::open(sFile.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("Failed to open file " + sFile + ": " + strerror(errno)));
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) < 0)
+    {
+      int iError = errno;
+      ::close(fd);
+      BOOST_THROW_EXCEPTION(ExceptionBase("Failed to stat file " + sFile + ": " + strerror(iError)));
+    }
+    SequentialReadahead readahead(fd, static_cast<uint64_t>(fileStat.st_size), policy);
+    for (;;)
+    {
+      ssize_t iRes = ::read(fd, &vChunk[0], vChunk.size());
+      if (iRes < 0)
+      {
+        if (errno == EINTR) continue;
+        int iError = errno;
+        ::close(fd);
+        BOOST_THROW_EXCEPTION(ExceptionBase("Failed to read file " + sFile + ": " + strerror(iError)));
+      }
+      if (iRes == 0) break;
+      readahead.onRead(uiTotal, static_cast<uint64_t>(iRes));
+      uiTotal += static_cast<uint64_t>(iRes);
+      if (!onData(&vChunk[0], static_cast<size_t>(iRes))) break;
+    }
+    ::close(fd);
+#endif
+    return uiTotal;
+  }
+
   static bool writeFile(const std::string& sFileName, const std::string& sContent, bool bBinary)
   {
     std::ios_base::openmode mode = std::ios_base::out;
@@ -102,7 +361,7 @@ public:
     return false;
   }
 
-  static bool writeFile(const std::string& sFileName, const char* szBuffer, unsigned uiSize, bool bBinary)
+  static bool writeFile(const std::string& sFileName, const char* szBuffer, size_t uiSize, bool bBinary)
   {
     std::ios_base::openmode mode = std::ios_base::out;
     if (bBinary) mode |= std::ios_base::binary;
@@ -110,7 +369,7 @@ public:
     std::ofstream out1(sFileName.c_str(), mode);
     if (out1.is_open())
     {
-      out1.write(szBuffer, uiSize);
+      out1.write(szBuffer, static_cast<std::streamsize>(uiSize));
       out1.close();
       return true;
     }
@@ -132,6 +391,45 @@ public:
     return false;
   }
 
+#ifndef _WIN32
+  /**
+   * @brief writevAll writes the buffers described by vIov to fd, continuing partial writes and
+   * writes interrupted by signals. vIov is modified.
+   * @param uiBytesWritten Incremented by the number of bytes written, also if an error occurs
+   * @param uiCalls Incremented for each successful writev call
+   * @return the error of the writev call that failed
+   */
+  static boost::system::error_code writevAll(int fd, std::vector<struct iovec>& vIov, uint64_t& uiBytesWritten, uint64_t& uiCalls)
+  {
+    size_t uiIov = 0;
+    while (uiIov < vIov.size())
+    {
+      int iCount = static_cast<int>(std::min<size_t>(vIov.size() - uiIov, IOV_MAX));
+      ssize_t iRes = writev(fd, &vIov[uiIov], iCount);
+      if (iRes < 0)
+      {
+        if (errno == EINTR) continue;
+        return boost::system::error_code(errno, boost::system::system_category());
+      }
+      ++uiCalls;
+      uiBytesWritten += static_cast<uint64_t>(iRes);
+      // skip what has been written, a partial write continues within an iovec
+      size_t uiWritten = static_cast<size_t>(iRes);
+      while (uiIov < vIov.size() && uiWritten >= vIov[uiIov].iov_len)
+      {
+        uiWritten -= vIov[uiIov].iov_len;
+        ++uiIov;
+      }
+      if (uiWritten > 0)
+      {
+        vIov[uiIov].iov_base = static_cast<uint8_t*>(vIov[uiIov].iov_base) + uiWritten;
+        vIov[uiIov].iov_len -= uiWritten;
+      }
+    }
+    return boost::system::error_code();
+  }
+#endif
+
   static double calculateFreeSpacePercentage(const std::string& sRootDirectory)
   {
   #ifdef _WIN32
@@ -198,23 +496,17 @@ public:
   static std::vector<std::string> getFileList( const std::string& sPath, const std::string& sFileSignature )
   {
     std::vector<std::string> vFiles;
+    // compile the pattern once for all entries
+    boost::scoped_ptr<boost::regex> pPattern;
+    if (sFileSignature != "") pPattern.reset(new boost::regex(sFileSignature));
     bfs::directory_iterator end_iter;
     for ( bfs::directory_iterator dir_itr( sPath ); dir_itr != end_iter; ++dir_itr )
     {
       if (bfs::is_regular(dir_itr->status()))
       {
-        std::string sAbsoluteFileName = dir_itr->path().string();
         std::string sFileName = dir_itr->path().leaf().string();
-        if (sFileSignature != "")
-        {
-          const boost::regex e(sFileSignature);
-          //Try and match filname pattern
-          if (regex_search(sFileName, e))
-          {
-            vFiles.push_back(sFileName);
-          }
-        }
-        else
+        //Try and match filname pattern
+        if (!pPattern || regex_search(sFileName, *pPattern))
         {
           vFiles.push_back(sFileName);
         }
@@ -223,6 +515,51 @@ public:
     return vFiles;
   }
 
+  /**
+   * @brief scanDirectory lists the regular files below sPath including all subdirectories.
+   * On Linux the subdirectories are read in parallel with getdents64 and the size and modification
+   * time are taken from the directory scan, so callers do not need to stat the files again.
+   * Only files matching the pattern are stat'ed. Symbolic links are not followed and
+   * subdirectories that cannot be read are skipped.
+   * @param sPath The directory to scan
+   * @param sFileSignature Regular expression matched against the file name. Empty matches all files.
+   * @param uiThreads The number of threads reading directories. 0 uses one thread per core.
+   * @return the files sorted by their path relative to sPath
+   */
+  static std::vector<FileInfo> scanDirectory(const std::string& sPath, const std::string& sFileSignature = "", uint32_t uiThreads = 0)
+  {
+    boost::scoped_ptr<boost::regex> pPattern;
+    if (sFileSignature != "") pPattern.reset(new boost::regex(sFileSignature));
+
+    std::vector<FileInfo> vFiles;
+#ifdef __linux__
+    int iRootFd = ::open(sPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (iRootFd < 0)
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("Failed to open directory " + sPath + ": " + strerror(errno)));
+    }
+    if (uiThreads == 0) uiThreads = std::max(boost::thread::hardware_concurrency(), 1u);
+    DirectoryScan scan(iRootFd, pPattern.get());
+    scan.run(uiThreads);
+    ::close(iRootFd);
+    vFiles.swap(scan.getFiles());
+#else
+    { uiThreads; }
+    const size_t uiRootLength = bfs::path(sPath).string().length();
+    for (bfs::recursive_directory_iterator it(sPath), end; it != end; ++it)
+    {
+      if (!bfs::is_regular(it->status())) continue;
+      std::string sFileName = it->path().leaf().string();
+      if (pPattern && !regex_search(sFileName, *pPattern)) continue;
+      std::string sRelative = it->path().string().substr(uiRootLength);
+      while (!sRelative.empty() && (sRelative[0] == '/' || sRelative[0] == '\\')) sRelative.erase(0, 1);
+      vFiles.push_back(FileInfo(sRelative, bfs::file_size(it->path()), bfs::last_write_time(it->path())));
+    }
+#endif
+    std::sort(vFiles.begin(), vFiles.end(), compareByPath);
+    return vFiles;
+  }
+
   static bool fileExists(const std::string& sSource)
   {
     if (sSource.empty()) return false;
@@ -242,5 +579,175 @@ public:
     }
   }
 
+private:
+  static bool compareByPath(const FileInfo& lhs, const FileInfo& rhs)
+  {
+    return lhs.sPath < rhs.sPath;
+  }
+
+#ifdef __linux__
+  /// layout of the records returned by getdents64
+  struct LinuxDirent64
+  {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+  };
+
+  /**
+   * @brief Parallel scan of a directory tree for scanDirectory.
+   * Directories are queued by their path relative to the root directory and opened with openat,
+   * so the scan is not affected by the working directory and never resolves the root again.
+   */
+  class DirectoryScan : public boost::noncopyable
+  {
+  public:
+    DirectoryScan(int iRootFd, const boost::regex* pPattern)
+      :m_iRootFd(iRootFd),
+      m_pPattern(pPattern),
+      m_uiPending(1)
+    {
+      // the root directory
+      m_dqDirectories.push_back(std::string());
+    }
+
+    void run(uint32_t uiThreads)
+    {
+      boost::thread_group threads;
+      for (uint32_t i = 1; i < uiThreads; ++i)
+      {
+        threads.create_thread(boost::bind(&DirectoryScan::work, this));
+      }
+      work();
+      threads.join_all();
+    }
+
+    std::vector<FileInfo>& getFiles() { return m_vFiles; }
+
+  private:
+    void work()
+    {
+      std::vector<FileInfo> vFiles;
+      std::vector<std::string> vSubdirectories;
+      std::vector<char> vBuffer(64 * 1024);
+      for (;;)
+      {
+        std::string sDirectory;
+        {
+          boost::mutex::scoped_lock lock(m_mutex);
+          // the scan is complete once no directory is queued or being read
+          while (m_dqDirectories.empty() && m_uiPending > 0)
+          {
+            m_condition.wait(lock);
+          }
+          if (m_dqDirectories.empty()) break;
+          sDirectory.swap(m_dqDirectories.front());
+          m_dqDirectories.pop_front();
+        }
+
+        readDirectory(sDirectory, vBuffer, vFiles, vSubdirectories);
+
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_dqDirectories.insert(m_dqDirectories.end(), vSubdirectories.begin(), vSubdirectories.end());
+        m_uiPending += vSubdirectories.size();
+        --m_uiPending;
+        if (m_uiPending == 0 || !vSubdirectories.empty()) m_condition.notify_all();
+        vSubdirectories.clear();
+      }
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_vFiles.insert(m_vFiles.end(), vFiles.begin(), vFiles.end());
+    }
+
+    void readDirectory(const std::string& sDirectory, std::vector<char>& vBuffer, std::vector<FileInfo>& vFiles, std::vector<std::string>& vSubdirectories)
+    {
+      int fd = openat(m_iRootFd, sDirectory.empty() ? "." : sDirectory.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (fd < 0)
+      {
+        LOG(WARNING) << "Failed to open directory " << sDirectory << ": " << strerror(errno);
+        return;
+      }
+      for (;;)
+      {
+        long iRead = syscall(SYS_getdents64, fd, &vBuffer[0], vBuffer.size());
+        if (iRead <= 0)
+        {
+          if (iRead < 0) LOG(WARNING) << "Failed to read directory " << sDirectory << ": " << strerror(errno);
+          break;
+        }
+        for (long iOffset = 0; iOffset < iRead; )
+        {
+          const LinuxDirent64* pEntry = reinterpret_cast<const LinuxDirent64*>(&vBuffer[iOffset]);
+          iOffset += pEntry->d_reclen;
+          const char* szName = pEntry->d_name;
+          if (szName[0] == '.' && (szName[1] == '\0' || (szName[1] == '.' && szName[2] == '\0'))) continue;
+
+          unsigned char uiType = pEntry->d_type;
+          struct stat fileStat;
+          bool bStat = false;
+          if (uiType == DT_UNKNOWN)
+          {
+            // not all file systems report the type
+            if (fstatat(fd, szName, &fileStat, AT_SYMLINK_NOFOLLOW) < 0) continue;
+            bStat = true;
+            uiType = S_ISDIR(fileStat.st_mode) ? DT_DIR : (S_ISREG(fileStat.st_mode) ? DT_REG : DT_UNKNOWN);
+          }
+
+          if (uiType == DT_DIR)
+          {
+            vSubdirectories.push_back(sDirectory.empty() ? std::string(szName) : sDirectory + "/" + szName);
+          }
+          else if (uiType == DT_REG)
+          {
+            if (m_pPattern && !boost::regex_search(szName, *m_pPattern)) continue;
+            if (!bStat && fstatat(fd, szName, &fileStat, AT_SYMLINK_NOFOLLOW) < 0) continue;
+            vFiles.push_back(FileInfo(sDirectory.empty() ? std::string(szName) : sDirectory + "/" + szName,
+                                      static_cast<uint64_t>(fileStat.st_size), fileStat.st_mtime));
+          }
+        }
+      }
+      ::close(fd);
+    }
+
+    const int m_iRootFd;
+    /// compiled regular expressions can be shared between threads
+    const boost::regex* m_pPattern;
+
+    boost::mutex m_mutex;
+    boost::condition_variable m_condition;
+    std::deque<std::string> m_dqDirectories;
+    /// number of directories queued or being read
+    uint64_t m_uiPending;
+    std::vector<FileInfo> m_vFiles;
+  };
+#endif
+
+#ifndef _WIN32
+  /// releases a mapping created by mapFileIntoBuffer
+  struct MunmapDeleter
+  {
+    explicit MunmapDeleter(size_t uiLength) : m_uiLength(uiLength) {}
+    void operator()(uint8_t* pData) const
+    {
+      if (pData) munmap(pData, m_uiLength);
+    }
+    size_t m_uiLength;
+  };
+
+  /// applies the access pattern hint to a mapping. Failures only cost performance and are ignored.
+  static void adviseMapping(void* pData, size_t uiSize, MapAdvice eAdvice)
+  {
+    int iAdvice = MADV_NORMAL;
+    switch (eAdvice)
+    {
+      case MA_SEQUENTIAL: iAdvice = MADV_SEQUENTIAL; break;
+      case MA_RANDOM: iAdvice = MADV_RANDOM; break;
+      case MA_WILLNEED: iAdvice = MADV_WILLNEED; break;
+      case MA_NORMAL: break;
+    }
+    madvise(pData, uiSize, iAdvice);
+  }
+#endif
 };
 
@@ -13,7 +13,7 @@ public:
   IBitStream(Buffer buffer)
     :m_pBuffer(nullptr),
     m_buffer(buffer),
-    m_uiBitsRemaining(buffer.getSize() << 3),
+    m_uiBitsRemaining(static_cast<uint64_t>(buffer.getSize()) << 3),
     m_uiBitsInCurrentByte(8),
     m_uiCurrentBytePos(0)
   {
@@ -23,15 +23,15 @@ public:
   IBitStream(const std::string& sData)
     :m_pBuffer(new uint8_t[sData.length()]),
       m_buffer(m_pBuffer, sData.length()),
-      m_uiBitsRemaining(m_buffer.getSize() << 3),
+      m_uiBitsRemaining(static_cast<uint64_t>(m_buffer.getSize()) << 3),
       m_uiBitsInCurrentByte(8),
       m_uiCurrentBytePos(0)
   {
     memcpy((void*)m_pBuffer, (void*)sData.c_str(), sData.length());
   }
 
-  uint32_t getBitsRemaining() const { return m_uiBitsRemaining; }
-  uint32_t getBytesRemaining() const { return (m_uiBitsRemaining >> 3); }
+  uint64_t getBitsRemaining() const { return m_uiBitsRemaining; }
+  uint64_t getBytesRemaining() const { return (m_uiBitsRemaining >> 3); }
 
   bool read(uint64_t& uiValue, uint32_t uiBits)
   {
@@ -164,9 +164,9 @@ public:
   }
 
   // this method can only be called on byte boundaries
-  bool readBytes(uint8_t*& rDestination, uint32_t uiBytes)
+  bool readBytes(uint8_t*& rDestination, uint64_t uiBytes)
   {
-    uint32_t uiBits = uiBytes << 3;
+    uint64_t uiBits = uiBytes << 3;
     if ((m_uiBitsInCurrentByte != 8) || 
         (uiBits > m_uiBitsRemaining)
        )
@@ -174,40 +174,31 @@ public:
       return false;
     }
 
-    memcpy(rDestination, &m_buffer[m_uiCurrentBytePos], uiBytes);
+    memcpy(rDestination, &m_buffer[m_uiCurrentBytePos], static_cast<size_t>(uiBytes));
     // update total
     m_uiBitsRemaining -= uiBits;
     m_uiCurrentBytePos += uiBytes;
     return true;
   }
 
-  bool skipBits(uint32_t uiBits)
+  bool skipBits(uint64_t uiBits)
   {
     if (uiBits > m_uiBitsRemaining)
     {
       return false;
     }
 
-    uint32_t uiBitsRemaining = uiBits;
-    while (uiBitsRemaining)
-    {
-      uint32_t uiBitsToReadInCurrentByte = std::min(m_uiBitsInCurrentByte, uiBitsRemaining);
-      // preserve old value
-      m_uiBitsInCurrentByte -= uiBitsToReadInCurrentByte;
-      if (m_uiBitsInCurrentByte == 0)
-      {
-        m_uiBitsInCurrentByte = 8;
-        ++m_uiCurrentBytePos;
-      }
-      uiBitsRemaining -= uiBitsToReadInCurrentByte;
-    }
+    // bit offset from the start of the current byte after skipping
+    uint64_t uiBitOffset = (8 - m_uiBitsInCurrentByte) + uiBits;
+    m_uiCurrentBytePos += uiBitOffset >> 3;
+    m_uiBitsInCurrentByte = 8 - static_cast<uint32_t>(uiBitOffset & 7);
     m_uiBitsRemaining -= uiBits;
     return true;
   }
 
-  bool skipBytes(uint32_t uiBytes)
+  bool skipBytes(uint64_t uiBytes)
   {
-    uint32_t uiBits = uiBytes << 3;
+    uint64_t uiBits = uiBytes << 3;
     if ((m_uiBitsInCurrentByte != 8) || 
       (uiBits > m_uiBitsRemaining)
       )
@@ -227,8 +218,8 @@ public:
 private:
   uint8_t* m_pBuffer;
   Buffer m_buffer;
-  uint32_t m_uiBitsRemaining;
+  uint64_t m_uiBitsRemaining;
   uint32_t m_uiBitsInCurrentByte;
-  uint32_t m_uiCurrentBytePos;
+  uint64_t m_uiCurrentBytePos;
 };
 
@@ -0,0 +1,99 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+/**
+ * @brief Accumulates scheduling lateness i.e. how long after its deadline a periodic task ran.
+ * Lateness values are bucketed into a log2 histogram so that percentiles can be estimated in
+ * constant memory. This class is not thread-safe.
+ */
+class LatenessStatistics
+{
+public:
+  static const uint32_t BUCKETS = 64;
+
+  LatenessStatistics()
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    m_uiCount = 0;
+    m_uiMissed = 0;
+    m_iMinNs = std::numeric_limits<int64_t>::max();
+    m_iMaxNs = 0;
+    m_iLastNs = 0;
+    m_dSumNs = 0.0;
+    std::fill(m_uiHistogram, m_uiHistogram + BUCKETS, 0);
+  }
+
+  /**
+   * @brief record adds a sample
+   * @param iLatenessNs The time between the deadline and the actual execution. Negative values are clamped to 0.
+   * @param uiMissed The number of deadlines that passed without an execution
+   */
+  void record(int64_t iLatenessNs, uint64_t uiMissed = 0)
+  {
+    if (iLatenessNs < 0) iLatenessNs = 0;
+    ++m_uiCount;
+    m_uiMissed += uiMissed;
+    m_iLastNs = iLatenessNs;
+    m_iMinNs = std::min(m_iMinNs, iLatenessNs);
+    m_iMaxNs = std::max(m_iMaxNs, iLatenessNs);
+    m_dSumNs += static_cast<double>(iLatenessNs);
+    ++m_uiHistogram[bucket(static_cast<uint64_t>(iLatenessNs))];
+  }
+
+  uint64_t getCount() const { return m_uiCount; }
+  uint64_t getMissed() const { return m_uiMissed; }
+  int64_t getMinNs() const { return m_uiCount ? m_iMinNs : 0; }
+  int64_t getMaxNs() const { return m_iMaxNs; }
+  int64_t getLastNs() const { return m_iLastNs; }
+  double getMeanNs() const { return m_uiCount ? m_dSumNs / m_uiCount : 0.0; }
+
+  /**
+   * @brief getPercentileNs estimates a percentile of the lateness
+   * @param dPercentile A value in [0, 100]
+   * @return an upper bound of the percentile, accurate to within a factor of 2
+   */
+  int64_t getPercentileNs(double dPercentile) const
+  {
+    if (m_uiCount == 0) return 0;
+    uint64_t uiRank = static_cast<uint64_t>(dPercentile / 100.0 * m_uiCount);
+    if (uiRank >= m_uiCount) uiRank = m_uiCount - 1;
+    uint64_t uiSeen = 0;
+    for (uint32_t i = 0; i < BUCKETS; ++i)
+    {
+      uiSeen += m_uiHistogram[i];
+      if (uiSeen > uiRank)
+      {
+        // bucket i holds values in [2^(i-1), 2^i)
+        int64_t iUpper = (i >= 63) ? std::numeric_limits<int64_t>::max() : (static_cast<int64_t>(1) << i);
+        return std::min(iUpper, m_iMaxNs);
+      }
+    }
+    return m_iMaxNs;
+  }
+
+private:
+  static uint32_t bucket(uint64_t uiValue)
+  {
+    uint32_t uiBucket = 0;
+    while (uiValue && uiBucket < BUCKETS - 1)
+    {
+      uiValue >>= 1;
+      ++uiBucket;
+    }
+    return uiBucket;
+  }
+
+  uint64_t m_uiCount;
+  uint64_t m_uiMissed;
+  int64_t m_iMinNs;
+  int64_t m_iMaxNs;
+  int64_t m_iLastNs;
+  double m_dSumNs;
+  uint64_t m_uiHistogram[BUCKETS];
+};
@@ -0,0 +1,375 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <glog/logging.h>
+#include "StallWatchdog.h"
+#include "ThreadUtil.h"
+
+/**
+ * @brief Bounded lock-free multi-producer single-consumer ring buffer.
+ * Each cell carries a sequence number that tells producers and the consumer whether the cell
+ * is free or holds a message, so no allocation takes place per message. The capacity is
+ * rounded up to the next power of two.
+ */
+template <typename Msg>
+class MpscRing : public boost::noncopyable
+{
+public:
+  explicit MpscRing(uint32_t uiCapacity)
+    :m_uiMask(roundUp(uiCapacity) - 1),
+    m_cells(new Cell[m_uiMask + 1]),
+    m_uiEnqueuePos(0),
+    m_uiDequeuePos(0)
+  {
+    for (size_t i = 0; i <= m_uiMask; ++i)
+    {
+      m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  size_t getCapacity() const { return m_uiMask + 1; }
+
+  /// can be called from any thread. Returns false if the ring is full.
+  bool tryPush(const Msg& msg)
+  {
+    Cell* pCell = claim();
+    if (!pCell) return false;
+    pCell->data = msg;
+    publish(pCell);
+    return true;
+  }
+
+  bool tryPush(Msg&& msg)
+  {
+    Cell* pCell = claim();
+    if (!pCell) return false;
+    pCell->data = std::move(msg);
+    publish(pCell);
+    return true;
+  }
+
+  /// must only be called from the consumer thread. Returns false if the ring is empty.
+  bool tryPop(Msg& msg)
+  {
+    Cell* pCell = &m_cells[m_uiDequeuePos & m_uiMask];
+    size_t uiSeq = pCell->sequence.load(std::memory_order_acquire);
+    if (uiSeq != m_uiDequeuePos + 1) return false;
+    msg = std::move(pCell->data);
+    // mark the cell as free for the producer that wraps around to it
+    pCell->sequence.store(m_uiDequeuePos + m_uiMask + 1, std::memory_order_release);
+    ++m_uiDequeuePos;
+    return true;
+  }
+
+  /// must only be called from the consumer thread
+  bool isEmpty() const
+  {
+    const Cell* pCell = &m_cells[m_uiDequeuePos & m_uiMask];
+    return pCell->sequence.load(std::memory_order_acquire) != m_uiDequeuePos + 1;
+  }
+
+private:
+  struct Cell
+  {
+    std::atomic<size_t> sequence;
+    Msg data;
+  };
+
+  static size_t roundUp(uint32_t uiCapacity)
+  {
+    size_t uiSize = 2;
+    while (uiSize < uiCapacity) uiSize <<= 1;
+    return uiSize;
+  }
+
+  /// reserves the next cell for a producer. Returns 0 if the ring is full.
+  Cell* claim()
+  {
+    size_t uiPos = m_uiEnqueuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      Cell* pCell = &m_cells[uiPos & m_uiMask];
+      size_t uiSeq = pCell->sequence.load(std::memory_order_acquire);
+      intptr_t iDiff = static_cast<intptr_t>(uiSeq) - static_cast<intptr_t>(uiPos);
+      if (iDiff == 0)
+      {
+        if (m_uiEnqueuePos.compare_exchange_weak(uiPos, uiPos + 1, std::memory_order_relaxed))
+          return pCell;
+      }
+      else if (iDiff < 0)
+      {
+        // the consumer has not freed the cell from the previous lap yet
+        return 0;
+      }
+      else
+      {
+        uiPos = m_uiEnqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void publish(Cell* pCell)
+  {
+    size_t uiPos = pCell->sequence.load(std::memory_order_relaxed);
+    pCell->sequence.store(uiPos + 1, std::memory_order_release);
+  }
+
+  static const size_t CACHE_LINE = 64;
+
+  const size_t m_uiMask;
+  boost::scoped_array<Cell> m_cells;
+  char m_pad0[CACHE_LINE];
+  std::atomic<size_t> m_uiEnqueuePos;
+  char m_pad1[CACHE_LINE];
+  /// only accessed by the consumer
+  size_t m_uiDequeuePos;
+};
+
+/**
+ * @brief Mailbox of a single consumer thread.
+ * Producers post into a lock-free ring. The consumer drains messages in batches and parks on a
+ * condition variable once it runs out of work; producers only take the mutex if the consumer is parked.
+ */
+template <typename Msg>
+class Mailbox : public boost::noncopyable
+{
+public:
+  explicit Mailbox(uint32_t uiCapacity)
+    :m_ring(uiCapacity),
+    m_bSleeping(false),
+    m_bClosed(false),
+    m_uiPosting(0)
+  {
+
+  }
+
+  size_t getCapacity() const { return m_ring.getCapacity(); }
+
+  /**
+   * @brief post queues the message for the consumer
+   * @return false if the mailbox is full or closed, in which case the message is not queued
+   */
+  template <typename M>
+  bool post(M&& msg)
+  {
+    // announce the post before checking the flag so that the consumer can wait for posts racing with close()
+    m_uiPosting.fetch_add(1, std::memory_order_seq_cst);
+    if (m_bClosed.load(std::memory_order_seq_cst) || !m_ring.tryPush(std::forward<M>(msg)))
+    {
+      m_uiPosting.fetch_sub(1, std::memory_order_release);
+      return false;
+    }
+    m_uiPosting.fetch_sub(1, std::memory_order_release);
+    // pairs with the fence in park(): either the consumer sees the message or we see that it sleeps
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_bSleeping.load(std::memory_order_relaxed))
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_condition.notify_one();
+    }
+    return true;
+  }
+
+  /// moves up to uiMax messages into vBatch. Must only be called from the consumer thread.
+  uint32_t drain(std::vector<Msg>& vBatch, uint32_t uiMax)
+  {
+    uint32_t uiCount = 0;
+    Msg msg;
+    while (uiCount < uiMax && m_ring.tryPop(msg))
+    {
+      vBatch.push_back(std::move(msg));
+      ++uiCount;
+    }
+    return uiCount;
+  }
+
+  /// blocks the consumer until a message is available or the mailbox is closed
+  void park()
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_bSleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (m_ring.isEmpty() && !m_bClosed.load(std::memory_order_relaxed))
+    {
+      m_condition.wait(lock);
+    }
+    m_bSleeping.store(false, std::memory_order_relaxed);
+  }
+
+  /// wakes the consumer permanently and refuses further posts. Messages that are already queued can still be drained.
+  void close()
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_bClosed.store(true, std::memory_order_seq_cst);
+    m_condition.notify_one();
+  }
+
+  void reopen()
+  {
+    m_bClosed.store(false, std::memory_order_release);
+  }
+
+  bool isClosed() const { return m_bClosed.load(std::memory_order_seq_cst); }
+
+  /// must only be called from the consumer thread
+  bool isEmpty() const { return m_ring.isEmpty(); }
+
+  /**
+   * @brief waitForPosts waits until the posts that were in progress when the mailbox was closed
+   * have queued their messages. Afterwards no message is added until the mailbox is reopened.
+   * Must only be called from the consumer thread after isClosed() returned true.
+   */
+  void waitForPosts() const
+  {
+    while (m_uiPosting.load(std::memory_order_acquire) != 0)
+    {
+      boost::this_thread::yield();
+    }
+  }
+
+private:
+  MpscRing<Msg> m_ring;
+  std::atomic<bool> m_bSleeping;
+  std::atomic<bool> m_bClosed;
+  /// number of producers between announcing a post and queueing the message
+  std::atomic<uint32_t> m_uiPosting;
+  boost::mutex m_mutex;
+  boost::condition_variable m_condition;
+};
+
+/// Configuration of a MailboxService
+struct MailboxOptions
+{
+  /**
+   * @brief MailboxOptions
+   * @param capacity The capacity of the mailbox, rounded up to a power of two
+   * @param maxBatch The maximum number of messages passed to onMessages per call
+   * @param policy The backoff applied before the service thread parks
+   */
+  MailboxOptions(uint32_t capacity = 1024, uint32_t maxBatch = 64, const SpinPolicy& policy = SpinPolicy())
+    :uiCapacity(capacity),
+    uiMaxBatch(maxBatch),
+    spinPolicy(policy)
+  {
+
+  }
+
+  uint32_t uiCapacity;
+  uint32_t uiMaxBatch;
+  SpinPolicy spinPolicy;
+};
+
+/**
+ * @brief Adapter that turns a message handler into a ServiceThread implementation.
+ * Impl must provide void onMessages(std::vector<Msg>& vBatch) which is called in the
+ * service thread with up to uiMaxBatch messages per call. When the mailbox is empty the
+ * service thread backs off according to the spin policy and then parks until the next post.
+ * Once stopped, posts are refused and the messages queued before are handled before the
+ * service thread completes.
+ *
+ * Usage:
+ *   ServiceThread<MailboxService<Handler, Msg> > service(boost::in_place_init, MailboxOptions(4096, 64), handlerArgs...);
+ *   service.start();
+ *   service.get()->post(msg);
+ */
+template <typename Impl, typename Msg>
+class MailboxService : public boost::noncopyable
+{
+public:
+  /// uses the default MailboxOptions and a default constructed Impl
+  MailboxService()
+    :m_mailbox(MailboxOptions().uiCapacity),
+    m_uiMaxBatch(MailboxOptions().uiMaxBatch),
+    m_spinPolicy(MailboxOptions().spinPolicy)
+  {
+
+  }
+
+  /**
+   * @brief MailboxService
+   * @param options The configuration of the mailbox
+   * @param args The arguments forwarded to the constructor of Impl
+   */
+  template <typename... Args>
+  explicit MailboxService(const MailboxOptions& options, Args&&... args)
+    :m_impl(std::forward<Args>(args)...),
+    m_mailbox(options.uiCapacity),
+    m_uiMaxBatch(options.uiMaxBatch > 0 ? options.uiMaxBatch : 1),
+    m_spinPolicy(options.spinPolicy)
+  {
+
+  }
+
+  Impl& getImpl() { return m_impl; }
+
+  /// can be called from any thread. Returns false if the mailbox is full or the service is stopped.
+  template <typename M>
+  bool post(M&& msg)
+  {
+    return m_mailbox.post(std::forward<M>(msg));
+  }
+
+  boost::system::error_code onStart()
+  {
+    m_mailbox.reopen();
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code start()
+  {
+    std::vector<Msg> vBatch;
+    vBatch.reserve(m_uiMaxBatch);
+    uint32_t uiIdleCount = 0;
+    for (;;)
+    {
+      vBatch.clear();
+      if (m_mailbox.drain(vBatch, m_uiMaxBatch) > 0)
+      {
+        uiIdleCount = 0;
+        StallWatchdog::Scope scope("mailbox");
+        m_impl.onMessages(vBatch);
+        continue;
+      }
+      // the mailbox is only left once all queued messages have been handled, including those of posts racing with close
+      if (m_mailbox.isClosed())
+      {
+        m_mailbox.waitForPosts();
+        if (m_mailbox.isEmpty()) break;
+        continue;
+      }
+      if (!ThreadUtil::backoff(m_spinPolicy, uiIdleCount++))
+      {
+        m_mailbox.park();
+        uiIdleCount = 0;
+      }
+    }
+    VLOG(15) << "Mailbox service complete";
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code stop()
+  {
+    m_mailbox.close();
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code onComplete()
+  {
+    return boost::system::error_code();
+  }
+
+private:
+  Impl m_impl;
+  Mailbox<Msg> m_mailbox;
+  const uint32_t m_uiMaxBatch;
+  const SpinPolicy m_spinPolicy;
+};
@@ -24,14 +24,14 @@ public:
    * @param bConservative
    * @param uiPreBufferSize
    */
-  explicit OBitStream(const uint32_t uiSize = DEFAULT_BUFFER_SIZE, const uint32_t uiPreBufferSize = PRE_BUFFER_SIZE, bool bConservative = true)
+  explicit OBitStream(const uint64_t uiSize = DEFAULT_BUFFER_SIZE, const uint32_t uiPreBufferSize = PRE_BUFFER_SIZE, bool bConservative = true)
     :m_uiBufferSize(uiSize),
     m_buffer(new uint8_t[uiSize], uiSize, uiPreBufferSize, 0), // allocating 4 bytes of prebuffer
     m_uiBitsLeft(8),
     m_uiCurrentBytePos(0),
     m_bConservative(bConservative)
   {
-    memset(m_buffer.getBuffer().get(), 0, m_uiBufferSize);
+    memset(m_buffer.getBuffer().get(), 0, static_cast<size_t>(m_uiBufferSize));
   }
   /**
    * @brief OBitStream
@@ -45,7 +45,7 @@ public:
     m_uiCurrentBytePos(0),
     m_bConservative(bConservative)
   {
-    memset(m_buffer.getBuffer().get(), 0, m_uiBufferSize);
+    memset(m_buffer.getBuffer().get(), 0, static_cast<size_t>(m_uiBufferSize));
   }
   /**
    * @brief reset resets the write pointers inside the class
@@ -56,7 +56,7 @@ public:
   {
     m_uiBitsLeft = 8;
     m_uiCurrentBytePos = 0;
-    memset(m_buffer.getBuffer().get(), 0, m_uiBufferSize);
+    memset(m_buffer.getBuffer().get(), 0, static_cast<size_t>(m_uiBufferSize));
   }
   /**
    * @brief write8Bits
@@ -89,8 +89,8 @@ public:
     if ( totalBitsLeft() < uiBits )
     {
       // reallocate more than enough memory:
-      uint32_t uiBytes = uiBits >> 3;
-      uint32_t uiNewSize = std::max(m_uiBufferSize << 1, (m_uiBufferSize + uiBytes) << 1 );
+      uint64_t uiBytes = uiBits >> 3;
+      uint64_t uiNewSize = std::max(m_uiBufferSize << 1, (m_uiBufferSize + uiBytes) << 1 );
       increaseBufferSize(uiNewSize);
     }
 
@@ -217,13 +217,13 @@ public:
    * @return
    * this method can only be called on byte boundaries
    */
-  bool writeBytes(const uint8_t*& rSrc, uint32_t uiBytes)
+  bool writeBytes(const uint8_t*& rSrc, uint64_t uiBytes)
   {
     if ((m_uiBitsLeft != 8) || // check byte boundary
         ((m_uiBufferSize - m_uiCurrentBytePos) < uiBytes) // check buffer size
        ) 
          return false;
-    memcpy(&m_buffer[m_uiCurrentBytePos], rSrc, uiBytes);
+    memcpy(&m_buffer[m_uiCurrentBytePos], rSrc, static_cast<size_t>(uiBytes));
     m_uiCurrentBytePos += uiBytes;
     return true;
   }
@@ -246,13 +246,13 @@ public:
           LOG(WARNING) << "WARN: Byte pos: " << m_uiCurrentBytePos << " Size: " << m_uiBufferSize;
       }
       assert (m_uiCurrentBytePos <= m_uiBufferSize);
-      uint32_t uiBytesLeft = m_uiBufferSize - m_uiCurrentBytePos;
+      uint64_t uiBytesLeft = m_uiBufferSize - m_uiCurrentBytePos;
 
-      uint32_t uiBytesToCopy = in.getBytesRemaining();
+      uint64_t uiBytesToCopy = in.getBytesRemaining();
       if (uiBytesToCopy > uiBytesLeft)
       {
         // conservative for now:
-        uint32_t uiNewSize = m_bConservative ? m_uiCurrentBytePos + uiBytesToCopy : m_uiBufferSize * 2;
+        uint64_t uiNewSize = m_bConservative ? m_uiCurrentBytePos + uiBytesToCopy : m_uiBufferSize * 2;
         increaseBufferSize(uiNewSize);
       }
       // increase buffer size if necessary
@@ -271,7 +271,7 @@ public:
    * this method writes all bytes remaining in the IBitStream to the output stream
    * TODO: make this method handle non-byte boundary data
    */
-  bool write(IBitStream& in, uint32_t uiBytesToCopy)
+  bool write(IBitStream& in, uint64_t uiBytesToCopy)
   {
 #if 0
       VLOG(5) << "bits left: " << m_uiBitsLeft << " bits remaining: " << in.m_uiBitsRemaining << " Bytes: " << in.getBytesRemaining() << " To copy: " << uiBytesToCopy;
@@ -287,12 +287,12 @@ public:
           LOG(WARNING) << "WARN: Byte pos: " << m_uiCurrentBytePos << " Size: " << m_uiBufferSize;
       }
       assert (m_uiCurrentBytePos <= m_uiBufferSize);
-      uint32_t uiBytesLeft = m_uiBufferSize - m_uiCurrentBytePos;
+      uint64_t uiBytesLeft = m_uiBufferSize - m_uiCurrentBytePos;
 
       if (uiBytesToCopy > uiBytesLeft)
       {
         // conservative for now:
-        uint32_t uiNewSize = m_uiCurrentBytePos + uiBytesToCopy;
+        uint64_t uiNewSize = m_uiCurrentBytePos + uiBytesToCopy;
         increaseBufferSize(uiNewSize);
       }
       // increase buffer size if necessary
@@ -307,7 +307,7 @@ public:
    * @brief bytesUsed
    * @return
    */
-  uint32_t bytesUsed() const 
+  uint64_t bytesUsed() const 
   {
     return m_uiCurrentBytePos + (m_uiBitsLeft == 8 ? 0 : 1);
   }
@@ -315,7 +315,7 @@ public:
    * @brief totalBitsLeft
    * @return
    */
-  uint32_t totalBitsLeft() const
+  uint64_t totalBitsLeft() const
   {
     return  m_uiBitsLeft + 8 * (m_uiBufferSize - m_uiCurrentBytePos - 1);
   }
@@ -328,11 +328,11 @@ public:
     // copy all bits to a buffer
     Buffer buffer;
     // first calculate size of buffer required
-    uint32_t uiSize = bytesUsed(); 
+    uint64_t uiSize = bytesUsed(); 
     if (uiSize)
     {
       buffer.setData(new uint8_t[uiSize], uiSize);
-      memcpy(&buffer[0], &m_buffer[0], uiSize); 
+      memcpy(&buffer[0], &m_buffer[0], static_cast<size_t>(uiSize)); 
     }
     return buffer;
   }
@@ -346,14 +346,14 @@ public:
   }
 
 private:
-  void increaseBufferSize(uint32_t uiNewSize)
+  void increaseBufferSize(uint64_t uiNewSize)
   {
     // respect old pre buffer
-    uint32_t uiOldPreBuffer = m_buffer.getPrebufferSize();
-    uint32_t uiOldPostBuffer = m_buffer.getPostbufferSize();
+    size_t uiOldPreBuffer = m_buffer.getPrebufferSize();
+    size_t uiOldPostBuffer = m_buffer.getPostbufferSize();
     Buffer buffer = Buffer(new uint8_t[uiNewSize], uiNewSize, uiOldPreBuffer, uiOldPostBuffer);
-    memset(&buffer[0], 0, uiNewSize);
-    memcpy(&buffer[0], &m_buffer[0], m_uiBufferSize );
+    memset(&buffer[0], 0, static_cast<size_t>(uiNewSize));
+    memcpy(&buffer[0], &m_buffer[0], static_cast<size_t>(m_uiBufferSize));
     m_buffer = buffer;
     m_uiBufferSize = uiNewSize;
   }
@@ -398,14 +398,14 @@ private:
     }
   }
 
-  uint32_t m_uiBufferSize;
+  uint64_t m_uiBufferSize;
   Buffer m_buffer;
 
   ///< Bits left in current byte
   uint32_t m_uiBitsLeft;
 
   ///< Current position in the buffer  
-  uint32_t m_uiCurrentBytePos;
+  uint64_t m_uiCurrentBytePos;
 
   bool m_bConservative;
 };
@@ -0,0 +1,359 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread/mutex.hpp>
+#include <glog/logging.h>
+#include "Buffer.h"
+#include "Clock.h"
+#include "PeriodicScheduler.h"
+
+/// A packet queued in the pacer
+struct PacedPacket
+{
+  PacedPacket()
+    :uiFlowId(0),
+    iSendTimeNs(0)
+  {
+
+  }
+
+  PacedPacket(uint32_t flowId, const Buffer& packet, int64_t sendTimeNs)
+    :uiFlowId(flowId),
+    buffer(packet),
+    iSendTimeNs(sendTimeNs)
+  {
+
+  }
+
+  uint32_t uiFlowId;
+  Buffer buffer;
+  /// the earliest time the packet may be sent, on the SimulatedClock in nanoseconds
+  int64_t iSendTimeNs;
+};
+
+/// Pacer counters
+struct PacerStats
+{
+  PacerStats()
+    :uiQueued(0),
+    uiReleased(0),
+    uiReleasedBytes(0),
+    uiDropped(0),
+    uiBatches(0)
+  {
+
+  }
+
+  /// number of packets currently queued
+  uint64_t uiQueued;
+  uint64_t uiReleased;
+  uint64_t uiReleasedBytes;
+  /// packets refused because the queue of the flow was full or the flow was unknown
+  uint64_t uiDropped;
+  uint64_t uiBatches;
+};
+
+/**
+ * @brief Paces packets of several flows onto the network.
+ *
+ * Packets are queued per flow with a target send time and released in batches from a
+ * PeriodicScheduler tick on the io_service, e.g. the io_service of a ServiceController.
+ * Each flow is limited by a token bucket: the bucket fills at the flow's rate up to the
+ * burst size and a packet is only released once enough tokens are available. Packets of a
+ * flow are released in FIFO order.
+ *
+ * Flows with queued packets are kept in a heap ordered by the time they next become eligible,
+ * so a tick only touches flows that can send. enqueue() can be called from any thread; the
+ * release handler is called in the tick without the pacer lock held.
+ *
+ * Times are taken from the SimulatedClock, i.e. the steady clock unless simulation is enabled.
+ * With simulated time, releaseDue() can be called instead of starting the pacer; it is refused while the pacer is started.
+ */
+class Pacer : public boost::noncopyable
+{
+public:
+  /// called with the packets released in one tick. The handler may swap the vector's contents.
+  typedef boost::function<void (std::vector<PacedPacket>&)> OnRelease_t;
+
+  /**
+   * @brief Pacer
+   * @param ioService The io_service the release handler runs on
+   * @param uiTickUs The interval at which queued packets are released
+   * @param uiMaxQueuedPerFlow The maximum number of packets queued per flow. 0 means unbounded.
+   */
+  Pacer(boost::asio::io_service& ioService, uint32_t uiTickUs = 1000, uint32_t uiMaxQueuedPerFlow = 0)
+    :m_scheduler(ioService, uiTickUs, MTP_SKIP),
+    m_uiMaxQueuedPerFlow(uiMaxQueuedPerFlow),
+    m_bStarted(false)
+  {
+
+  }
+
+  ~Pacer()
+  {
+    stop();
+  }
+
+  /**
+   * @brief addFlow adds a flow or changes the rate of an existing flow
+   * @param uiFlowId The id of the flow
+   * @param uiRateBytesPerSecond The sustained rate. 0 means the flow is not rate limited.
+   * @param uiBurstBytes The size of the token bucket
+   */
+  void addFlow(uint32_t uiFlowId, uint64_t uiRateBytesPerSecond, uint32_t uiBurstBytes)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    Flow& flow = m_mFlows[uiFlowId];
+    flow.uiRateBytesPerSecond = uiRateBytesPerSecond;
+    flow.dBurstBytes = uiBurstBytes;
+    flow.dTokens = std::min(flow.dTokens, flow.dBurstBytes);
+    if (flow.iLastRefillNs == 0)
+    {
+      // a new flow starts with a full bucket
+      flow.dTokens = flow.dBurstBytes;
+      flow.iLastRefillNs = nowNs();
+    }
+  }
+
+  /// removes the flow and discards its queued packets
+  void removeFlow(uint32_t uiFlowId)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    auto it = m_mFlows.find(uiFlowId);
+    if (it == m_mFlows.end()) return;
+    m_stats.uiQueued -= it->second.packets.size();
+    // heap entries of the flow are discarded lazily
+    m_mFlows.erase(it);
+  }
+
+  /**
+   * @brief enqueue queues the packet for release
+   * @param uiFlowId The flow the packet belongs to
+   * @param buffer The packet
+   * @param iSendTimeNs The earliest SimulatedClock time the packet may be sent. 0 means as soon as the rate permits.
+   * @return false if the flow is unknown or its queue is full
+   */
+  bool enqueue(uint32_t uiFlowId, const Buffer& buffer, int64_t iSendTimeNs = 0)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    auto it = m_mFlows.find(uiFlowId);
+    if (it == m_mFlows.end() || (m_uiMaxQueuedPerFlow != 0 && it->second.packets.size() >= m_uiMaxQueuedPerFlow))
+    {
+      ++m_stats.uiDropped;
+      return false;
+    }
+    Flow& flow = it->second;
+    flow.packets.push_back(PacedPacket(uiFlowId, buffer, iSendTimeNs));
+    ++m_stats.uiQueued;
+    if (flow.packets.size() == 1)
+    {
+      schedule(uiFlowId, flow, iSendTimeNs);
+    }
+    return true;
+  }
+
+  /**
+   * @brief start starts releasing packets. onRelease is called on the io_service.
+   * @return operation_not_permitted if the pacer is already started
+   */
+  boost::system::error_code start(OnRelease_t onRelease)
+  {
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      if (m_bStarted)
+        return boost::system::error_code(boost::system::errc::operation_not_permitted, boost::system::generic_category());
+      // the handler is only read by ticks, which are started afterwards
+      m_onRelease = onRelease;
+      m_bStarted = true;
+    }
+    boost::system::error_code ec = m_scheduler.start(boost::bind(&Pacer::onTick, this));
+    if (ec)
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      m_bStarted = false;
+    }
+    return ec;
+  }
+
+  /// stops releasing packets. Queued packets are kept. A tick in progress on another thread completes before stop() returns.
+  void stop()
+  {
+    m_scheduler.stop();
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_bStarted = false;
+  }
+
+  PacerStats getStats() const
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_stats;
+  }
+
+  /// lateness of the ticks that release the packets
+  LatenessStatistics getTickStatistics() const
+  {
+    return m_scheduler.getStatistics();
+  }
+
+  /**
+   * @brief releaseDue passes all packets that are due now to the release handler, as a tick does.
+   * @return false if the pacer is started, in which case the ticks release the packets
+   */
+  bool releaseDue()
+  {
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      if (m_bStarted) return false;
+    }
+    onTick();
+    return true;
+  }
+
+  /**
+   * @brief setReleaseHandler sets the release handler without starting the ticks, e.g. to call releaseDue() with simulated time
+   * @return false if the pacer is started
+   */
+  bool setReleaseHandler(OnRelease_t onRelease)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_bStarted) return false;
+    m_onRelease = onRelease;
+    return true;
+  }
+
+private:
+  /// only one thread releases packets at a time: the tick while started, otherwise the caller of releaseDue
+  void onTick()
+  {
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      collectDuePackets(nowNs(), m_vBatch);
+    }
+    if (m_vBatch.empty()) return;
+    if (m_onRelease) m_onRelease(m_vBatch);
+    m_vBatch.clear();
+  }
+
+  struct Flow
+  {
+    Flow()
+      :uiRateBytesPerSecond(0),
+      dBurstBytes(0.0),
+      dTokens(0.0),
+      iLastRefillNs(0),
+      iScheduledNs(-1)
+    {
+
+    }
+
+    uint64_t uiRateBytesPerSecond;
+    double dBurstBytes;
+    double dTokens;
+    int64_t iLastRefillNs;
+    /// the time of the flow's valid heap entry, -1 if the flow is not in the heap
+    int64_t iScheduledNs;
+    std::deque<PacedPacket> packets;
+  };
+
+  /// time at which a flow becomes eligible, and the flow id. The earliest entry is on top.
+  typedef std::pair<int64_t, uint32_t> HeapEntry_t;
+  typedef std::priority_queue<HeapEntry_t, std::vector<HeapEntry_t>, std::greater<HeapEntry_t> > FlowHeap_t;
+
+  static int64_t nowNs()
+  {
+    return SimulatedClock::now().time_since_epoch().count();
+  }
+
+  void schedule(uint32_t uiFlowId, Flow& flow, int64_t iEligibleNs)
+  {
+    flow.iScheduledNs = iEligibleNs;
+    m_heap.push(HeapEntry_t(iEligibleNs, uiFlowId));
+  }
+
+  void refill(Flow& flow, int64_t iNowNs)
+  {
+    if (iNowNs > flow.iLastRefillNs)
+    {
+      flow.dTokens = std::min(flow.dBurstBytes, flow.dTokens + flow.uiRateBytesPerSecond * ((iNowNs - flow.iLastRefillNs) / 1e9));
+      flow.iLastRefillNs = iNowNs;
+    }
+  }
+
+  /// Must be called with m_mutex held
+  void collectDuePackets(int64_t iNowNs, std::vector<PacedPacket>& vBatch)
+  {
+    while (!m_heap.empty() && m_heap.top().first <= iNowNs)
+    {
+      HeapEntry_t entry = m_heap.top();
+      m_heap.pop();
+      auto it = m_mFlows.find(entry.second);
+      // skip entries of removed flows and stale entries
+      if (it == m_mFlows.end() || it->second.iScheduledNs != entry.first) continue;
+
+      Flow& flow = it->second;
+      flow.iScheduledNs = -1;
+      refill(flow, iNowNs);
+      while (!flow.packets.empty())
+      {
+        PacedPacket& packet = flow.packets.front();
+        if (packet.iSendTimeNs > iNowNs) break;
+        double dSize = static_cast<double>(packet.buffer.getSize());
+        if (flow.uiRateBytesPerSecond != 0)
+        {
+          // packets larger than the bucket are sent once the bucket is full
+          if (flow.dTokens < std::min(dSize, flow.dBurstBytes)) break;
+          flow.dTokens -= dSize;
+        }
+        m_stats.uiReleasedBytes += packet.buffer.getSize();
+        vBatch.push_back(PacedPacket());
+        std::swap(vBatch.back(), packet);
+        flow.packets.pop_front();
+      }
+
+      if (!flow.packets.empty())
+      {
+        int64_t iEligibleNs = std::max(flow.packets.front().iSendTimeNs, iNowNs);
+        if (flow.uiRateBytesPerSecond != 0)
+        {
+          double dNeeded = std::min(static_cast<double>(flow.packets.front().buffer.getSize()), flow.dBurstBytes) - flow.dTokens;
+          if (dNeeded > 0)
+          {
+            iEligibleNs = std::max(iEligibleNs, iNowNs + static_cast<int64_t>(dNeeded * 1e9 / flow.uiRateBytesPerSecond) + 1);
+          }
+        }
+        schedule(entry.second, flow, iEligibleNs);
+      }
+    }
+    if (!vBatch.empty())
+    {
+      m_stats.uiQueued -= vBatch.size();
+      m_stats.uiReleased += vBatch.size();
+      ++m_stats.uiBatches;
+    }
+  }
+
+  PeriodicScheduler m_scheduler;
+  const uint32_t m_uiMaxQueuedPerFlow;
+  /// only changed while the pacer is not started
+  OnRelease_t m_onRelease;
+
+  mutable boost::mutex m_mutex;
+  std::unordered_map<uint32_t, Flow> m_mFlows;
+  FlowHeap_t m_heap;
+  PacerStats m_stats;
+  /// true between start() and stop()
+  bool m_bStarted;
+  /// reused between ticks to avoid allocations. Only accessed from onTick.
+  std::vector<PacedPacket> m_vBatch;
+};
@@ -0,0 +1,396 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <boost/exception_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include "ExceptionBase.h"
+#include "ServiceController.h"
+
+/**
+ * Parallel algorithms that execute on the worker threads of a running ServiceController
+ * instead of creating additional threads.
+ *
+ * The calling thread always participates in the work, so these functions may be called
+ * from within a handler running on the same controller without deadlocking. If the controller
+ * is not running, all work is executed in the calling thread.
+ *
+ * Helpers are posted with ServiceController::postHelper to the lane given by ePriority, so they are
+ * subject to the controller's priority lanes and background share. They bypass the bounded task
+ * queues, so they never shed queued user tasks.
+ *
+ * If a work item throws, the remaining work items are skipped and the first exception is
+ * rethrown in the calling thread once all in-flight work has completed.
+ */
+namespace details {
+
+  /// Shared state of a chunked loop. Helpers posted to the controller keep it alive.
+  class ChunkedLoopState : public boost::noncopyable
+  {
+  public:
+    typedef boost::function<void (uint64_t)> RunChunk_t;
+
+    ChunkedLoopState(uint64_t uiChunks, const RunChunk_t& runChunk)
+      :m_uiChunks(uiChunks),
+      m_runChunk(runChunk),
+      m_uiNextChunk(0),
+      m_uiCompleted(0),
+      m_bFailed(false)
+    {
+
+    }
+
+    /// claims and executes the next chunk. Returns false once all chunks have been claimed.
+    bool runNextChunk()
+    {
+      uint64_t uiChunk = m_uiNextChunk.fetch_add(1);
+      if (uiChunk >= m_uiChunks) return false;
+
+      if (!m_bFailed.load())
+      {
+        try
+        {
+          m_runChunk(uiChunk);
+        }
+        catch (...)
+        {
+          boost::mutex::scoped_lock lock(m_mutex);
+          if (!m_bFailed.exchange(true))
+            m_exception = boost::current_exception();
+        }
+      }
+
+      if (m_uiCompleted.fetch_add(1) + 1 == m_uiChunks)
+      {
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_completeCondition.notify_all();
+      }
+      return true;
+    }
+
+    void runAvailableChunks()
+    {
+      while (runNextChunk()) {}
+    }
+
+    /// participates until all chunks are claimed and then blocks until they have all completed
+    void runAndWait()
+    {
+      runAvailableChunks();
+      boost::mutex::scoped_lock lock(m_mutex);
+      while (m_uiCompleted.load() < m_uiChunks)
+      {
+        m_completeCondition.wait(lock);
+      }
+      if (m_exception)
+        boost::rethrow_exception(m_exception);
+    }
+
+  private:
+    const uint64_t m_uiChunks;
+    RunChunk_t m_runChunk;
+    std::atomic<uint64_t> m_uiNextChunk;
+    std::atomic<uint64_t> m_uiCompleted;
+    std::atomic<bool> m_bFailed;
+    boost::mutex m_mutex;
+    boost::condition_variable m_completeCondition;
+    boost::exception_ptr m_exception;
+  };
+
+  inline void runChunkedLoop(ServiceController& controller, TaskPriority ePriority, uint64_t uiChunks, const ChunkedLoopState::RunChunk_t& runChunk)
+  {
+    if (uiChunks == 0) return;
+    boost::shared_ptr<ChunkedLoopState> pState = boost::make_shared<ChunkedLoopState>(uiChunks, runChunk);
+    // the calling thread takes part, so one helper less than there are workers is needed
+    uint64_t uiHelpers = std::min<uint64_t>(uiChunks - 1, controller.isRunning() ? controller.getThreadCount() : 0);
+    for (uint64_t i = 0; i < uiHelpers; ++i)
+    {
+      controller.postHelper(ePriority, boost::bind(&ChunkedLoopState::runAvailableChunks, pState));
+    }
+    pState->runAndWait();
+  }
+
+  template <typename Index, typename Func>
+  void runRange(Index begin, Index end, Index grain, uint64_t uiChunk, Func& func)
+  {
+    Index chunkBegin = begin + static_cast<Index>(uiChunk) * grain;
+    Index chunkEnd = (end - chunkBegin > grain) ? chunkBegin + grain : end;
+    func(chunkBegin, chunkEnd);
+  }
+
+  template <typename Index, typename Func>
+  struct ForEachIndex
+  {
+    Func func;
+    void operator()(Index chunkBegin, Index chunkEnd)
+    {
+      for (Index i = chunkBegin; i < chunkEnd; ++i)
+        func(i);
+    }
+  };
+
+  template <typename Index>
+  uint64_t countChunks(Index begin, Index end, Index grain)
+  {
+    if (!(begin < end)) return 0;
+    if (grain < 1) grain = 1;
+    uint64_t uiLength = static_cast<uint64_t>(end - begin);
+    return (uiLength + grain - 1) / grain;
+  }
+
+} // namespace details
+
+/**
+ * @brief parallelForRange splits [begin, end) into chunks of grain indices and calls func(chunkBegin, chunkEnd)
+ * for each chunk on the controller's worker threads and the calling thread. Blocks until all chunks are done.
+ * @param ePriority The lane the helpers are posted to
+ */
+template <typename Index, typename Func>
+void parallelForRange(ServiceController& controller, Index begin, Index end, Index grain, Func func, TaskPriority ePriority = TP_NORMAL)
+{
+  if (grain < 1) grain = 1;
+  uint64_t uiChunks = details::countChunks(begin, end, grain);
+  details::runChunkedLoop(controller, ePriority, uiChunks,
+                          [&](uint64_t uiChunk){ details::runRange(begin, end, grain, uiChunk, func); });
+}
+
+/**
+ * @brief parallelFor calls func(i) for every i in [begin, end). Indices are distributed in chunks of grain.
+ */
+template <typename Index, typename Func>
+void parallelFor(ServiceController& controller, Index begin, Index end, Index grain, Func func, TaskPriority ePriority = TP_NORMAL)
+{
+  details::ForEachIndex<Index, Func> forEach = { func };
+  parallelForRange(controller, begin, end, grain, forEach, ePriority);
+}
+
+/**
+ * @brief parallelReduce maps each chunk [chunkBegin, chunkEnd) of [begin, end) to a partial result using
+ * mapChunk(chunkBegin, chunkEnd) and combines the partial results in chunk order, starting with identity.
+ * Since partial results are combined in order, the result is deterministic for any associative combine.
+ */
+template <typename T, typename Index, typename MapChunk, typename Combine>
+T parallelReduce(ServiceController& controller, Index begin, Index end, Index grain, T identity, MapChunk mapChunk, Combine combine,
+                 TaskPriority ePriority = TP_NORMAL)
+{
+  if (grain < 1) grain = 1;
+  uint64_t uiChunks = details::countChunks(begin, end, grain);
+  std::vector<T> vPartials(uiChunks, identity);
+  details::runChunkedLoop(controller, ePriority, uiChunks, [&](uint64_t uiChunk)
+  {
+    auto storePartial = [&](Index chunkBegin, Index chunkEnd){ vPartials[uiChunk] = mapChunk(chunkBegin, chunkEnd); };
+    details::runRange(begin, end, grain, uiChunk, storePartial);
+  });
+
+  T result = identity;
+  for (size_t i = 0; i < vPartials.size(); ++i)
+  {
+    result = combine(result, vPartials[i]);
+  }
+  return result;
+}
+
+/**
+ * @brief Directed acyclic graph of tasks executed on a ServiceController.
+ * A task runs once all tasks it depends on have completed. Independent tasks run in parallel.
+ * The graph can be run multiple times.
+ */
+class TaskGraph : public boost::noncopyable
+{
+public:
+  typedef uint32_t TaskId_t;
+
+  /// adds a task to the graph and returns its id
+  TaskId_t addTask(const Task_t& task)
+  {
+    m_vTasks.push_back(task);
+    m_vSuccessors.push_back(std::vector<TaskId_t>());
+    m_vDependencyCount.push_back(0);
+    return static_cast<TaskId_t>(m_vTasks.size() - 1);
+  }
+
+  /// specifies that uiAfter may only start once uiBefore has completed
+  void addDependency(TaskId_t uiBefore, TaskId_t uiAfter)
+  {
+    if (uiBefore >= m_vTasks.size() || uiAfter >= m_vTasks.size() || uiBefore == uiAfter)
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("Invalid task dependency"));
+    }
+    m_vSuccessors[uiBefore].push_back(uiAfter);
+    ++m_vDependencyCount[uiAfter];
+  }
+
+  size_t size() const { return m_vTasks.size(); }
+
+  /**
+   * @brief run executes all tasks and blocks until they have completed.
+   * Throws an ExceptionBase if the graph contains a cycle. If a task throws, tasks that have not
+   * been started yet are skipped and the first exception is rethrown.
+   * @param ePriority The lane the helpers are posted to
+   */
+  void run(ServiceController& controller, TaskPriority ePriority = TP_NORMAL)
+  {
+    if (m_vTasks.empty()) return;
+    if (hasCycle())
+    {
+      BOOST_THROW_EXCEPTION(ExceptionBase("TaskGraph contains a cycle"));
+    }
+
+    boost::shared_ptr<RunState> pState = boost::make_shared<RunState>(boost::ref(*this), boost::ref(controller), ePriority);
+    pState->runAndWait();
+  }
+
+private:
+  bool hasCycle() const
+  {
+    std::vector<uint32_t> vPending(m_vDependencyCount);
+    std::deque<TaskId_t> ready;
+    for (size_t i = 0; i < vPending.size(); ++i)
+    {
+      if (vPending[i] == 0) ready.push_back(static_cast<TaskId_t>(i));
+    }
+    size_t uiVisited = 0;
+    while (!ready.empty())
+    {
+      TaskId_t uiId = ready.front();
+      ready.pop_front();
+      ++uiVisited;
+      for (TaskId_t uiNext : m_vSuccessors[uiId])
+      {
+        if (--vPending[uiNext] == 0) ready.push_back(uiNext);
+      }
+    }
+    return uiVisited != m_vTasks.size();
+  }
+
+  /// State of one run. Helpers posted to the controller keep it alive.
+  class RunState : public boost::enable_shared_from_this<RunState>, public boost::noncopyable
+  {
+  public:
+    RunState(const TaskGraph& graph, ServiceController& controller, TaskPriority ePriority)
+      :m_graph(graph),
+      m_controller(controller),
+      m_ePriority(ePriority),
+      m_vPending(graph.m_vDependencyCount),
+      m_uiCompleted(0)
+    {
+      for (size_t i = 0; i < m_vPending.size(); ++i)
+      {
+        if (m_vPending[i] == 0) m_ready.push_back(static_cast<TaskId_t>(i));
+      }
+    }
+
+    /// executes ready tasks until none are left
+    void runReadyTasks()
+    {
+      TaskId_t uiId;
+      while (popReady(uiId))
+      {
+        runTask(uiId);
+      }
+    }
+
+    void runAndWait()
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      // the initially ready tasks: keep one for the calling thread
+      postHelpers(m_ready.size() - 1);
+      while (m_uiCompleted < m_graph.m_vTasks.size())
+      {
+        if (!m_ready.empty())
+        {
+          TaskId_t uiId = m_ready.front();
+          m_ready.pop_front();
+          lock.unlock();
+          runTask(uiId);
+          lock.lock();
+        }
+        else
+        {
+          m_condition.wait(lock);
+        }
+      }
+      if (m_exception)
+        boost::rethrow_exception(m_exception);
+    }
+
+  private:
+    bool popReady(TaskId_t& uiId)
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      if (m_ready.empty()) return false;
+      uiId = m_ready.front();
+      m_ready.pop_front();
+      return true;
+    }
+
+    void runTask(TaskId_t uiId)
+    {
+      bool bSkip = false;
+      {
+        boost::mutex::scoped_lock lock(m_mutex);
+        bSkip = static_cast<bool>(m_exception);
+      }
+      if (!bSkip)
+      {
+        try
+        {
+          m_graph.m_vTasks[uiId]();
+        }
+        catch (...)
+        {
+          boost::mutex::scoped_lock lock(m_mutex);
+          if (!m_exception) m_exception = boost::current_exception();
+        }
+      }
+
+      boost::mutex::scoped_lock lock(m_mutex);
+      size_t uiNewlyReady = 0;
+      for (TaskId_t uiNext : m_graph.m_vSuccessors[uiId])
+      {
+        if (--m_vPending[uiNext] == 0)
+        {
+          m_ready.push_back(uiNext);
+          ++uiNewlyReady;
+        }
+      }
+      ++m_uiCompleted;
+      // the current thread continues with one of the newly ready tasks
+      if (uiNewlyReady > 1) postHelpers(uiNewlyReady - 1);
+      m_condition.notify_all();
+    }
+
+    /// must be called with m_mutex held
+    void postHelpers(size_t uiCount)
+    {
+      if (!m_controller.isRunning()) return;
+      uiCount = std::min<size_t>(uiCount, m_controller.getThreadCount());
+      for (size_t i = 0; i < uiCount; ++i)
+      {
+        m_controller.postHelper(m_ePriority, boost::bind(&RunState::runReadyTasks, shared_from_this()));
+      }
+    }
+
+    const TaskGraph& m_graph;
+    ServiceController& m_controller;
+    const TaskPriority m_ePriority;
+    std::vector<uint32_t> m_vPending;
+    size_t m_uiCompleted;
+    std::deque<TaskId_t> m_ready;
+    boost::mutex m_mutex;
+    boost::condition_variable m_condition;
+    boost::exception_ptr m_exception;
+  };
+
+  std::vector<Task_t> m_vTasks;
+  std::vector<std::vector<TaskId_t> > m_vSuccessors;
+  std::vector<uint32_t> m_vDependencyCount;
+};
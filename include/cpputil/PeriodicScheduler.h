@@ -0,0 +1,366 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/placeholders.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+#include <glog/logging.h>
+#include "LatenessStatistics.h"
+
+#if defined(__linux__)
+  #define CPPUTIL_USE_TIMERFD
+  #include <sys/timerfd.h>
+  #include <time.h>
+  #include <unistd.h>
+  #include <boost/asio/buffer.hpp>
+  #include <boost/asio/posix/stream_descriptor.hpp>
+#else
+  #include <boost/asio/steady_timer.hpp>
+#endif
+
+/// Determines what happens when one or more ticks were missed because the previous tick or the event loop was late
+enum MissedTickPolicy
+{
+  /// the tick handler is called once for every missed tick
+  MTP_CATCH_UP,
+  /// missed ticks are skipped and the schedule continues at the next period boundary
+  MTP_SKIP
+};
+
+/**
+ * @brief Drift-free periodic scheduler with microsecond resolution.
+ *
+ * Deadlines are absolute (start + n * period), so lateness of one tick does not shift
+ * subsequent ticks. On Linux the scheduler is backed by a timerfd registered with the
+ * io_service, elsewhere by a steady_timer. The tick handler runs on a thread of the io_service;
+ * ticks are never executed concurrently. The scheduler may be destroyed while the io_service
+ * still has one of its handlers pending.
+ *
+ * For each wakeup the lateness (time between the deadline and the execution) and the number
+ * of missed ticks are recorded and can be read with getStatistics().
+ */
+class PeriodicScheduler : public boost::noncopyable
+{
+public:
+  /// The parameter is the index of the tick since start() was called
+  typedef boost::function<void (uint64_t)> OnTick_t;
+
+  /**
+   * @brief PeriodicScheduler
+   * @param ioService The io_service the tick handler is executed on
+   * @param uiPeriodUs The period in microseconds
+   * @param ePolicy The policy for ticks that were missed
+   */
+  PeriodicScheduler(boost::asio::io_service& ioService, uint32_t uiPeriodUs, MissedTickPolicy ePolicy = MTP_SKIP)
+    :m_ioService(ioService),
+    m_uiPeriodNs(static_cast<int64_t>(uiPeriodUs > 0 ? uiPeriodUs : 1) * 1000),
+    m_ePolicy(ePolicy)
+  {
+
+  }
+
+  ~PeriodicScheduler()
+  {
+    stop();
+  }
+
+  /**
+   * @brief start schedules the first tick one period from now
+   * @param onTick The handler called for every tick
+   */
+  boost::system::error_code start(OnTick_t onTick)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_pSchedule && m_pSchedule->isRunning())
+      return boost::system::error_code(boost::system::errc::operation_not_permitted, boost::system::generic_category());
+
+    // every start gets a new schedule so that a cancellation still pending from stop() cannot affect it
+    boost::shared_ptr<Schedule> pSchedule = boost::make_shared<Schedule>(boost::ref(m_ioService), m_uiPeriodNs, m_ePolicy, onTick);
+    boost::system::error_code ec = pSchedule->start();
+    if (ec) return ec;
+    m_pSchedule = pSchedule;
+    return ec;
+  }
+
+  /**
+   * @brief stop cancels the schedule.
+   * When stop() returns, no tick is executing and no further tick will be executed, so the owner
+   * of the tick handler may be destroyed. If stop() is called from within the tick handler, the
+   * current tick completes after stop() returns. stop() must not be called while holding a lock
+   * the tick handler acquires.
+   */
+  void stop()
+  {
+    boost::shared_ptr<Schedule> pSchedule = getSchedule();
+    if (pSchedule) pSchedule->stop();
+  }
+
+  bool isRunning() const
+  {
+    boost::shared_ptr<Schedule> pSchedule = getSchedule();
+    return pSchedule && pSchedule->isRunning();
+  }
+
+  uint32_t getPeriodUs() const { return static_cast<uint32_t>(m_uiPeriodNs / 1000); }
+
+  /// returns a snapshot of the lateness statistics since start()
+  LatenessStatistics getStatistics() const
+  {
+    boost::shared_ptr<Schedule> pSchedule = getSchedule();
+    return pSchedule ? pSchedule->getStatistics() : LatenessStatistics();
+  }
+
+private:
+  /**
+   * @brief The state of one started schedule.
+   * Pending handlers hold a shared_ptr to the schedule, so it outlives the PeriodicScheduler
+   * until the io_service has completed or destroyed them. All handlers and the cancellation
+   * run on m_strand since the timer objects are not thread safe.
+   */
+  class Schedule : public boost::enable_shared_from_this<Schedule>, public boost::noncopyable
+  {
+  public:
+    Schedule(boost::asio::io_service& ioService, int64_t uiPeriodNs, MissedTickPolicy ePolicy, OnTick_t onTick)
+      :m_uiPeriodNs(uiPeriodNs),
+      m_ePolicy(ePolicy),
+      m_onTick(onTick),
+      m_bRunning(false),
+      m_iStartNs(0),
+      m_uiTick(0),
+      m_strand(ioService),
+#ifdef CPPUTIL_USE_TIMERFD
+      m_descriptor(ioService),
+      m_uiExpirations(0)
+#else
+      m_timer(ioService)
+#endif
+    {
+
+    }
+
+    boost::system::error_code start()
+    {
+      m_iStartNs = nowNs();
+#ifdef CPPUTIL_USE_TIMERFD
+      int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      if (fd < 0)
+      {
+        return boost::system::error_code(errno, boost::system::system_category());
+      }
+      struct itimerspec spec;
+      toTimespec(m_iStartNs + m_uiPeriodNs, spec.it_value);
+      toTimespec(m_uiPeriodNs, spec.it_interval);
+      if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0)
+      {
+        boost::system::error_code ec(errno, boost::system::system_category());
+        ::close(fd);
+        return ec;
+      }
+      boost::system::error_code ec;
+      m_descriptor.assign(fd, ec);
+      if (ec)
+      {
+        ::close(fd);
+        return ec;
+      }
+#else
+      m_timer.expires_at(toTimePoint(m_iStartNs + m_uiPeriodNs));
+#endif
+      m_bRunning = true;
+      asyncWait();
+      return boost::system::error_code();
+    }
+
+    void stop()
+    {
+      {
+        // waits for a tick in progress on another thread
+        boost::recursive_mutex::scoped_lock lock(m_tickMutex);
+        if (!m_bRunning.exchange(false)) return;
+      }
+      m_strand.post(boost::bind(&Schedule::cancel, shared_from_this()));
+    }
+
+    bool isRunning() const { return m_bRunning; }
+
+    LatenessStatistics getStatistics() const
+    {
+      boost::mutex::scoped_lock lock(m_statsMutex);
+      return m_stats;
+    }
+
+  private:
+    void cancel()
+    {
+      boost::system::error_code ec;
+#ifdef CPPUTIL_USE_TIMERFD
+      m_descriptor.cancel(ec);
+      m_descriptor.close(ec);
+#else
+      m_timer.cancel(ec);
+#endif
+    }
+
+#ifdef CPPUTIL_USE_TIMERFD
+    static void toTimespec(int64_t iNs, struct timespec& ts)
+    {
+      ts.tv_sec = static_cast<time_t>(iNs / 1000000000);
+      ts.tv_nsec = static_cast<long>(iNs % 1000000000);
+    }
+
+    void asyncWait()
+    {
+      // the timerfd becomes readable once it has expired and yields the number of expirations
+      m_descriptor.async_read_some(boost::asio::buffer(&m_uiExpirations, sizeof(m_uiExpirations)),
+                                   m_strand.wrap(boost::bind(&Schedule::onTimerFd, shared_from_this(), boost::asio::placeholders::error,
+                                                             boost::asio::placeholders::bytes_transferred)));
+    }
+
+    void onTimerFd(const boost::system::error_code& ec, std::size_t uiBytes)
+    {
+      if (ec == boost::asio::error::would_block || ec == boost::asio::error::try_again)
+      {
+        if (m_bRunning) asyncWait();
+        return;
+      }
+      if (ec || uiBytes != sizeof(m_uiExpirations))
+      {
+        if (ec && ec != boost::asio::error::operation_aborted)
+        {
+          LOG(WARNING) << "Periodic scheduler error: " << ec.message();
+        }
+        return;
+      }
+      {
+        boost::recursive_mutex::scoped_lock lock(m_tickMutex);
+        if (!m_bRunning) return;
+        onExpired(m_uiExpirations);
+      }
+      if (m_bRunning) asyncWait();
+    }
+#else
+    static boost::chrono::steady_clock::time_point toTimePoint(int64_t iNs)
+    {
+      return boost::chrono::steady_clock::time_point(boost::chrono::nanoseconds(iNs));
+    }
+
+    void asyncWait()
+    {
+      m_timer.async_wait(m_strand.wrap(boost::bind(&Schedule::onTimer, shared_from_this(), boost::asio::placeholders::error)));
+    }
+
+    void onTimer(const boost::system::error_code& ec)
+    {
+      if (ec)
+      {
+        if (ec != boost::asio::error::operation_aborted)
+        {
+          LOG(WARNING) << "Periodic scheduler error: " << ec.message();
+        }
+        return;
+      }
+      {
+        boost::recursive_mutex::scoped_lock lock(m_tickMutex);
+        if (!m_bRunning) return;
+        // number of deadlines that have passed since the last tick
+        uint64_t uiDue = static_cast<uint64_t>((nowNs() - m_iStartNs) / m_uiPeriodNs);
+        uint64_t uiExpirations = (uiDue > m_uiTick) ? uiDue - m_uiTick : 1;
+        onExpired(uiExpirations);
+      }
+      if (m_bRunning)
+      {
+        m_timer.expires_at(toTimePoint(m_iStartNs + static_cast<int64_t>(m_uiTick + 1) * m_uiPeriodNs));
+        asyncWait();
+      }
+    }
+#endif
+
+    /// Must be called with m_tickMutex held
+    void onExpired(uint64_t uiExpirations)
+    {
+      // the deadline of the most recent expiration
+      int64_t iDeadlineNs = m_iStartNs + static_cast<int64_t>(m_uiTick + uiExpirations) * m_uiPeriodNs;
+      {
+        boost::mutex::scoped_lock lock(m_statsMutex);
+        m_stats.record(nowNs() - iDeadlineNs, uiExpirations - 1);
+      }
+
+      if (m_ePolicy == MTP_SKIP)
+      {
+        m_uiTick += uiExpirations;
+        invoke(m_uiTick);
+      }
+      else
+      {
+        for (uint64_t i = 0; i < uiExpirations && m_bRunning; ++i)
+        {
+          invoke(++m_uiTick);
+        }
+      }
+    }
+
+    void invoke(uint64_t uiTick)
+    {
+      try
+      {
+        m_onTick(uiTick);
+      }
+      catch(boost::exception &e)
+      {
+        LOG(ERROR) << "Boost Exception: " << boost::diagnostic_information(e);
+      }
+      catch(std::exception& e)
+      {
+        LOG(ERROR) << "Std Exception: " << e.what();
+      }
+    }
+
+    const int64_t m_uiPeriodNs;
+    const MissedTickPolicy m_ePolicy;
+    const OnTick_t m_onTick;
+    std::atomic<bool> m_bRunning;
+    /// held while a tick executes. Recursive so that the tick handler may call stop().
+    boost::recursive_mutex m_tickMutex;
+    int64_t m_iStartNs;
+    uint64_t m_uiTick;
+
+    boost::asio::io_service::strand m_strand;
+#ifdef CPPUTIL_USE_TIMERFD
+    boost::asio::posix::stream_descriptor m_descriptor;
+    uint64_t m_uiExpirations;
+#else
+    boost::asio::basic_waitable_timer<boost::chrono::steady_clock> m_timer;
+#endif
+
+    mutable boost::mutex m_statsMutex;
+    LatenessStatistics m_stats;
+  };
+
+  static int64_t nowNs()
+  {
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  boost::shared_ptr<Schedule> getSchedule() const
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_pSchedule;
+  }
+
+  boost::asio::io_service& m_ioService;
+  const int64_t m_uiPeriodNs;
+  const MissedTickPolicy m_ePolicy;
+  mutable boost::mutex m_mutex;
+  boost::shared_ptr<Schedule> m_pSchedule;
+};
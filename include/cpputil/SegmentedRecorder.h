@@ -0,0 +1,388 @@
+#pragma once
+
+#ifdef _WIN32
+  #error "SegmentedRecorder.h requires POSIX file I/O (open, writev, ftruncate)"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/chrono.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/system/error_code.hpp>
+#include <glog/logging.h>
+// POSIX
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "Buffer.h"
+#include "FileUtil.h"
+
+/// Rotation, batching and disk space settings of a SegmentedRecorder
+struct SegmentPolicy
+{
+  SegmentPolicy(uint64_t maxSegmentBytes = 256 * 1024 * 1024, uint32_t maxSegmentDurationMs = 0,
+                uint32_t batchBytes = 1024 * 1024, double minFreeSpace = 0.05, bool preallocate = true)
+    :uiMaxSegmentBytes(maxSegmentBytes),
+    uiMaxSegmentDurationMs(maxSegmentDurationMs),
+    uiBatchBytes(batchBytes),
+    dMinFreeSpace(minFreeSpace),
+    bPreallocate(preallocate)
+  {
+
+  }
+
+  /// a new segment is started before a buffer would make the segment exceed this size
+  uint64_t uiMaxSegmentBytes;
+  /// a new segment is started once the segment is older than this. 0 disables time based rotation.
+  uint32_t uiMaxSegmentDurationMs;
+  /// appended buffers are collected until this many bytes are pending and then written with one writev
+  uint32_t uiBatchBytes;
+  /// the oldest segments are deleted while the free space fraction reported by
+  /// FileUtil::calculateFreeSpacePercentage is below this value. 0 disables the check.
+  double dMinFreeSpace;
+  /// if set, the space for a full segment is allocated when the segment is created
+  bool bPreallocate;
+};
+
+/// SegmentedRecorder counters
+struct RecorderStats
+{
+  RecorderStats()
+    :uiBytesWritten(0),
+    uiWrites(0),
+    uiSegmentsCreated(0),
+    uiSegmentsDeleted(0)
+  {
+
+  }
+
+  uint64_t uiBytesWritten;
+  /// number of writev calls
+  uint64_t uiWrites;
+  uint64_t uiSegmentsCreated;
+  /// segments deleted to free disk space
+  uint64_t uiSegmentsDeleted;
+};
+
+/**
+ * @brief Records a continuous stream of buffers into rotating segment files.
+ *
+ * Segments are named <prefix>_<index>.seg in the recording directory. The index continues
+ * after the highest index found in the directory when the recorder is opened, and segments of
+ * earlier recordings are subject to deletion like the ones written by this recorder.
+ *
+ * Appended buffers are not copied: they are held until the batch is written with a single
+ * writev. Each segment is preallocated with fallocate so that it is laid out contiguously and
+ * truncated to the data actually written when it is closed. After each write the free disk
+ * space is checked and the oldest closed segments are deleted while it is below the threshold.
+ *
+ * The recorder is not thread-safe and is meant to be driven by a single thread, e.g. the
+ * service thread of a MailboxService. It uses POSIX file I/O and is not available on Windows;
+ * segments are only preallocated on Linux.
+ */
+class SegmentedRecorder : public boost::noncopyable
+{
+public:
+  /**
+   * @brief SegmentedRecorder
+   * @param sDirectory The directory the segments are written to. It is created if it does not exist.
+   * @param sPrefix The prefix of the segment file names
+   * @param policy The rotation, batching and disk space settings
+   */
+  SegmentedRecorder(const std::string& sDirectory, const std::string& sPrefix, const SegmentPolicy& policy = SegmentPolicy())
+    :m_sDirectory(sDirectory),
+    m_sPrefix(sPrefix),
+    m_policy(policy),
+    m_fd(-1),
+    m_uiNextIndex(0),
+    m_uiSegmentBytes(0),
+    m_uiSegmentWritten(0),
+    m_iSegmentStartNs(0),
+    m_uiBatchBytes(0),
+    m_bLowSpaceReported(false)
+  {
+
+  }
+
+  ~SegmentedRecorder()
+  {
+    close();
+  }
+
+  static const char* getSegmentExtension() { return ".seg"; }
+
+  static std::string getSegmentName(const std::string& sPrefix, uint64_t uiIndex)
+  {
+    char szIndex[32];
+    snprintf(szIndex, sizeof(szIndex), "%08llu", static_cast<unsigned long long>(uiIndex));
+    return sPrefix + "_" + szIndex + getSegmentExtension();
+  }
+
+  /// creates the directory if necessary and starts the first segment
+  boost::system::error_code open()
+  {
+    if (m_fd >= 0)
+      return boost::system::error_code(boost::system::errc::operation_not_permitted, boost::system::generic_category());
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(m_sDirectory, ec);
+    if (ec) return ec;
+    scanSegments();
+    return openSegment();
+  }
+
+  bool isOpen() const { return m_fd >= 0; }
+
+  /**
+   * @brief append queues the buffer for writing. The buffer must not be modified until it has been written.
+   * A new segment is started first if the buffer does not fit into the current segment or the segment has expired.
+   * If the current segment fails to close, the buffer is still appended to the new segment and the error is returned.
+   */
+  boost::system::error_code append(const Buffer& buffer)
+  {
+    if (m_fd < 0)
+      return boost::system::error_code(boost::system::errc::bad_file_descriptor, boost::system::generic_category());
+    if (buffer.getSize() == 0) return boost::system::error_code();
+
+    boost::system::error_code ecRotate;
+    if (m_uiSegmentBytes > 0 && (m_uiSegmentBytes + buffer.getSize() > m_policy.uiMaxSegmentBytes || isSegmentExpired()))
+    {
+      ecRotate = rotate();
+      // the next segment could not be opened
+      if (m_fd < 0) return ecRotate;
+    }
+
+    m_vBatch.push_back(buffer);
+    struct iovec iov;
+    iov.iov_base = const_cast<uint8_t*>(buffer.data());
+    iov.iov_len = buffer.getSize();
+    m_vIov.push_back(iov);
+    m_uiBatchBytes += buffer.getSize();
+    m_uiSegmentBytes += buffer.getSize();
+    if (m_uiBatchBytes >= m_policy.uiBatchBytes)
+    {
+      boost::system::error_code ec = flush();
+      if (ec) return ec;
+    }
+    return ecRotate;
+  }
+
+  /// writes the pending batch to the current segment
+  boost::system::error_code flush()
+  {
+    if (m_fd < 0 || m_vIov.empty()) return boost::system::error_code();
+    boost::system::error_code ec = writeBatch();
+    enforceFreeSpace();
+    return ec;
+  }
+
+  /**
+   * @brief rotate closes the current segment and starts the next one.
+   * The next segment is opened even if closing the current segment fails, so recording continues.
+   * @return the error of opening the next segment, otherwise the error of closing the current one
+   */
+  boost::system::error_code rotate()
+  {
+    boost::system::error_code ec = closeSegment();
+    if (ec)
+    {
+      LOG(WARNING) << "Failed to close segment " << m_sCurrentSegment << ", continuing with the next segment: " << ec.message();
+    }
+    boost::system::error_code ecOpen = openSegment();
+    return ecOpen ? ecOpen : ec;
+  }
+
+  /// writes the pending batch and closes the current segment
+  boost::system::error_code close()
+  {
+    return closeSegment();
+  }
+
+  /// returns the path of the segment currently written, empty if the recorder is closed
+  std::string getCurrentSegment() const { return (m_fd >= 0) ? m_sCurrentSegment : std::string(); }
+
+  /// returns the offset in the current segment at which the next appended buffer is written
+  uint64_t getCurrentOffset() const { return m_uiSegmentBytes; }
+
+  /// returns the paths of the closed segments, oldest first
+  std::vector<std::string> getClosedSegments() const
+  {
+    return std::vector<std::string>(m_dqClosedSegments.begin(), m_dqClosedSegments.end());
+  }
+
+  RecorderStats getStats() const { return m_stats; }
+
+private:
+  static int64_t nowNs()
+  {
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  bool isSegmentExpired() const
+  {
+    return m_policy.uiMaxSegmentDurationMs != 0 &&
+        nowNs() - m_iSegmentStartNs >= static_cast<int64_t>(m_policy.uiMaxSegmentDurationMs) * 1000000;
+  }
+
+  /// parses the index from the name of a segment of this recorder. Returns false for other files.
+  bool parseSegmentIndex(const std::string& sFileName, uint64_t& uiIndex) const
+  {
+    const std::string sExtension(getSegmentExtension());
+    size_t uiPrefix = m_sPrefix.length() + 1;
+    if (sFileName.length() <= uiPrefix + sExtension.length()) return false;
+    if (sFileName.compare(0, m_sPrefix.length(), m_sPrefix) != 0 || sFileName[m_sPrefix.length()] != '_') return false;
+    if (sFileName.compare(sFileName.length() - sExtension.length(), sExtension.length(), sExtension) != 0) return false;
+    std::string sIndex = sFileName.substr(uiPrefix, sFileName.length() - uiPrefix - sExtension.length());
+    if (sIndex.find_first_not_of("0123456789") != std::string::npos) return false;
+    uiIndex = strtoull(sIndex.c_str(), nullptr, 10);
+    return true;
+  }
+
+  /// picks up the segments of previous recordings
+  void scanSegments()
+  {
+    std::vector<std::pair<uint64_t, std::string> > vSegments;
+    for (const std::string& sFileName : FileUtil::getFileList(m_sDirectory, ""))
+    {
+      uint64_t uiIndex = 0;
+      if (parseSegmentIndex(sFileName, uiIndex))
+      {
+        vSegments.push_back(std::make_pair(uiIndex, (boost::filesystem::path(m_sDirectory) / sFileName).string()));
+      }
+    }
+    std::sort(vSegments.begin(), vSegments.end());
+    m_dqClosedSegments.clear();
+    for (const std::pair<uint64_t, std::string>& segment : vSegments)
+    {
+      m_dqClosedSegments.push_back(segment.second);
+    }
+    m_uiNextIndex = vSegments.empty() ? 0 : vSegments.back().first + 1;
+  }
+
+  boost::system::error_code openSegment()
+  {
+    std::string sSegment = (boost::filesystem::path(m_sDirectory) / getSegmentName(m_sPrefix, m_uiNextIndex)).string();
+    int fd = ::open(sSegment.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+      boost::system::error_code ec(errno, boost::system::system_category());
+      LOG(WARNING) << "Failed to create segment " << sSegment << ": " << ec.message();
+      return ec;
+    }
+#if defined(__linux__)
+    if (m_policy.bPreallocate && m_policy.uiMaxSegmentBytes > 0)
+    {
+      // the file size is only extended by writes, so readers of the segment never see the preallocated space
+      if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(m_policy.uiMaxSegmentBytes)) < 0)
+      {
+        VLOG(15) << "Failed to preallocate segment " << sSegment << ": " << strerror(errno);
+      }
+    }
+#endif
+    m_fd = fd;
+    ++m_uiNextIndex;
+    m_sCurrentSegment = sSegment;
+    m_uiSegmentBytes = 0;
+    m_uiSegmentWritten = 0;
+    m_iSegmentStartNs = nowNs();
+    ++m_stats.uiSegmentsCreated;
+    VLOG(15) << "Segment opened: " << sSegment;
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code closeSegment()
+  {
+    if (m_fd < 0) return boost::system::error_code();
+    boost::system::error_code ec = writeBatch();
+    // release the preallocated space that was not used
+    if (ftruncate(m_fd, static_cast<off_t>(m_uiSegmentWritten)) < 0 && !ec)
+    {
+      ec = boost::system::error_code(errno, boost::system::system_category());
+    }
+    ::close(m_fd);
+    m_fd = -1;
+    m_dqClosedSegments.push_back(m_sCurrentSegment);
+    VLOG(15) << "Segment closed: " << m_sCurrentSegment << " size: " << m_uiSegmentWritten;
+    enforceFreeSpace();
+    return ec;
+  }
+
+  boost::system::error_code writeBatch()
+  {
+    uint64_t uiWritten = 0;
+    boost::system::error_code ec = FileUtil::writevAll(m_fd, m_vIov, uiWritten, m_stats.uiWrites);
+    if (ec)
+    {
+      LOG(WARNING) << "Failed to write segment " << m_sCurrentSegment << ": " << ec.message();
+    }
+    m_uiSegmentWritten += uiWritten;
+    m_stats.uiBytesWritten += uiWritten;
+    // on error the unwritten part of the batch is dropped
+    m_uiSegmentBytes = m_uiSegmentWritten;
+    m_vIov.clear();
+    m_vBatch.clear();
+    m_uiBatchBytes = 0;
+    return ec;
+  }
+
+  /// deletes the oldest closed segments while the free disk space is below the threshold
+  void enforceFreeSpace()
+  {
+    if (m_policy.dMinFreeSpace <= 0.0) return;
+    double dFree = FileUtil::calculateFreeSpacePercentage(m_sDirectory);
+    // 0 is also returned if the file system could not be queried
+    if (dFree <= 0.0) return;
+    while (dFree < m_policy.dMinFreeSpace && !m_dqClosedSegments.empty())
+    {
+      std::string sOldest = m_dqClosedSegments.front();
+      m_dqClosedSegments.pop_front();
+      if (::unlink(sOldest.c_str()) < 0 && errno != ENOENT)
+      {
+        LOG(WARNING) << "Failed to delete segment " << sOldest << ": " << strerror(errno);
+        continue;
+      }
+      ++m_stats.uiSegmentsDeleted;
+      LOG(WARNING) << "Low disk space: deleted segment " << sOldest;
+      dFree = FileUtil::calculateFreeSpacePercentage(m_sDirectory);
+    }
+    if (dFree < m_policy.dMinFreeSpace)
+    {
+      if (!m_bLowSpaceReported)
+      {
+        LOG(WARNING) << "Low disk space in " << m_sDirectory << " and no segments left to delete";
+        m_bLowSpaceReported = true;
+      }
+    }
+    else
+    {
+      m_bLowSpaceReported = false;
+    }
+  }
+
+  const std::string m_sDirectory;
+  const std::string m_sPrefix;
+  const SegmentPolicy m_policy;
+
+  int m_fd;
+  uint64_t m_uiNextIndex;
+  std::string m_sCurrentSegment;
+  /// size of the current segment including the pending batch
+  uint64_t m_uiSegmentBytes;
+  /// bytes of the current segment written to the file
+  uint64_t m_uiSegmentWritten;
+  int64_t m_iSegmentStartNs;
+
+  /// the buffers of the pending batch are held until they have been written
+  std::vector<Buffer> m_vBatch;
+  std::vector<struct iovec> m_vIov;
+  uint64_t m_uiBatchBytes;
+
+  std::deque<std::string> m_dqClosedSegments;
+  bool m_bLowSpaceReported;
+  RecorderStats m_stats;
+};
@@ -1,20 +1,60 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <memory>
-#include <boost/asio/deadline_timer.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <boost/asio/io_service.hpp>
 #include <boost/asio/placeholders.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/bind.hpp>
+#include <boost/chrono.hpp>
 #include <boost/function.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/thread.hpp>
+#include "Clock.h"
+#include "LatenessStatistics.h"
+#include "ShardedStrand.h"
+#include "StallWatchdog.h"
+#include "TaskQueue.h"
+#include "ThreadUtil.h"
 
 // -DSINGLE_CORE: can be used to simplify debugging and determining
 // whether multi-threading related bugs are occurring
 // #define SINGLE_CORE
 
+/**
+ * @brief Parameters of the elastic worker mode of the ServiceController.
+ * The controller samples the io_service queue delay and the worker utilization every uiSampleIntervalMs.
+ * The utilization is the share of the sample interval the workers spent outside of waiting for handlers.
+ * Handlers posted directly to the io_service instead of through post() are accounted as waiting.
+ * A worker is added whenever the queue delay exceeds uiScaleUpDelayUs, and a worker is retired once
+ * the utilization stayed below dScaleDownUtilization for uiScaleDownSamples consecutive samples.
+ */
+struct ElasticPolicy
+{
+  ElasticPolicy(uint32_t sampleIntervalMs = 100, uint32_t scaleUpDelayUs = 2000,
+                double scaleDownUtilization = 0.25, uint32_t scaleDownSamples = 10)
+    :uiSampleIntervalMs(sampleIntervalMs),
+    uiScaleUpDelayUs(scaleUpDelayUs),
+    dScaleDownUtilization(scaleDownUtilization),
+    uiScaleDownSamples(scaleDownSamples)
+  {
+
+  }
+
+  uint32_t uiSampleIntervalMs;
+  uint32_t uiScaleUpDelayUs;
+  double dScaleDownUtilization;
+  uint32_t uiScaleDownSamples;
+};
+
 /**
  * This class provides active object functionality
  * Sub-classes should provide event-loop starting and
@@ -27,6 +67,17 @@ class ServiceController : public boost::noncopyable
 public:
 
   typedef boost::function<void ()> OnStart_t;
+  /// Called with the tag and the task whenever a task is shed by a bounded queue
+  typedef boost::function<void (const std::string&, Task_t&)> OnShed_t;
+
+  /// Determines how worker threads wait for handlers
+  enum RunMode
+  {
+    /// Workers block in io_service::run()
+    RM_BLOCKING,
+    /// Workers spin on io_service::poll() with adaptive backoff: spin, then yield, then park
+    RM_BUSY_POLL
+  };
 
   virtual ~ServiceController(){}
 
@@ -42,6 +93,291 @@ public:
   /// Completion handler
   void setOnStartHandler(OnStart_t onStart) { m_onStart = onStart; }
 
+  /**
+   * @brief setRunMode configures how the worker threads wait for handlers.
+   * This can only be changed while the controller is not running.
+   * @param eRunMode RM_BLOCKING or RM_BUSY_POLL
+   * @param spinPolicy The spin and yield budgets used in RM_BUSY_POLL mode before a worker parks
+   * @return true if the mode could be set
+   */
+  bool setRunMode(RunMode eRunMode, const SpinPolicy& spinPolicy = SpinPolicy())
+  {
+    if (!isReady()) return false;
+    m_eRunMode = eRunMode;
+    m_spinPolicy = spinPolicy;
+    return true;
+  }
+
+  /**
+   * @brief getShardedStrand returns the controller's keyed strands.
+   * Handlers posted with the same key run in order, handlers of different keys run in parallel.
+   */
+  ShardedStrand& getShardedStrand() { return m_shardedStrand; }
+
+  /**
+   * @brief setStrandShardCount sets the number of strands keys are hashed onto.
+   * This can only be changed while the controller is not running.
+   * @return true if the number of shards could be changed
+   */
+  bool setStrandShardCount(uint32_t uiShards)
+  {
+    if (!isReady()) return false;
+    m_shardedStrand.resize(uiShards);
+    return true;
+  }
+
+  /// queues the handler for execution in order with all other handlers posted with the same key
+  template <typename Key, typename Handler>
+  void postOrdered(const Key& key, Handler handler)
+  {
+    m_shardedStrand.post(key, handler);
+  }
+
+  /**
+   * @brief setQueueCapacity bounds the controller's default task queue used by post(task)
+   * @param uiCapacity The maximum number of queued tasks. 0 means unbounded.
+   * @param ePolicy The policy applied once the queue is full
+   */
+  void setQueueCapacity(uint32_t uiCapacity, ShedPolicy ePolicy = SP_REJECT)
+  {
+    m_pDefaultQueue->configure(uiCapacity, ePolicy);
+  }
+
+  /**
+   * @brief setQueueCapacity bounds the task queue of the specified tag used by post(sTag, task)
+   * @param sTag The tag identifying the queue. Tasks of different tags are admitted independently.
+   * @param uiCapacity The maximum number of queued tasks. 0 means unbounded.
+   * @param ePolicy The policy applied once the queue is full
+   */
+  void setQueueCapacity(const std::string& sTag, uint32_t uiCapacity, ShedPolicy ePolicy = SP_REJECT)
+  {
+    getQueue(sTag)->configure(uiCapacity, ePolicy);
+  }
+
+  /// The shed handler is called in the posting thread for every dropped or replaced task
+  void setShedHandler(OnShed_t onShed) { m_onShed = onShed; }
+
+  /**
+   * @brief post queues the task on the controller's default queue
+   * @return AR_REJECTED if the queue is full and the policy is SP_REJECT.
+   * The task will be executed for AR_ADMITTED, AR_DROPPED_OLDEST and AR_COALESCED.
+   */
+  AdmissionResult post(const Task_t& task)
+  {
+    return post(std::string(), m_pDefaultQueue, task);
+  }
+
+  /**
+   * @brief post queues the task on the queue of the specified tag
+   * @return AR_REJECTED if the queue is full and the policy is SP_REJECT.
+   * The task will be executed for AR_ADMITTED, AR_DROPPED_OLDEST and AR_COALESCED.
+   */
+  AdmissionResult post(const std::string& sTag, const Task_t& task)
+  {
+    return post(sTag, getQueue(sTag), task);
+  }
+
+  /**
+   * @brief post queues the task on the default queue of the specified lane
+   * @return AR_REJECTED if the queue is full and the policy is SP_REJECT.
+   */
+  AdmissionResult post(TaskPriority ePriority, const Task_t& task)
+  {
+    return post(std::string(), m_apLaneQueues[ePriority], task);
+  }
+
+  /**
+   * @brief postHelper queues the task on an internal, unbounded queue of the specified lane.
+   * Helper tasks are never rejected or shed and never cause user tasks to be shed. They are meant for
+   * optional work that the poster completes itself otherwise, such as the helpers of the parallel algorithms.
+   */
+  void postHelper(TaskPriority ePriority, const Task_t& task)
+  {
+    post(std::string(), m_apHelperQueues[ePriority], task);
+  }
+
+  /**
+   * @brief setQueuePriority assigns the queue of the specified tag to a lane. Tags are in the TP_NORMAL lane by default.
+   * This should be called before tasks are posted to the tag.
+   */
+  void setQueuePriority(const std::string& sTag, TaskPriority ePriority)
+  {
+    TaskQueuePtr_t pQueue = getQueue(sTag);
+    boost::mutex::scoped_lock lock(m_queueMutex);
+    // all lanes are locked in index order so that popFromLane never sees the queue between two lanes
+    boost::unique_lock<boost::mutex> aLaneLocks[TP_COUNT];
+    for (uint32_t i = 0; i < TP_COUNT; ++i)
+    {
+      aLaneLocks[i] = boost::unique_lock<boost::mutex>(m_aLanes[i].mutex);
+    }
+    for (uint32_t i = 0; i < TP_COUNT; ++i)
+    {
+      std::vector<TaskQueuePtr_t>& vLane = m_aLanes[i].vQueues;
+      auto it = std::find(vLane.begin(), vLane.end(), pQueue);
+      if (it == vLane.end()) continue;
+      vLane.erase(it);
+      uint32_t uiDepth = pQueue->getDepth();
+      m_aLanes[i].uiDepth -= uiDepth;
+      m_aLanes[ePriority].uiDepth += uiDepth;
+    }
+    m_aLanes[ePriority].vQueues.push_back(pQueue);
+    pQueue->setPriority(ePriority);
+  }
+
+  /**
+   * @brief setBackgroundShare limits the number of workers that may execute TP_BACKGROUND tasks concurrently.
+   * Drain tokens that find only background work while the limit is reached are deferred until a background task completes.
+   * @param uiMaxWorkers The maximum number of workers. 0 means no limit.
+   */
+  void setBackgroundShare(uint32_t uiMaxWorkers)
+  {
+    boost::mutex::scoped_lock lock(m_backgroundMutex);
+    m_uiBackgroundShare = uiMaxWorkers;
+    // deferred tokens re-check the new limit
+    for (; m_uiDeferredTokens > 0; --m_uiDeferredTokens)
+    {
+      m_rIo_service.post(boost::bind(&ServiceController::runQueuedTasks, this, 1));
+    }
+  }
+
+  /**
+   * @brief postBatch queues all tasks on the default queue with a single lock and wakes
+   * at most one worker per running thread. The tasks are split into equal chunks, one per woken worker.
+   * @return the number of tasks that were queued. Tasks not queued were rejected or shed.
+   */
+  uint32_t postBatch(const std::vector<Task_t>& vTasks)
+  {
+    return postBatch(std::string(), m_pDefaultQueue, vTasks);
+  }
+
+  /**
+   * @brief postBatch queues all tasks on the queue of the specified tag with a single lock and wakes
+   * at most one worker per running thread. The tasks are split into equal chunks, one per woken worker.
+   * @return the number of tasks that were queued. Tasks not queued were rejected or shed.
+   */
+  uint32_t postBatch(const std::string& sTag, const std::vector<Task_t>& vTasks)
+  {
+    return postBatch(sTag, getQueue(sTag), vTasks);
+  }
+
+  /**
+   * @brief setStallWatchdog attaches a watchdog to the controller. While the controller is running,
+   * all workers are registered with the watchdog, tasks posted through post() and postBatch() are
+   * tracked under their tag and heartbeat probes detect stalls in other handlers.
+   * The watchdog thread is started with the controller. This can only be changed while the controller is not running.
+   * @return true if the watchdog could be set
+   */
+  bool setStallWatchdog(boost::shared_ptr<StallWatchdog> pWatchdog)
+  {
+    if (!isReady()) return false;
+    m_pWatchdog = pWatchdog;
+    return true;
+  }
+
+  /**
+   * @brief setElasticThreads enables the elastic worker mode in which the number of workers is adjusted
+   * between uiMinThreads and uiMaxThreads while the controller is running. The fixed thread count of the
+   * constructor is ignored in this mode. This can only be changed while the controller is not running.
+   * @param uiMinThreads The number of workers started initially. At least one worker is always kept.
+   * @param uiMaxThreads The upper bound. 0 means the number of cores.
+   * @param policy The sampling and scaling thresholds
+   * @return true if the mode could be set
+   */
+  bool setElasticThreads(uint32_t uiMinThreads, uint32_t uiMaxThreads, const ElasticPolicy& policy = ElasticPolicy())
+  {
+    if (!isReady()) return false;
+    if (uiMaxThreads == 0)
+    {
+      unsigned uiCores = boost::thread::hardware_concurrency();
+      uiMaxThreads = (uiCores > 0) ? uiCores : 1;
+    }
+#ifdef SINGLE_CORE
+    uiMinThreads = uiMaxThreads = 1;
+#endif
+    m_uiMinThreads = std::max<uint32_t>(uiMinThreads, 1);
+    m_uiElasticMaxThreads = std::max(uiMaxThreads, m_uiMinThreads);
+    m_elasticPolicy = policy;
+    m_bElastic = true;
+    return true;
+  }
+
+  /// disables the elastic worker mode. This can only be changed while the controller is not running.
+  bool setFixedThreads()
+  {
+    if (!isReady()) return false;
+    m_bElastic = false;
+    return true;
+  }
+
+  bool isElastic() const { return m_bElastic; }
+
+  /// returns the number of worker threads while running, 0 otherwise
+  uint32_t getThreadCount() const { return m_uiThreadCount; }
+
+  /// returns the most recently measured io_service queue delay in elastic mode
+  uint64_t getMeasuredQueueDelayUs() const { return static_cast<uint64_t>(m_iQueueDelayUs.load()); }
+
+  /// returns the worker utilization of the most recent sample interval in elastic mode
+  double getMeasuredUtilization() const { return m_dUtilization.load(); }
+
+  /// returns the gauges of the default queue
+  TaskQueueStats getQueueStats() const
+  {
+    return m_pDefaultQueue->getStats();
+  }
+
+  /// returns the gauges of the queue of the specified tag
+  TaskQueueStats getQueueStats(const std::string& sTag) const
+  {
+    boost::mutex::scoped_lock lock(m_queueMutex);
+    auto it = m_mQueues.find(sTag);
+    if (it == m_mQueues.end()) return TaskQueueStats();
+    return it->second->getStats();
+  }
+
+  /// returns the gauges of the default queue of the specified lane
+  TaskQueueStats getQueueStats(TaskPriority ePriority) const
+  {
+    return m_apLaneQueues[ePriority]->getStats();
+  }
+
+  /// returns the number of tasks queued over all tags
+  uint32_t getTotalQueueDepth() const
+  {
+    uint32_t uiDepth = 0;
+    for (uint32_t i = 0; i < TP_COUNT; ++i)
+    {
+      boost::mutex::scoped_lock lock(m_aLanes[i].mutex);
+      for (size_t j = 0; j < m_aLanes[i].vQueues.size(); ++j)
+      {
+        uiDepth += m_aLanes[i].vQueues[j]->getDepth();
+      }
+    }
+    return uiDepth;
+  }
+
+  /// returns a snapshot of how late doPeriodicTask was executed relative to its deadlines
+  LatenessStatistics getPeriodicTaskStats() const
+  {
+    boost::mutex::scoped_lock lock(m_timerStatsMutex);
+    return m_timerStats;
+  }
+
+  RunMode getRunMode() const { return m_eRunMode; }
+  const SpinPolicy& getSpinPolicy() const { return m_spinPolicy; }
+
+  /**
+   * @brief setCpuAffinity pins worker threads to cores. Worker i is pinned to vCores[i % vCores.size()].
+   * An empty vector disables pinning. This can only be changed while the controller is not running.
+   * @return true if the affinity could be set
+   */
+  bool setCpuAffinity(const std::vector<unsigned>& vCores)
+  {
+    if (!isReady()) return false;
+    m_vCores = vCores;
+    return true;
+  }
+
   boost::system::error_code start()
   {
     // give subclass a chance to take action
@@ -49,6 +385,11 @@ public:
     if (ec) return ec;
 
     m_pWork = boost::shared_ptr<boost::asio::io_service::work>(new boost::asio::io_service::work(m_rIo_service));
+    if (m_pWatchdog)
+    {
+      m_pWatchdog->monitor(m_rIo_service);
+      m_pWatchdog->start();
+    }
     m_timer.async_wait(boost::bind(&ServiceController::onTimer, this, boost::asio::placeholders::error ));
 
     unsigned uiCores = boost::thread::hardware_concurrency();
@@ -60,7 +401,16 @@ public:
 #ifdef SINGLE_CORE
     uiCores = 1;
 #else
-    if (m_uiMaxThreads!= 0 && uiCores > m_uiMaxThreads)
+    if (SimulatedClock::isSimulated())
+    {
+      // virtual time is only deterministic with a single worker
+      uiCores = 1;
+    }
+    else if (m_bElastic)
+    {
+      uiCores = m_uiMinThreads;
+    }
+    else if (m_uiMaxThreads!= 0 && uiCores > m_uiMaxThreads)
     {
       uiCores = m_uiMaxThreads;
     }
@@ -68,36 +418,35 @@ public:
     VLOG(15) << "Using " << uiCores << " cores";
 
     // create threads for io service
-    if (uiCores > 1)
     {
-      boost::thread_group worker_threads;
+      boost::mutex::scoped_lock lock(m_workerMutex);
+      m_bMonitorStop = false;
+      m_uiRetireRequests = 0;
+      m_iProbePostedNs = 0;
+      m_uiNextWorker = 0;
+      m_dqWaitTimes.clear();
+      m_dUtilization = 0.0;
       for( unsigned x = 0; x < uiCores; ++x )
       {
-        worker_threads.create_thread( boost::bind( &ServiceController::runIoService, this ) );
+        spawnWorker();
       }
-
-      m_eState = SS_RUNNING;
-      if (m_onStart)
-        m_onStart();
-
-      worker_threads.join_all();
     }
-    else
+
+    m_eState = SS_RUNNING;
+    if (m_bElastic && !SimulatedClock::isSimulated())
     {
-#if 0
-      m_eState = SS_RUNNING;
-      runIoService();
-#endif
-      boost::thread_group worker_threads;
-      worker_threads.create_thread( boost::bind( &ServiceController::runIoService, this ) );
-      m_eState = SS_RUNNING;
+      m_pMonitorThread = boost::make_shared<boost::thread>(boost::bind(&ServiceController::runElasticMonitor, this));
+    }
 
-      if (m_onStart)
-        m_onStart();
+    if (m_onStart)
+      m_onStart();
 
-      worker_threads.join_all();
-    }
+    joinWorkers();
 
+    if (m_pWatchdog)
+    {
+      m_pWatchdog->stopMonitoring(m_rIo_service);
+    }
     m_rIo_service.reset();
     m_eState = SS_READY;
     return boost::system::error_code();
@@ -125,24 +474,64 @@ public:
      */
   ServiceController(unsigned uiTimerTimeoutMs = 1000, uint32_t uiMaxThreads = 0)
     :m_rIo_service(m_ioService),
-      m_strand(m_rIo_service),
+      m_shardedStrand(m_rIo_service, getDefaultStrandShardCount()),
       m_eState(SS_READY),
       m_uiTimerTimeoutMs(uiTimerTimeoutMs),
       m_timer(m_rIo_service, boost::posix_time::milliseconds(m_uiTimerTimeoutMs)),
-      m_uiMaxThreads(uiMaxThreads)
+      m_uiMaxThreads(uiMaxThreads),
+      m_eRunMode(RM_BLOCKING),
+      m_uiThreadCount(0),
+      m_pDefaultQueue(getQueue("")),
+      m_uiBackgroundShare(getDefaultBackgroundShare()),
+      m_uiBackgroundRunning(0),
+      m_uiDeferredTokens(0),
+      m_bElastic(false),
+      m_uiMinThreads(1),
+      m_uiElasticMaxThreads(1),
+      m_uiActiveWorkers(0),
+      m_dUtilization(0.0),
+      m_uiRetireRequests(0),
+      m_uiNextWorker(0),
+      m_bMonitorStop(false),
+      m_iProbePostedNs(0),
+      m_iQueueDelayUs(0)
   {
-
+    for (uint32_t i = 0; i < TP_COUNT; ++i)
+    {
+      m_apLaneQueues[i] = createLaneQueue(static_cast<TaskPriority>(i));
+      m_apHelperQueues[i] = createHelperQueue(static_cast<TaskPriority>(i));
+    }
   }
 
   ServiceController(boost::asio::io_service& io_service, unsigned uiTimerTimeoutMs = 1000, uint32_t uiMaxThreads = 0)
     :m_rIo_service(io_service),
-      m_strand(m_rIo_service),
+      m_shardedStrand(m_rIo_service, getDefaultStrandShardCount()),
       m_eState(SS_READY),
       m_uiTimerTimeoutMs(uiTimerTimeoutMs),
       m_timer(m_rIo_service, boost::posix_time::milliseconds(m_uiTimerTimeoutMs)),
-      m_uiMaxThreads(uiMaxThreads)
+      m_uiMaxThreads(uiMaxThreads),
+      m_eRunMode(RM_BLOCKING),
+      m_uiThreadCount(0),
+      m_pDefaultQueue(getQueue("")),
+      m_uiBackgroundShare(getDefaultBackgroundShare()),
+      m_uiBackgroundRunning(0),
+      m_uiDeferredTokens(0),
+      m_bElastic(false),
+      m_uiMinThreads(1),
+      m_uiElasticMaxThreads(1),
+      m_uiActiveWorkers(0),
+      m_dUtilization(0.0),
+      m_uiRetireRequests(0),
+      m_uiNextWorker(0),
+      m_bMonitorStop(false),
+      m_iProbePostedNs(0),
+      m_iQueueDelayUs(0)
   {
-
+    for (uint32_t i = 0; i < TP_COUNT; ++i)
+    {
+      m_apLaneQueues[i] = createLaneQueue(static_cast<TaskPriority>(i));
+      m_apHelperQueues[i] = createHelperQueue(static_cast<TaskPriority>(i));
+    }
   }
 
 protected:
@@ -151,12 +540,264 @@ protected:
   virtual void doPeriodicTask() {}
 
 private:
+  /// Several shards per core reduce the chance of unrelated keys sharing a strand
+  static uint32_t getDefaultStrandShardCount()
+  {
+    unsigned uiCores = boost::thread::hardware_concurrency();
+    return 4 * ((uiCores > 0) ? uiCores : 1);
+  }
+
+  /// By default background work may occupy a quarter of the cores
+  static uint32_t getDefaultBackgroundShare()
+  {
+    unsigned uiCores = boost::thread::hardware_concurrency();
+    return std::max<uint32_t>(uiCores / 4, 1);
+  }
+
+  typedef boost::shared_ptr<BoundedTaskQueue> TaskQueuePtr_t;
+
+  /**
+   * The queues of a priority lane. The vector and cursor are guarded by the lane's mutex, so workers
+   * draining different lanes do not contend. If both are needed, m_queueMutex is locked before a lane mutex.
+   */
+  struct Lane
+  {
+    Lane() : uiCursor(0), uiDepth(0) {}
+    mutable boost::mutex mutex;
+    std::vector<TaskQueuePtr_t> vQueues;
+    size_t uiCursor;
+    /// number of queued tasks in the lane
+    std::atomic<uint32_t> uiDepth;
+  };
+
+  /// Time a worker has spent waiting for handlers, used for the utilization estimate of the elastic mode
+  struct WorkerWaitTime
+  {
+    WorkerWaitTime() : iWaitNs(0), iWaitStartNs(0) {}
+    /// total duration of the completed waits
+    std::atomic<int64_t> iWaitNs;
+    /// start of the wait in progress, 0 while the worker runs handlers
+    std::atomic<int64_t> iWaitStartNs;
+  };
+
+  TaskQueuePtr_t getQueue(const std::string& sTag)
+  {
+    boost::mutex::scoped_lock lock(m_queueMutex);
+    TaskQueuePtr_t& pQueue = m_mQueues[sTag];
+    if (!pQueue)
+    {
+      pQueue = boost::make_shared<BoundedTaskQueue>(sTag);
+      boost::mutex::scoped_lock laneLock(m_aLanes[TP_NORMAL].mutex);
+      m_aLanes[TP_NORMAL].vQueues.push_back(pQueue);
+    }
+    return pQueue;
+  }
+
+  /// creates the untagged queue of a lane
+  TaskQueuePtr_t createLaneQueue(TaskPriority ePriority)
+  {
+    if (ePriority == TP_NORMAL) return m_pDefaultQueue;
+    TaskQueuePtr_t pQueue = boost::make_shared<BoundedTaskQueue>(ePriority == TP_HIGH ? "high priority" : "background");
+    pQueue->setPriority(ePriority);
+    boost::mutex::scoped_lock lock(m_aLanes[ePriority].mutex);
+    m_aLanes[ePriority].vQueues.push_back(pQueue);
+    return pQueue;
+  }
+
+  /// creates the unbounded helper queue of a lane. Like the lane queues, it is not accessible by tag.
+  TaskQueuePtr_t createHelperQueue(TaskPriority ePriority)
+  {
+    TaskQueuePtr_t pQueue = boost::make_shared<BoundedTaskQueue>("helpers");
+    pQueue->setPriority(ePriority);
+    boost::mutex::scoped_lock lock(m_aLanes[ePriority].mutex);
+    m_aLanes[ePriority].vQueues.push_back(pQueue);
+    return pQueue;
+  }
+
+  AdmissionResult post(const std::string& sTag, TaskQueuePtr_t pQueue, const Task_t& task)
+  {
+    Task_t shedTask;
+    AdmissionResult eResult = pQueue->push(task, shedTask);
+    switch (eResult)
+    {
+      case AR_ADMITTED:
+      {
+        // one drain token per queued task
+        ++m_aLanes[pQueue->getPriority()].uiDepth;
+        m_rIo_service.post(boost::bind(&ServiceController::runQueuedTasks, this, 1));
+        break;
+      }
+      case AR_DROPPED_NEWEST:
+      case AR_DROPPED_OLDEST:
+      case AR_COALESCED:
+      {
+        // the depth is unchanged, so the pending drain tokens suffice
+        if (m_onShed) m_onShed(sTag, shedTask);
+        break;
+      }
+      case AR_REJECTED:
+      {
+        break;
+      }
+    }
+    return eResult;
+  }
+
+  uint32_t postBatch(const std::string& sTag, TaskQueuePtr_t pQueue, const std::vector<Task_t>& vTasks)
+  {
+    std::vector<Task_t> vShedTasks;
+    uint32_t uiQueued = 0;
+    uint32_t uiAdmitted = pQueue->pushBatch(vTasks, vShedTasks, uiQueued);
+    if (uiAdmitted > 0)
+    {
+      m_aLanes[pQueue->getPriority()].uiDepth += uiAdmitted;
+      // one drain token per worker, each responsible for an equal share of the batch
+      uint32_t uiWorkers = std::max<uint32_t>(m_uiThreadCount, 1);
+      uint32_t uiTokens = std::min(uiAdmitted, uiWorkers);
+      uint32_t uiChunk = uiAdmitted / uiTokens;
+      uint32_t uiRemainder = uiAdmitted % uiTokens;
+      for (uint32_t i = 0; i < uiTokens; ++i)
+      {
+        uint32_t uiCount = uiChunk + ((i < uiRemainder) ? 1 : 0);
+        m_rIo_service.post(boost::bind(&ServiceController::runQueuedTasks, this, uiCount));
+      }
+    }
+    if (m_onShed)
+    {
+      for (size_t i = 0; i < vShedTasks.size(); ++i)
+        m_onShed(sTag, vShedTasks[i]);
+    }
+    return uiQueued;
+  }
+
+  /**
+   * Executes uiCount queued tasks. A drain token is not bound to the queue it was posted for:
+   * each task is taken from the highest non-empty lane, round-robin over the queues of a lane.
+   * Since exactly one token is posted per queued task, every task is eventually executed.
+   */
+  void runQueuedTasks(uint32_t uiCount)
+  {
+    endWait();
+    for (uint32_t i = 0; i < uiCount; ++i)
+    {
+      Task_t task;
+      TaskQueuePtr_t pQueue;
+      bool bBackground = false;
+      if (!popNextTask(task, pQueue, bBackground))
+      {
+        if (bBackground)
+        {
+          // only background work is left and the background share is exhausted
+          deferTokens(uiCount - i);
+          return;
+        }
+        continue;
+      }
+      try
+      {
+        StallWatchdog::Scope scope(pQueue->getName().c_str());
+        task();
+      }
+      catch (...)
+      {
+        if (bBackground) onBackgroundTaskComplete();
+        // the remaining tokens must not be lost when the exception unwinds the worker
+        if (i + 1 < uiCount)
+          m_rIo_service.post(boost::bind(&ServiceController::runQueuedTasks, this, uiCount - i - 1));
+        throw;
+      }
+      if (bBackground) onBackgroundTaskComplete();
+    }
+  }
+
+  /**
+   * Pops a task from the highest non-empty lane. Background tasks are only popped if the background share
+   * permits, otherwise bBackground is set and false is returned.
+   */
+  bool popNextTask(Task_t& task, TaskQueuePtr_t& pQueue, bool& bBackground)
+  {
+    bBackground = false;
+    for (uint32_t i = 0; i < TP_COUNT; ++i)
+    {
+      Lane& lane = m_aLanes[i];
+      if (lane.uiDepth.load() == 0) continue;
+      if (i == TP_BACKGROUND && !acquireBackgroundWorker())
+      {
+        bBackground = true;
+        return false;
+      }
+      if (popFromLane(lane, task, pQueue))
+      {
+        bBackground = (i == TP_BACKGROUND);
+        return true;
+      }
+      if (i == TP_BACKGROUND) onBackgroundTaskComplete();
+    }
+    return false;
+  }
+
+  bool popFromLane(Lane& lane, Task_t& task, TaskQueuePtr_t& pQueue)
+  {
+    boost::mutex::scoped_lock lock(lane.mutex);
+    size_t uiQueues = lane.vQueues.size();
+    for (size_t j = 0; j < uiQueues; ++j)
+    {
+      TaskQueuePtr_t& pCandidate = lane.vQueues[(lane.uiCursor + j) % uiQueues];
+      if (pCandidate->pop(task))
+      {
+        lane.uiCursor = (lane.uiCursor + j + 1) % uiQueues;
+        --lane.uiDepth;
+        pQueue = pCandidate;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool acquireBackgroundWorker()
+  {
+    boost::mutex::scoped_lock lock(m_backgroundMutex);
+    if (m_uiBackgroundShare != 0 && m_uiBackgroundRunning >= m_uiBackgroundShare) return false;
+    ++m_uiBackgroundRunning;
+    return true;
+  }
+
+  void deferTokens(uint32_t uiCount)
+  {
+    boost::mutex::scoped_lock lock(m_backgroundMutex);
+    m_uiDeferredTokens += uiCount;
+  }
+
+  /// releases the background worker and reposts a deferred token if there is one
+  void onBackgroundTaskComplete()
+  {
+    boost::mutex::scoped_lock lock(m_backgroundMutex);
+    --m_uiBackgroundRunning;
+    if (m_uiDeferredTokens > 0)
+    {
+      --m_uiDeferredTokens;
+      m_rIo_service.post(boost::bind(&ServiceController::runQueuedTasks, this, 1));
+    }
+  }
+
+  void recordTimerLateness()
+  {
+    int64_t iLatenessUs = (SimulatedTimeTraits::now() - m_timer.expires_at()).total_microseconds();
+    uint64_t uiPeriodUs = static_cast<uint64_t>(m_uiTimerTimeoutMs) * 1000;
+    uint64_t uiMissed = (iLatenessUs > 0 && uiPeriodUs > 0) ? static_cast<uint64_t>(iLatenessUs) / uiPeriodUs : 0;
+    boost::mutex::scoped_lock lock(m_timerStatsMutex);
+    m_timerStats.record(iLatenessUs * 1000, uiMissed);
+  }
+
   void onTimer( const boost::system::error_code& ec )
   {
+    endWait();
     if (!ec)
     {
+      recordTimerLateness();
       try
       {
+        StallWatchdog::Scope scope("periodic task");
         doPeriodicTask();
 #if 0
         VLOG(5) << "[" << boost::this_thread::get_id() << "] Do periodic tasks (" << m_uiTimerTimeoutMs << "ms)" << std::endl;
@@ -171,13 +812,15 @@ private:
         LOG(ERROR) << "Std Exception: " << e.what();
       }
 
+      // the timer may already have expired when stop() cancelled it
+      if (isStopping())
+      {
+        VLOG(15) << "Shutting down";
+        return;
+      }
+
       /// Schedule next report
       m_timer.expires_at(m_timer.expires_at() + boost::posix_time::milliseconds(m_uiTimerTimeoutMs));
-      //m_timer.async_wait(boost::bind(&ServiceController::onTimer, this, boost::asio::placeholders::error));
-
-      // causes hang
-      //m_timer.async_wait(m_strand.wrap(boost::bind(&ServiceController::onTimer, this, boost::asio::placeholders::error)));
-
       m_timer.async_wait(boost::bind(&ServiceController::onTimer, this, boost::asio::placeholders::error));
     }
     else
@@ -193,12 +836,227 @@ private:
     }
   }
 
-  void runIoService()
+  /// Must be called with m_workerMutex held
+  void spawnWorker()
+  {
+    // release the handles of workers that have retired
+    for (auto it = m_vWorkers.begin(); it != m_vWorkers.end(); )
+    {
+      if ((*it)->try_join_for(boost::chrono::milliseconds(0)))
+        it = m_vWorkers.erase(it);
+      else
+        ++it;
+    }
+    ++m_uiActiveWorkers;
+    m_uiThreadCount = m_uiActiveWorkers;
+    // the slots of retired workers are kept so that the idle time they accumulated stays in the sum
+    m_dqWaitTimes.emplace_back();
+    m_vWorkers.push_back(boost::make_shared<boost::thread>(boost::bind(&ServiceController::runWorker, this, m_uiNextWorker++,
+                                                                       &m_dqWaitTimes.back())));
+  }
+
+  void runWorker(unsigned uiWorker, WorkerWaitTime* pWaitTime)
+  {
+    runIoService(uiWorker, *pWaitTime);
+    boost::mutex::scoped_lock lock(m_workerMutex);
+    --m_uiActiveWorkers;
+    m_uiThreadCount = m_uiActiveWorkers;
+    m_workerCondition.notify_all();
+  }
+
+  /// blocks until all workers have completed, then stops the elastic monitor
+  void joinWorkers()
+  {
+    std::vector<boost::shared_ptr<boost::thread> > vWorkers;
+    {
+      boost::mutex::scoped_lock lock(m_workerMutex);
+      while (m_uiActiveWorkers > 0)
+      {
+        m_workerCondition.wait(lock);
+      }
+      m_bMonitorStop = true;
+      m_workerCondition.notify_all();
+      vWorkers.swap(m_vWorkers);
+    }
+    if (m_pMonitorThread)
+    {
+      m_pMonitorThread->join();
+      m_pMonitorThread.reset();
+    }
+    for (size_t i = 0; i < vWorkers.size(); ++i)
+    {
+      vWorkers[i]->join();
+    }
+  }
+
+  /// a worker may retire if the elastic monitor requested it and the minimum is not undercut
+  bool shouldRetire()
+  {
+    if (m_uiRetireRequests.load(std::memory_order_relaxed) == 0) return false;
+    boost::mutex::scoped_lock lock(m_workerMutex);
+    if (m_uiRetireRequests > 0 && m_uiActiveWorkers > m_uiMinThreads)
+    {
+      --m_uiRetireRequests;
+      return true;
+    }
+    return false;
+  }
+
+  static int64_t nowNs()
+  {
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void onQueueDelayProbe()
+  {
+    m_iQueueDelayUs = (nowNs() - m_iProbePostedNs.load()) / 1000;
+    m_iProbePostedNs = 0;
+  }
+
+  /**
+   * Measures the time a handler waits in the io_service before it is run. At most one probe is in flight:
+   * if the previous probe has not run yet, the time it has been waiting so far is the delay.
+   */
+  int64_t sampleQueueDelayUs()
+  {
+    int64_t iNow = nowNs();
+    int64_t iPostedNs = m_iProbePostedNs.load();
+    if (iPostedNs != 0)
+    {
+      return std::max<int64_t>((iNow - iPostedNs) / 1000, m_iQueueDelayUs.load());
+    }
+    m_iProbePostedNs = iNow;
+    m_rIo_service.post(boost::bind(&ServiceController::onQueueDelayProbe, this));
+    return m_iQueueDelayUs.load();
+  }
+
+  /// the wait time of the calling worker while it is parked in run_one
+  static WorkerWaitTime*& currentWait()
+  {
+    static thread_local WorkerWaitTime* pWaitTime = nullptr;
+    return pWaitTime;
+  }
+
+  /// marks the start of a wait for handlers of the calling worker
+  static void beginWait(WorkerWaitTime& waitTime)
+  {
+    waitTime.iWaitStartNs.store(nowNs());
+    currentWait() = &waitTime;
+  }
+
+  /**
+   * Ends the wait of the calling worker if it is still in progress. Since run_one both waits for and
+   * runs a handler, the handlers of the controller call this on entry to end the wait precisely.
+   */
+  static void endWait()
+  {
+    WorkerWaitTime* pWaitTime = currentWait();
+    if (!pWaitTime) return;
+    currentWait() = nullptr;
+    int64_t iStartNs = pWaitTime->iWaitStartNs.exchange(0);
+    pWaitTime->iWaitNs.fetch_add(nowNs() - iStartNs);
+  }
+
+  /**
+   * Must be called with m_workerMutex held. Returns the total time all workers have spent waiting for handlers up to iNowNs,
+   * including waits in progress. A wait ending during the call may be missed; it is included in the next sample.
+   */
+  int64_t sampleWaitNs(int64_t iNowNs) const
+  {
+    int64_t iTotalNs = 0;
+    for (const WorkerWaitTime& waitTime : m_dqWaitTimes)
+    {
+      iTotalNs += waitTime.iWaitNs.load();
+      int64_t iStartNs = waitTime.iWaitStartNs.load();
+      if (iStartNs != 0 && iNowNs > iStartNs) iTotalNs += iNowNs - iStartNs;
+    }
+    return iTotalNs;
+  }
+
+  /// Adds a worker when handlers queue up and retires one after a sustained period of low utilization
+  void runElasticMonitor()
+  {
+    uint32_t uiLowSamples = 0;
+    boost::mutex::scoped_lock lock(m_workerMutex);
+    int64_t iLastSampleNs = nowNs();
+    int64_t iLastWaitNs = sampleWaitNs(iLastSampleNs);
+    while (!m_bMonitorStop)
+    {
+      m_workerCondition.wait_for(lock, boost::chrono::milliseconds(m_elasticPolicy.uiSampleIntervalMs));
+      if (m_bMonitorStop || !isRunning() || m_rIo_service.stopped()) continue;
+
+      int64_t iDelayUs = sampleQueueDelayUs();
+      uint32_t uiActive = m_uiActiveWorkers;
+      // share of the capacity of the active workers since the last sample that was not spent waiting
+      int64_t iNowNs = nowNs();
+      int64_t iWaitNs = sampleWaitNs(iNowNs);
+      double dCapacityNs = static_cast<double>(iNowNs - iLastSampleNs) * uiActive;
+      double dUtilization = (dCapacityNs > 0) ? 1.0 - (iWaitNs - iLastWaitNs) / dCapacityNs : 0.0;
+      dUtilization = std::min(1.0, std::max(0.0, dUtilization));
+      m_dUtilization = dUtilization;
+      iLastSampleNs = iNowNs;
+      iLastWaitNs = iWaitNs;
+
+      if (iDelayUs > static_cast<int64_t>(m_elasticPolicy.uiScaleUpDelayUs) && uiActive < m_uiElasticMaxThreads)
+      {
+        VLOG(15) << "Queue delay " << iDelayUs << "us: adding worker " << uiActive + 1;
+        spawnWorker();
+        uiLowSamples = 0;
+      }
+      else if (dUtilization < m_elasticPolicy.dScaleDownUtilization && uiActive > m_uiMinThreads + m_uiRetireRequests)
+      {
+        if (++uiLowSamples >= m_elasticPolicy.uiScaleDownSamples)
+        {
+          VLOG(15) << "Utilization " << dUtilization << ": retiring worker " << uiActive;
+          ++m_uiRetireRequests;
+          uiLowSamples = 0;
+          // wake a parked worker so that it can retire
+          m_rIo_service.post(&ServiceController::noop);
+        }
+      }
+      else
+      {
+        uiLowSamples = 0;
+      }
+    }
+  }
+
+  static void noop() {}
+
+  /**
+   * Runs handlers one at a time so that the worker can retire between handlers.
+   * The time spent waiting for a handler is accounted as idle for the utilization estimate.
+   */
+  void runElasticIoService(WorkerWaitTime& waitTime)
+  {
+    while (!shouldRetire())
+    {
+      if (m_rIo_service.poll_one() > 0) continue;
+      beginWait(waitTime);
+      std::size_t uiHandlers = m_rIo_service.run_one();
+      endWait();
+      if (uiHandlers == 0) break;
+    }
+  }
+
+  void runIoService(unsigned uiWorker, WorkerWaitTime& waitTime)
   {
     try
     {
+      if (!m_vCores.empty())
+      {
+        ThreadUtil::setCurrentThreadAffinity(m_vCores[uiWorker % m_vCores.size()]);
+      }
       VLOG(15) << "[" << boost::this_thread::get_id() << "] Running io service thread";
-      m_rIo_service.run();
+      StallWatchdog::Registration registration(m_pWatchdog, "ServiceController worker " + boost::lexical_cast<std::string>(uiWorker));
+      if (SimulatedClock::isSimulated())
+        runSimulatedIoService();
+      else if (m_eRunMode == RM_BUSY_POLL)
+        busyPollIoService(waitTime);
+      else if (m_bElastic)
+        runElasticIoService(waitTime);
+      else
+        m_rIo_service.run();
       VLOG(15) << "[" << boost::this_thread::get_id() << "] End of io service thread";
       return;
     }
@@ -213,6 +1071,47 @@ private:
     LOG(WARNING) << "[" << boost::this_thread::get_id() << "] End of io service thread due to exception";
   }
 
+  /**
+   * Runs all ready handlers and jumps the simulated clock to the next timer deadline once the
+   * io service is idle. Without a pending deadline the worker blocks until a handler is posted.
+   */
+  void runSimulatedIoService()
+  {
+    while (!m_rIo_service.stopped())
+    {
+      if (m_rIo_service.poll() > 0) continue;
+      if (m_rIo_service.stopped()) break;
+      if (!SimulatedClock::advanceToNextDeadline())
+      {
+        m_rIo_service.run_one();
+      }
+    }
+  }
+
+  /**
+   * Polls the io service for ready handlers. When idle, the worker spins, then yields and finally
+   * parks in run_one() until the next handler is ready. The loop ends once the io service runs out of work.
+   */
+  void busyPollIoService(WorkerWaitTime& waitTime)
+  {
+    uint32_t uiIdleCount = 0;
+    while (!m_rIo_service.stopped() && !shouldRetire())
+    {
+      if (m_rIo_service.poll() > 0)
+      {
+        uiIdleCount = 0;
+      }
+      else if (!ThreadUtil::backoff(m_spinPolicy, uiIdleCount++))
+      {
+        // park
+        beginWait(waitTime);
+        m_rIo_service.run_one();
+        endWait();
+        uiIdleCount = 0;
+      }
+    }
+  }
+
 
 private:
   boost::asio::io_service m_ioService;
@@ -221,7 +1120,7 @@ protected:
 private:
 
   boost::shared_ptr<boost::asio::io_service::work> m_pWork;
-  boost::asio::io_service::strand m_strand;
+  ShardedStrand m_shardedStrand;
 
   enum ServiceState
   {
@@ -232,9 +1131,52 @@ private:
   ServiceState m_eState;
 
   unsigned m_uiTimerTimeoutMs;
-  boost::asio::deadline_timer m_timer;
+  SimulatedDeadlineTimer_t m_timer;
+  mutable boost::mutex m_timerStatsMutex;
+  LatenessStatistics m_timerStats;
   uint32_t m_uiMaxThreads;
 
+  RunMode m_eRunMode;
+  SpinPolicy m_spinPolicy;
+  std::vector<unsigned> m_vCores;
+  std::atomic<uint32_t> m_uiThreadCount;
+
+  /// bounded task queues by tag
+  mutable boost::mutex m_queueMutex;
+  std::unordered_map<std::string, TaskQueuePtr_t> m_mQueues;
+  Lane m_aLanes[TP_COUNT];
+  TaskQueuePtr_t m_pDefaultQueue;
+  TaskQueuePtr_t m_apLaneQueues[TP_COUNT];
+  /// unbounded queues of postHelper, one per lane
+  TaskQueuePtr_t m_apHelperQueues[TP_COUNT];
+  boost::mutex m_backgroundMutex;
+  uint32_t m_uiBackgroundShare;
+  uint32_t m_uiBackgroundRunning;
+  uint32_t m_uiDeferredTokens;
+  OnShed_t m_onShed;
+
+  boost::shared_ptr<StallWatchdog> m_pWatchdog;
+
+  /// elastic worker mode
+  bool m_bElastic;
+  uint32_t m_uiMinThreads;
+  uint32_t m_uiElasticMaxThreads;
+  ElasticPolicy m_elasticPolicy;
+  /// worker threads, guarded by m_workerMutex
+  boost::mutex m_workerMutex;
+  boost::condition_variable m_workerCondition;
+  std::vector<boost::shared_ptr<boost::thread> > m_vWorkers;
+  boost::shared_ptr<boost::thread> m_pMonitorThread;
+  uint32_t m_uiActiveWorkers;
+  /// one slot per worker spawned since start, guarded by m_workerMutex. Never shrinks while running.
+  std::deque<WorkerWaitTime> m_dqWaitTimes;
+  std::atomic<double> m_dUtilization;
+  std::atomic<uint32_t> m_uiRetireRequests;
+  unsigned m_uiNextWorker;
+  bool m_bMonitorStop;
+  std::atomic<int64_t> m_iProbePostedNs;
+  std::atomic<int64_t> m_iQueueDelayUs;
+
   OnStart_t m_onStart;
 };
 
@@ -0,0 +1,161 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/thread.hpp>
+#include <glog/logging.h>
+#include "MakeService.h"
+
+/**
+ * @brief Manages N instances of a service, typically one per core.
+ * All instances are started together and stopped in parallel.
+ * If one instance fails to start, the already started instances are stopped again.
+ */
+template <typename T>
+class ServiceGroup : private boost::noncopyable
+{
+public:
+  typedef boost::shared_ptr< ServiceThread<T> > ServicePtr_t;
+  typedef boost::shared_ptr< ServiceGroup<T> > ptr;
+
+  /**
+   * @brief ServiceGroup
+   * @param vServices The service instances. Instance i is pinned to core i % cores if bPinToCores is set.
+   * @param bPinToCores Pins each service thread to a core
+   */
+  ServiceGroup(const std::vector<ServicePtr_t>& vServices, bool bPinToCores = true)
+    :m_vServices(vServices),
+    m_vStarted(vServices.size(), false)
+  {
+    if (bPinToCores)
+    {
+      unsigned uiCores = boost::thread::hardware_concurrency();
+      uiCores = (uiCores > 0) ? uiCores : 1;
+      for (size_t i = 0; i < m_vServices.size(); ++i)
+      {
+        m_vServices[i]->setCpuAffinity(static_cast<int>(i % uiCores));
+      }
+    }
+  }
+
+  ~ServiceGroup()
+  {
+    // ServiceThread stops itself on destruction, but stopping in parallel is faster
+    stopNoThrow();
+  }
+
+  size_t size() const { return m_vServices.size(); }
+  ServicePtr_t& get(size_t uiIndex) { return m_vServices[uiIndex]; }
+  ServicePtr_t& operator[](size_t uiIndex) { return m_vServices[uiIndex]; }
+
+  /**
+   * @brief start starts all instances
+   * @return the error of the first instance that failed to start, in which case all instances are stopped
+   */
+  boost::system::error_code start()
+  {
+    for (size_t i = 0; i < m_vServices.size(); ++i)
+    {
+      if (m_vStarted[i]) continue;
+      boost::system::error_code ec = m_vServices[i]->start();
+      if (!ec)
+      {
+        m_vStarted[i] = true;
+      }
+      else
+      {
+        LOG(WARNING) << "Failed to start service instance " << i << ": " << ec.message();
+        // the start error is returned even if a started instance failed
+        stopNoThrow();
+        return ec;
+      }
+    }
+    return boost::system::error_code();
+  }
+
+  /**
+   * @brief stop stops all started instances in parallel and waits for their completion.
+   * If a service thread terminated with an exception, the first exception is rethrown.
+   * @return the first error reported by an instance
+   */
+  boost::system::error_code stop()
+  {
+    std::vector<boost::system::error_code> vErrors(m_vServices.size());
+    std::vector<boost::exception_ptr> vExceptions(m_vServices.size());
+    boost::thread_group stopThreads;
+    for (size_t i = 0; i < m_vServices.size(); ++i)
+    {
+      if (!m_vStarted[i]) continue;
+      m_vStarted[i] = false;
+      stopThreads.create_thread(boost::bind(&ServiceGroup::stopInstance, this, i, &vErrors[i], &vExceptions[i]));
+    }
+    stopThreads.join_all();
+
+    for (size_t i = 0; i < vExceptions.size(); ++i)
+    {
+      if (vExceptions[i]) boost::rethrow_exception(vExceptions[i]);
+    }
+    for (size_t i = 0; i < vErrors.size(); ++i)
+    {
+      if (vErrors[i]) return vErrors[i];
+    }
+    return boost::system::error_code();
+  }
+
+private:
+  /// stops all started instances, logging instead of rethrowing an exception of a service thread
+  boost::system::error_code stopNoThrow()
+  {
+    try
+    {
+      return stop();
+    }
+    catch (...)
+    {
+      LOG(WARNING) << "Service instance terminated with an exception: " << boost::current_exception_diagnostic_information();
+      return boost::system::error_code(boost::system::errc::operation_canceled, boost::system::generic_category());
+    }
+  }
+
+  void stopInstance(size_t uiIndex, boost::system::error_code* pEc, boost::exception_ptr* pException)
+  {
+    try
+    {
+      *pEc = m_vServices[uiIndex]->stop();
+    }
+    catch (...)
+    {
+      *pException = boost::current_exception();
+    }
+  }
+
+  std::vector<ServicePtr_t> m_vServices;
+  std::vector<bool> m_vStarted;
+};
+
+/**
+ * @brief makeServiceGroup creates uiInstances instances of service T, each constructed with args
+ * and pinned to its own core.
+ * @param uiInstances The number of instances. If 0, one instance per core is created.
+ */
+template <typename T, typename... Args>
+typename ServiceGroup<T>::ptr makeServiceGroup(uint32_t uiInstances, const Args&... args)
+{
+  if (uiInstances == 0)
+  {
+    unsigned uiCores = boost::thread::hardware_concurrency();
+    uiInstances = (uiCores > 0) ? uiCores : 1;
+  }
+  std::vector<typename ServiceGroup<T>::ServicePtr_t> vServices;
+  vServices.reserve(uiInstances);
+  for (uint32_t i = 0; i < uiInstances; ++i)
+  {
+    vServices.push_back(makeService<T>(args...));
+  }
+  return boost::make_shared< ServiceGroup<T> >(vServices, true);
+}
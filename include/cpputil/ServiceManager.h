@@ -1,9 +1,21 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <boost/thread/recursive_mutex.hpp>
 #include <cpputil/ServiceController.h>
 
+/**
+ * @brief Starts and stops a set of services with the controller.
+ *
+ * Services can be registered, started, stopped and deregistered while the manager is running.
+ * The start and stop callbacks are called with the registry lock held, so they may call back into
+ * the manager on the same thread, e.g. to register or deregister services, but must not wait for
+ * another thread that calls into the manager.
+ */
 class ServiceManager : public ServiceController
 {
 public:
@@ -17,6 +29,7 @@ public:
   /// Default Constructor: Service manager uses io_service of ServiceController
   ServiceManager()
     :m_uiServiceId(0),
+      m_bServicesStarted(false),
       m_uiLastErrorServiceId(NO_ERROR_ID),
       m_uiDurationMs(0),
       m_endTimer(m_rIo_service)
@@ -28,6 +41,7 @@ public:
   ServiceManager(boost::asio::io_service& ioService)
     :ServiceController(ioService),
       m_uiServiceId(0),
+      m_bServicesStarted(false),
       m_uiLastErrorServiceId(NO_ERROR_ID),
       m_uiDurationMs(0),
       m_endTimer(m_rIo_service)
@@ -44,28 +58,39 @@ public:
   /// return service id of last error
   uint32_t getLastErrorServiceId() const { return m_uiLastErrorServiceId;}
 
-  /// registers service IFF services are not running already.
-  /// returns true if successful
-  /// ID that can be used to deregister service
+  /**
+   * @brief registerService registers a service. If the manager is running and bAutoStart is set,
+   * the service is started immediately; if it fails to start, it is not registered.
+   * @param onStart The function starting the service
+   * @param onStop The function stopping the service
+   * @param uiServiceId ID that can be used to start, stop and deregister the service
+   * @param bAutoStart if true, the service is started with the manager
+   * @return true if successful
+   */
   bool registerService(ServiceCb_t onStart, ServiceCb_t onStop, uint32_t& uiServiceId, bool bAutoStart = true )
   {
-    if (isReady())
-    {
-      m_mServices[m_uiServiceId] = std::make_tuple(onStart, onStop, bAutoStart);
-      uiServiceId = m_uiServiceId++;
-      VLOG(15) << "Service registered: " << uiServiceId;
-      return true;
-    }
-    else
+    boost::recursive_mutex::scoped_lock lock(m_serviceMutex);
+    uint32_t uiId = m_uiServiceId++;
+    m_mServices[uiId] = std::make_tuple(onStart, onStop, bAutoStart);
+    VLOG(15) << "Service registered: " << uiId;
+    if (m_bServicesStarted && bAutoStart)
     {
-      LOG(WARNING) << "Failed to register service";
-      return false;
+      boost::system::error_code ec = startServiceLocked(uiId);
+      if (ec)
+      {
+        LOG(WARNING) << "Failed to register service: " << uiId;
+        m_mServices.erase(uiId);
+        return false;
+      }
     }
+    uiServiceId = uiId;
+    return true;
   }
 
-  /// deregisters service IFF services are not currently runnng.
+  /// deregisters service. A running service is stopped first.
   bool deregisterService(uint32_t uiServiceId)
   {
+    boost::recursive_mutex::scoped_lock lock(m_serviceMutex);
     auto it = m_mServices.find(uiServiceId);
     if (it == m_mServices.end())
     {
@@ -74,12 +99,51 @@ public:
     }
     else
     {
+      if (m_sRunning.count(uiServiceId))
+      {
+        // the service is removed even if it reports an error on stop
+        stopServiceLocked(uiServiceId);
+      }
       VLOG(15) << "Service deregistered: " << uiServiceId;
-      m_mServices.erase(it);
+      m_mServices.erase(uiServiceId);
       return true;
     }
   }
 
+  /**
+   * @brief startService starts a registered service while the manager is running.
+   * Starting a service that is already running has no effect.
+   */
+  boost::system::error_code startService(uint32_t uiServiceId)
+  {
+    boost::recursive_mutex::scoped_lock lock(m_serviceMutex);
+    if (!m_bServicesStarted)
+      return boost::system::error_code(boost::system::errc::operation_not_permitted, boost::system::generic_category());
+    if (m_mServices.find(uiServiceId) == m_mServices.end())
+      return boost::system::error_code(boost::system::errc::invalid_argument, boost::system::generic_category());
+    if (m_sRunning.count(uiServiceId)) return boost::system::error_code();
+    return startServiceLocked(uiServiceId);
+  }
+
+  /**
+   * @brief stopService stops a running service. The service remains registered and can be restarted.
+   * Stopping a service that is not running has no effect.
+   */
+  boost::system::error_code stopService(uint32_t uiServiceId)
+  {
+    boost::recursive_mutex::scoped_lock lock(m_serviceMutex);
+    if (m_mServices.find(uiServiceId) == m_mServices.end())
+      return boost::system::error_code(boost::system::errc::invalid_argument, boost::system::generic_category());
+    if (!m_sRunning.count(uiServiceId)) return boost::system::error_code();
+    return stopServiceLocked(uiServiceId);
+  }
+
+  bool isServiceRunning(uint32_t uiServiceId) const
+  {
+    boost::recursive_mutex::scoped_lock lock(m_serviceMutex);
+    return m_sRunning.count(uiServiceId) > 0;
+  }
+
 protected:
 
   /**
@@ -91,58 +155,78 @@ protected:
    */
   virtual boost::system::error_code doStart()
   {
+    boost::recursive_mutex::scoped_lock lock(m_serviceMutex);
     m_lastError = boost::system::error_code();
     m_uiLastErrorServiceId = NO_ERROR_ID;
 
     boost::system::error_code ec;
     std::vector<uint32_t> started;
-    for (const std::pair<uint32_t, Service_t>& pair : m_mServices)
+    std::unordered_set<uint32_t> attempted;
+    // Callbacks may register or deregister services, so the registry is never iterated while one runs.
+    // Auto-start services registered by a callback are picked up by the next pass.
+    std::vector<uint32_t> vIds = getAutoStartIds(attempted);
+    while (!vIds.empty() && !ec)
     {
-      if (std::get<2>(pair.second))
+      for (uint32_t uiId : vIds)
       {
-        ec = std::get<0>(pair.second)();
+        attempted.insert(uiId);
+        auto it = m_mServices.find(uiId);
+        // deregistered by a previous callback
+        if (it == m_mServices.end()) continue;
+        // copy: the callback may deregister its own service
+        ServiceCb_t onStart = std::get<0>(it->second);
+        ec = onStart();
         if (!ec)
         {
           // remember started ids so that we can stop them in case one fails
-          started.push_back(pair.first);
+          started.push_back(uiId);
+          // a callback deregistering the service later must stop it
+          m_sRunning.insert(uiId);
         }
         else
         {
           LOG(WARNING) << "Failed to start service: " << ec.message();
           // failure
           m_lastError = ec;
-          m_uiLastErrorServiceId = pair.first;
+          m_uiLastErrorServiceId = uiId;
           break;
         }
       }
+      vIds = getAutoStartIds(attempted);
     }
 
-    if (m_lastError)
+    if (ec)
     {
       // stop previously started services
       for (uint32_t uiId : started)
       {
+        // already stopped by a deregistration
+        if (!m_sRunning.erase(uiId)) continue;
+        ServiceCb_t onStop = std::get<1>(m_mServices[uiId]);
         // don't overwrite the error that causes the stop...
-        boost::system::error_code ec = std::get<1>(m_mServices[uiId])();
-        if (ec)
+        boost::system::error_code stopError = onStop();
+        if (stopError)
         {
-          LOG(WARNING) << "Failed to stop service: " << ec.message();
+          LOG(WARNING) << "Failed to stop service: " << stopError.message();
         }
       }
+      return ec;
     }
 
+    m_bServicesStarted = true;
+
     if (m_uiDurationMs != 0)
     {
       m_endTimer.expires_from_now(boost::posix_time::milliseconds(m_uiDurationMs));
       m_endTimer.async_wait(boost::bind(&ServiceManager::onEndTimer, this, boost::asio::placeholders::error ));
     }
 
-    return m_lastError;
+    return ec;
   }
 
   /**
    * @fn  virtual boost::system::error_code ServiceManager::doStop()
-   * @brief Stops all services managed by this component
+   * @brief Stops all running services managed by this component
    * @return  .
    */
   virtual boost::system::error_code doStop()
@@ -150,19 +234,15 @@ protected:
     // cancel timer in case it was called
     m_endTimer.cancel();
     
+    boost::recursive_mutex::scoped_lock lock(m_serviceMutex);
     m_lastError = boost::system::error_code();
     m_uiLastErrorServiceId = NO_ERROR_ID;
+    m_bServicesStarted = false;
 
-    boost::system::error_code ec;
-    for (const std::pair<uint32_t, Service_t>& pair : m_mServices)
+    std::vector<uint32_t> running(m_sRunning.begin(), m_sRunning.end());
+    for (uint32_t uiId : running)
     {
-      ec = std::get<1>(pair.second)();
-      if (ec)
-      {
-        LOG(WARNING) << "Failed to stop service: " << ec.message();
-        m_uiLastErrorServiceId = pair.first;
-        m_lastError = ec;
-      }
+      stopServiceLocked(uiId);
     }
 
     return m_lastError;
@@ -170,6 +250,53 @@ protected:
 
 private:
 
+  /// Must be called with m_serviceMutex held. Returns the ids of auto-start services not in attempted in registration order.
+  std::vector<uint32_t> getAutoStartIds(const std::unordered_set<uint32_t>& attempted) const
+  {
+    std::vector<uint32_t> vIds;
+    for (const std::pair<const uint32_t, Service_t>& pair : m_mServices)
+    {
+      if (std::get<2>(pair.second) && !attempted.count(pair.first)) vIds.push_back(pair.first);
+    }
+    std::sort(vIds.begin(), vIds.end());
+    return vIds;
+  }
+
+  /// Must be called with m_serviceMutex held
+  boost::system::error_code startServiceLocked(uint32_t uiServiceId)
+  {
+    // copy: the callback may deregister its own service
+    ServiceCb_t onStart = std::get<0>(m_mServices[uiServiceId]);
+    boost::system::error_code ec = onStart();
+    if (ec)
+    {
+      LOG(WARNING) << "Failed to start service: " << ec.message();
+      m_lastError = ec;
+      m_uiLastErrorServiceId = uiServiceId;
+      return ec;
+    }
+    VLOG(15) << "Service started: " << uiServiceId;
+    m_sRunning.insert(uiServiceId);
+    return ec;
+  }
+
+  /// Must be called with m_serviceMutex held. The service is considered stopped even if an error is reported.
+  boost::system::error_code stopServiceLocked(uint32_t uiServiceId)
+  {
+    m_sRunning.erase(uiServiceId);
+    ServiceCb_t onStop = std::get<1>(m_mServices[uiServiceId]);
+    boost::system::error_code ec = onStop();
+    if (ec)
+    {
+      LOG(WARNING) << "Failed to stop service: " << ec.message();
+      m_lastError = ec;
+      m_uiLastErrorServiceId = uiServiceId;
+      return ec;
+    }
+    VLOG(15) << "Service stopped: " << uiServiceId;
+    return ec;
+  }
+
   void onEndTimer( const boost::system::error_code& ec )
   {
     if (!ec)
@@ -185,13 +312,19 @@ private:
   }
 private:
 
+  /// guards the service registry. Recursive so that service callbacks can reconfigure the manager.
+  mutable boost::recursive_mutex m_serviceMutex;
   uint32_t m_uiServiceId;
   std::unordered_map<uint32_t, Service_t> m_mServices;
+  /// ids of the services that are currently running
+  std::unordered_set<uint32_t> m_sRunning;
+  /// true between a successful doStart and doStop
+  bool m_bServicesStarted;
 
   // store information about the last error
   boost::system::error_code m_lastError;
   uint32_t m_uiLastErrorServiceId;
 
   uint32_t m_uiDurationMs;
-  boost::asio::deadline_timer m_endTimer;
+  SimulatedDeadlineTimer_t m_endTimer;
 };
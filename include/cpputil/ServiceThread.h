@@ -1,5 +1,6 @@
 #pragma once
 
+#include <utility>
 #include <boost/exception_ptr.hpp>
 #include <boost/function.hpp>
 #include <boost/make_shared.hpp>
@@ -10,6 +11,8 @@
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
 #include <glog/logging.h>
+#include "StallWatchdog.h"
+#include "ThreadUtil.h"
 
 typedef boost::function<void (boost::system::error_code)> CompletionHandler_t;
 
@@ -73,7 +76,8 @@ public:
 
   ServiceThread()
     :m_eState(SS_READY),
-    m_sServiceName(ServiceTraits<T>::name)
+    m_sServiceName(ServiceTraits<T>::name),
+    m_iCore(-1)
   {
     VLOG(15) << "Service created: " << m_sServiceName;
   }
@@ -81,11 +85,24 @@ public:
   ServiceThread(ServiceImpl impl)
     :m_eState(SS_READY),
     m_sServiceName(ServiceTraits<T>::name),
+    m_iCore(-1),
     m_pImpl(impl)
   {
     VLOG(15) << "Service created: " << m_sServiceName;
   }
 
+  /// Constructs the service implementation in place. This is only available if T is a value type
+  /// in which case the implementation is stored inside the ServiceThread object.
+  template <typename... Args>
+  explicit ServiceThread(boost::in_place_init_t, Args&&... args)
+    :m_eState(SS_READY),
+    m_sServiceName(ServiceTraits<T>::name),
+    m_iCore(-1),
+    m_pImpl(boost::in_place_init, std::forward<Args>(args)...)
+  {
+    VLOG(15) << "Service created: " << m_sServiceName;
+  }
+
   ~ServiceThread()
   {
     VLOG(15) << "Service destructor: " << m_sServiceName;
@@ -121,6 +138,13 @@ public:
   /// Completion handler
   void setCompletionHandler(CompletionHandler_t onComplete) { m_onComplete = onComplete; }
 
+  /// Pins the service thread to the specified core when it is started. A negative value disables pinning.
+  void setCpuAffinity(int iCore) { m_iCore = iCore; }
+
+  /// Registers the service thread with the watchdog. The implementation marks its handlers
+  /// with StallWatchdog::Scope. The watchdog thread is started with the service if it is not running yet.
+  void setStallWatchdog(boost::shared_ptr<StallWatchdog> pWatchdog) { m_pWatchdog = pWatchdog; }
+
   /// if the service implementation reports an error from the start or stop method call, it can be accessed via this method
   /// NB: only the last error can be accessed
   boost::system::error_code getServiceErrorCode() const { return m_ecService; }
@@ -160,6 +184,7 @@ public:
     }
 
     VLOG(15) << "Starting service: " << m_sServiceName;
+    if (m_pWatchdog) m_pWatchdog->start();
     m_pServiceThread = thread_ptr(new boost::thread(boost::bind(&ServiceThread::main, this)));
 
     m_startCondition.wait(m_threadMutex);
@@ -212,12 +237,19 @@ private:
     {
       VLOG(15) << "Service thread started: " << m_sServiceName;
 
+      if (m_iCore >= 0)
+      {
+        ThreadUtil::setCurrentThreadAffinity(static_cast<unsigned>(m_iCore));
+      }
+
       boost::mutex::scoped_lock lock(m_threadMutex);
       // notify main thread that it can continue
       m_startCondition.notify_one();
       // Try Dummy wait to allow 1st thread to resume
       m_startCondition.wait(m_threadMutex);
 
+      StallWatchdog::Registration registration(m_pWatchdog, m_sServiceName);
+
       // call implementation of event loop
       // This will block
       // In scenarios where the service fails to start, the implementation can return an error code
@@ -246,6 +278,8 @@ private:
   ServiceState m_eState;
   /// Service name
   std::string m_sServiceName;
+  /// Core the service thread is pinned to, -1 if not pinned
+  int m_iCore;
   /// Service thread
   thread_ptr m_pServiceThread;
   /// Thread mutex
@@ -265,4 +299,6 @@ private:
   boost::exception_ptr m_exception;
 
   CompletionHandler_t m_onComplete;
+
+  boost::shared_ptr<StallWatchdog> m_pWatchdog;
 };
@@ -0,0 +1,94 @@
+#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * @brief Hashes keys onto one of N strands of an io_service.
+ * Handlers posted with the same key are executed in order and never concurrently,
+ * while handlers for different keys are spread over all threads running the io_service.
+ * Typical keys are stream identifiers such as an RTP SSRC.
+ *
+ * NB: boost::asio shares a fixed number of strand implementations between all strands of
+ * an io_service, so two shards may occasionally be serialized with respect to each other.
+ * This only affects parallelism, never ordering.
+ */
+class ShardedStrand : public boost::noncopyable
+{
+public:
+  typedef boost::asio::io_service::strand Strand_t;
+
+  /**
+   * @brief ShardedStrand
+   * @param ioService The io_service the strands dispatch to
+   * @param uiShards The number of strands. A value of 0 is treated as 1.
+   */
+  ShardedStrand(boost::asio::io_service& ioService, uint32_t uiShards)
+    :m_ioService(ioService)
+  {
+    resize(uiShards);
+  }
+
+  /**
+   * @brief resize replaces the strands. This must not be called while handlers
+   * are being posted or executed through this object.
+   */
+  void resize(uint32_t uiShards)
+  {
+    uiShards = (uiShards > 0) ? uiShards : 1;
+    m_vStrands.clear();
+    m_vStrands.reserve(uiShards);
+    for (uint32_t i = 0; i < uiShards; ++i)
+    {
+      m_vStrands.push_back(boost::shared_ptr<Strand_t>(new Strand_t(m_ioService)));
+    }
+  }
+
+  uint32_t getShardCount() const { return static_cast<uint32_t>(m_vStrands.size()); }
+
+  /// returns the index of the shard that the key maps to
+  template <typename Key>
+  uint32_t getShardIndex(const Key& key) const
+  {
+    // boost::hash is the identity for integers: mix the bits so that sequential keys spread evenly
+    uint64_t uiHash = static_cast<uint64_t>(boost::hash<Key>()(key)) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<uint32_t>((uiHash >> 32) % m_vStrands.size());
+  }
+
+  /// returns the strand that the key maps to
+  template <typename Key>
+  Strand_t& getStrand(const Key& key)
+  {
+    return *m_vStrands[getShardIndex(key)];
+  }
+
+  /// queues the handler for execution in order with all other handlers of the same key
+  template <typename Key, typename Handler>
+  void post(const Key& key, Handler handler)
+  {
+    getStrand(key).post(handler);
+  }
+
+  /// executes the handler immediately if the caller is already running in the key's strand, otherwise posts it
+  template <typename Key, typename Handler>
+  void dispatch(const Key& key, Handler handler)
+  {
+    getStrand(key).dispatch(handler);
+  }
+
+  /// wraps the handler so that it is dispatched through the key's strand when invoked, e.g. as an async completion handler
+  template <typename Key, typename Handler>
+  auto wrap(const Key& key, Handler handler) -> decltype(std::declval<Strand_t&>().wrap(handler))
+  {
+    return getStrand(key).wrap(handler);
+  }
+
+private:
+  boost::asio::io_service& m_ioService;
+  std::vector<boost::shared_ptr<Strand_t> > m_vStrands;
+};
@@ -0,0 +1,500 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/function.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <glog/logging.h>
+
+#if defined(__linux__) && defined(__GLIBC__)
+  #define CPPUTIL_STALL_BACKTRACE
+  #include <execinfo.h>
+  #include <pthread.h>
+  #include <signal.h>
+#endif
+
+/// Describes a handler that has been running for longer than the watchdog threshold
+struct StallReport
+{
+  StallReport()
+    :uiWorker(0),
+    uiElapsedUs(0)
+  {
+
+  }
+
+  /// tag of the stalled handler, empty if the handler was not tagged
+  std::string sTag;
+  /// name of the thread the handler is running in
+  std::string sThreadName;
+  /// index of the worker slot
+  uint32_t uiWorker;
+  /// time the handler has been running for
+  uint64_t uiElapsedUs;
+  /// symbolized backtrace of the stalled thread if backtraces are enabled
+  std::vector<std::string> vBacktrace;
+};
+
+/**
+ * @brief Detects handlers that block an event loop.
+ *
+ * Threads register with the watchdog and mark the start and end of each handler using
+ * StallWatchdog::Scope. A separate watchdog thread scans all registered threads and reports
+ * every handler that runs for longer than the threshold, once per handler invocation.
+ * Optionally, the watchdog posts heartbeat probes to an io_service and reports if no worker
+ * picks them up within the threshold, which also detects stalls in untagged handlers.
+ *
+ * Marking a handler costs a thread-local read, a steady clock read and a few relaxed atomic stores,
+ * so the watchdog can stay enabled in production.
+ */
+class StallWatchdog : private boost::noncopyable
+{
+  struct Slot;
+
+public:
+  typedef boost::function<void (const StallReport&)> OnStall_t;
+
+  static const uint32_t MAX_THREADS = 256;
+  static const uint32_t MAX_FRAMES = 64;
+
+  /**
+   * @brief StallWatchdog
+   * @param uiThresholdMs handlers running for longer than this are reported
+   * @param uiCheckIntervalMs interval at which the watchdog thread scans the registered threads
+   * @param bCaptureBacktrace captures the backtrace of stalled threads (Linux/glibc only).
+   * This interrupts the stalled thread with iSignal.
+   * @param iSignal The signal used to capture backtraces
+   */
+  StallWatchdog(uint32_t uiThresholdMs = 200, uint32_t uiCheckIntervalMs = 50, bool bCaptureBacktrace = false, int iSignal = DEFAULT_SIGNAL)
+    :m_uiThresholdNs(static_cast<uint64_t>(uiThresholdMs) * 1000000),
+    m_uiCheckIntervalMs(uiCheckIntervalMs),
+    m_bCaptureBacktrace(bCaptureBacktrace),
+    m_iSignal(iSignal),
+    m_bShutdown(false)
+  {
+    m_onStall = &StallWatchdog::logStall;
+  }
+
+  ~StallWatchdog()
+  {
+    stop();
+  }
+
+  /// The stall handler is called in the watchdog thread. The default handler logs a warning.
+  void setStallHandler(OnStall_t onStall) { m_onStall = onStall; }
+
+  /// Heartbeat probes are posted to the io_service while the watchdog is running.
+  /// If no thread executes a probe within the threshold, a stall with the tag "heartbeat" is reported.
+  void monitor(boost::asio::io_service& ioService)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_vMonitored.push_back(std::make_pair(&ioService, boost::make_shared<Heartbeat>()));
+  }
+
+  /// Stops posting heartbeat probes to the io_service
+  void stopMonitoring(boost::asio::io_service& ioService)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    for (auto it = m_vMonitored.begin(); it != m_vMonitored.end(); ++it)
+    {
+      if (it->first == &ioService)
+      {
+        m_vMonitored.erase(it);
+        return;
+      }
+    }
+  }
+
+  /// Starts the watchdog thread. Calling start on a running watchdog has no effect.
+  void start()
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_pThread) return;
+#ifdef CPPUTIL_STALL_BACKTRACE
+    if (m_bCaptureBacktrace)
+    {
+      // the first call of backtrace() may allocate: make sure it happens outside of the signal handler
+      void* frames[1];
+      backtrace(frames, 1);
+      struct sigaction action;
+      memset(&action, 0, sizeof(action));
+      action.sa_handler = &StallWatchdog::onBacktraceSignal;
+      action.sa_flags = SA_RESTART;
+      sigemptyset(&action.sa_mask);
+      sigaction(m_iSignal, &action, nullptr);
+    }
+#endif
+    m_bShutdown = false;
+    m_pThread = boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&StallWatchdog::run, this)));
+  }
+
+  /// Stops the watchdog thread
+  void stop()
+  {
+    boost::shared_ptr<boost::thread> pThread;
+    {
+      boost::mutex::scoped_lock lock(m_mutex);
+      pThread = m_pThread;
+      m_pThread.reset();
+      m_bShutdown = true;
+      m_condition.notify_all();
+    }
+    if (pThread) pThread->join();
+  }
+
+  /**
+   * @brief registerThread registers the calling thread. Handlers of unregistered threads are not tracked.
+   * A thread can only be registered with one watchdog at a time, since Scope tracks handlers
+   * through a single thread-local slot.
+   * @return false if the maximum number of threads is registered or the thread is already registered
+   */
+  bool registerThread(const std::string& sThreadName)
+  {
+    if (currentSlot())
+    {
+      LOG(WARNING) << "Stall watchdog: thread " << sThreadName << " is already registered";
+      return false;
+    }
+    boost::mutex::scoped_lock lock(m_mutex);
+    for (uint32_t i = 0; i < MAX_THREADS; ++i)
+    {
+      Slot& slot = m_slots[i];
+      if (!slot.bInUse.load())
+      {
+        slot.sThreadName = sThreadName;
+        slot.set(nullptr, 0, slot.uiHandler.load(std::memory_order_relaxed));
+#ifdef CPPUTIL_STALL_BACKTRACE
+        slot.thread = pthread_self();
+#endif
+        slot.bInUse.store(true);
+        currentSlot() = &slot;
+        return true;
+      }
+    }
+    LOG(WARNING) << "Stall watchdog: too many threads registered";
+    return false;
+  }
+
+  /// deregisters the calling thread. Has no effect if the thread is registered with another watchdog.
+  void deregisterThread()
+  {
+    Slot* pSlot = currentSlot();
+    if (!pSlot || pSlot < m_slots || pSlot >= m_slots + MAX_THREADS) return;
+    boost::mutex::scoped_lock lock(m_mutex);
+    pSlot->set(nullptr, 0, pSlot->uiHandler.load(std::memory_order_relaxed));
+    pSlot->bInUse.store(false);
+    currentSlot() = nullptr;
+  }
+
+  /// Registers the calling thread with the watchdog for the lifetime of the object. A null watchdog is ignored.
+  class Registration : private boost::noncopyable
+  {
+  public:
+    Registration(boost::shared_ptr<StallWatchdog> pWatchdog, const std::string& sThreadName)
+      :m_pWatchdog(pWatchdog)
+    {
+      if (m_pWatchdog) m_pWatchdog->registerThread(sThreadName);
+    }
+
+    ~Registration()
+    {
+      if (m_pWatchdog) m_pWatchdog->deregisterThread();
+    }
+
+  private:
+    boost::shared_ptr<StallWatchdog> m_pWatchdog;
+  };
+
+  /**
+   * @brief Marks the execution of a handler in the calling thread for the lifetime of the object.
+   * The tag must remain valid while the handler runs. Scopes may be nested, in which case the
+   * innermost scope is tracked. A stall is reported once, even if it spans nested scopes.
+   * This is a no-op in unregistered threads.
+   */
+  class Scope : private boost::noncopyable
+  {
+  public:
+    explicit Scope(const char* szTag)
+      :m_pSlot(currentSlot()),
+      m_szOuterTag(nullptr),
+      m_iOuterStartNs(0),
+      m_uiOuterHandler(0)
+    {
+      if (m_pSlot)
+      {
+        // only the owning thread writes the slot, so relaxed loads see its own values
+        m_szOuterTag = m_pSlot->szTag.load(std::memory_order_relaxed);
+        m_iOuterStartNs = m_pSlot->iStartNs.load(std::memory_order_relaxed);
+        m_uiOuterHandler = m_pSlot->uiHandler.load(std::memory_order_relaxed);
+        m_pSlot->set(szTag, nowNs(), ++m_pSlot->uiHandlerCount);
+      }
+    }
+
+    ~Scope()
+    {
+      if (m_pSlot)
+      {
+        m_pSlot->set(m_szOuterTag, m_iOuterStartNs, m_uiOuterHandler);
+      }
+    }
+
+  private:
+    Slot* m_pSlot;
+    const char* m_szOuterTag;
+    int64_t m_iOuterStartNs;
+    uint64_t m_uiOuterHandler;
+  };
+
+private:
+#ifdef CPPUTIL_STALL_BACKTRACE
+  static const int DEFAULT_SIGNAL = SIGUSR2;
+#else
+  static const int DEFAULT_SIGNAL = 0;
+#endif
+
+  struct Slot
+  {
+    Slot()
+      :bInUse(false),
+      szTag(nullptr),
+      iStartNs(0),
+      uiHandler(0),
+      uiSequence(0),
+      uiHandlerCount(0),
+      uiReportedHandler(0),
+      bBacktraceReady(false),
+      iFrames(0)
+    {
+
+    }
+
+    /// Must only be called by the owning thread. Publishes the current handler as in a seqlock:
+    /// the sequence is odd while the fields are updated.
+    void set(const char* szNewTag, int64_t iNewStartNs, uint64_t uiNewHandler)
+    {
+      uint64_t uiSeq = uiSequence.load(std::memory_order_relaxed);
+      uiSequence.store(uiSeq + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      szTag.store(szNewTag, std::memory_order_relaxed);
+      iStartNs.store(iNewStartNs, std::memory_order_relaxed);
+      uiHandler.store(uiNewHandler, std::memory_order_relaxed);
+      uiSequence.store(uiSeq + 2, std::memory_order_release);
+    }
+
+    /// reads a consistent snapshot of the current handler. Returns false if the owning thread changed it meanwhile.
+    bool read(const char*& szCurrentTag, int64_t& iCurrentStartNs, uint64_t& uiCurrentHandler) const
+    {
+      uint64_t uiSeq = uiSequence.load(std::memory_order_acquire);
+      if (uiSeq & 1) return false;
+      szCurrentTag = szTag.load(std::memory_order_relaxed);
+      iCurrentStartNs = iStartNs.load(std::memory_order_relaxed);
+      uiCurrentHandler = uiHandler.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return uiSequence.load(std::memory_order_relaxed) == uiSeq;
+    }
+
+    std::atomic<bool> bInUse;
+    std::atomic<const char*> szTag;
+    /// start of the current handler, 0 if idle
+    std::atomic<int64_t> iStartNs;
+    /// id of the current handler. Ids increase, so nested handlers have larger ids than their outer handlers.
+    std::atomic<uint64_t> uiHandler;
+    /// seqlock sequence guarding szTag, iStartNs and uiHandler
+    std::atomic<uint64_t> uiSequence;
+    /// only accessed by the owning thread. Not reset when the slot is reused.
+    uint64_t uiHandlerCount;
+    /// id of the last reported handler, only accessed by the watchdog thread
+    uint64_t uiReportedHandler;
+    /// guarded by m_mutex since the slot can be reused while the watchdog thread reads it
+    std::string sThreadName;
+#ifdef CPPUTIL_STALL_BACKTRACE
+    pthread_t thread;
+#endif
+    std::atomic<bool> bBacktraceReady;
+    int iFrames;
+    void* frames[MAX_FRAMES];
+  };
+
+  /// Heartbeat probe state shared with probes still queued in the io_service
+  struct Heartbeat
+  {
+    Heartbeat()
+      :iPostedNs(0),
+      bPending(false)
+    {
+
+    }
+
+    std::atomic<int64_t> iPostedNs;
+    std::atomic<bool> bPending;
+  };
+
+  static Slot*& currentSlot()
+  {
+    static thread_local Slot* pSlot = nullptr;
+    return pSlot;
+  }
+
+  static int64_t nowNs()
+  {
+    return boost::chrono::duration_cast<boost::chrono::nanoseconds>(boost::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static void onHeartbeat(boost::shared_ptr<Heartbeat> pHeartbeat)
+  {
+    pHeartbeat->bPending.store(false);
+  }
+
+#ifdef CPPUTIL_STALL_BACKTRACE
+  static void onBacktraceSignal(int)
+  {
+    Slot* pSlot = currentSlot();
+    if (!pSlot) return;
+    pSlot->iFrames = backtrace(pSlot->frames, MAX_FRAMES);
+    pSlot->bBacktraceReady.store(true, std::memory_order_release);
+  }
+#endif
+
+  static void logStall(const StallReport& report)
+  {
+    LOG(WARNING) << "Stall detected in " << report.sThreadName << " (worker " << report.uiWorker << "): handler '"
+                 << report.sTag << "' running for " << report.uiElapsedUs / 1000 << " ms";
+    for (size_t i = 0; i < report.vBacktrace.size(); ++i)
+    {
+      LOG(WARNING) << "  #" << i << " " << report.vBacktrace[i];
+    }
+  }
+
+  void run()
+  {
+    VLOG(15) << "Stall watchdog started";
+    boost::mutex::scoped_lock lock(m_mutex);
+    while (!m_bShutdown)
+    {
+      m_condition.timed_wait(lock, boost::posix_time::milliseconds(m_uiCheckIntervalMs));
+      if (m_bShutdown) break;
+      std::vector<StallReport> vReports;
+      checkHeartbeats(vReports);
+      // the handler may call back into the watchdog
+      lock.unlock();
+      for (const StallReport& report : vReports)
+      {
+        if (m_onStall) m_onStall(report);
+      }
+      checkThreads();
+      lock.lock();
+    }
+    VLOG(15) << "Stall watchdog stopped";
+  }
+
+  void checkThreads()
+  {
+    int64_t iNow = nowNs();
+    for (uint32_t i = 0; i < MAX_THREADS; ++i)
+    {
+      Slot& slot = m_slots[i];
+      if (!slot.bInUse.load(std::memory_order_relaxed)) continue;
+      const char* szTag = nullptr;
+      int64_t iStart = 0;
+      uint64_t uiHandler = 0;
+      // the handler changed while reading: it is checked again in the next interval
+      if (!slot.read(szTag, iStart, uiHandler)) continue;
+      if (iStart == 0 || iNow - iStart < static_cast<int64_t>(m_uiThresholdNs)) continue;
+      // an outer handler resumed after a reported nested handler belongs to the same stall
+      if (uiHandler <= slot.uiReportedHandler) continue;
+      slot.uiReportedHandler = uiHandler;
+
+      StallReport report;
+      {
+        boost::mutex::scoped_lock lock(m_mutex);
+        // the thread may have deregistered in the meantime
+        if (!slot.bInUse.load()) continue;
+        report.sThreadName = slot.sThreadName;
+      }
+      if (szTag) report.sTag = szTag;
+      report.uiWorker = i;
+      report.uiElapsedUs = static_cast<uint64_t>(iNow - iStart) / 1000;
+      captureBacktrace(slot, report);
+      if (m_onStall) m_onStall(report);
+    }
+  }
+
+  /// must be called with m_mutex held. Adds a report for each probe that has not been executed within the threshold.
+  void checkHeartbeats(std::vector<StallReport>& vReports)
+  {
+    int64_t iNow = nowNs();
+    for (size_t i = 0; i < m_vMonitored.size(); ++i)
+    {
+      boost::shared_ptr<Heartbeat>& pHeartbeat = m_vMonitored[i].second;
+      if (pHeartbeat->bPending.load())
+      {
+        int64_t iPosted = pHeartbeat->iPostedNs.load();
+        if (iPosted != 0 && iNow - iPosted >= static_cast<int64_t>(m_uiThresholdNs))
+        {
+          StallReport report;
+          report.sTag = "heartbeat";
+          report.sThreadName = "io_service";
+          report.uiWorker = static_cast<uint32_t>(i);
+          report.uiElapsedUs = static_cast<uint64_t>(iNow - iPosted) / 1000;
+          // report once per probe
+          pHeartbeat->iPostedNs.store(0);
+          vReports.push_back(report);
+        }
+        continue;
+      }
+      pHeartbeat->bPending.store(true);
+      pHeartbeat->iPostedNs.store(iNow);
+      m_vMonitored[i].first->post(boost::bind(&StallWatchdog::onHeartbeat, pHeartbeat));
+    }
+  }
+
+  void captureBacktrace(Slot& slot, StallReport& report)
+  {
+#ifdef CPPUTIL_STALL_BACKTRACE
+    if (!m_bCaptureBacktrace) return;
+    slot.bBacktraceReady.store(false);
+    if (pthread_kill(slot.thread, m_iSignal) != 0) return;
+    // give the stalled thread up to 20ms to record its stack
+    for (int i = 0; i < 20 && !slot.bBacktraceReady.load(std::memory_order_acquire); ++i)
+    {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    if (!slot.bBacktraceReady.load(std::memory_order_acquire)) return;
+    char** szSymbols = backtrace_symbols(slot.frames, slot.iFrames);
+    if (!szSymbols) return;
+    for (int i = 0; i < slot.iFrames; ++i)
+    {
+      report.vBacktrace.push_back(szSymbols[i]);
+    }
+    free(szSymbols);
+#else
+    { slot; report; }
+#endif
+  }
+
+  const uint64_t m_uiThresholdNs;
+  const uint32_t m_uiCheckIntervalMs;
+  const bool m_bCaptureBacktrace;
+  const int m_iSignal;
+
+  Slot m_slots[MAX_THREADS];
+
+  boost::mutex m_mutex;
+  boost::condition_variable m_condition;
+  bool m_bShutdown;
+  boost::shared_ptr<boost::thread> m_pThread;
+
+  std::vector<std::pair<boost::asio::io_service*, boost::shared_ptr<Heartbeat> > > m_vMonitored;
+
+  OnStall_t m_onStall;
+};
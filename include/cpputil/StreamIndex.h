@@ -0,0 +1,292 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/system/error_code.hpp>
+#include <glog/logging.h>
+#include "ChunkedIBitStream.h"
+
+/// Maps a timestamp and frame number to the byte offset of the frame in a stream file
+struct IndexEntry
+{
+  IndexEntry()
+    :uiTimestamp(0),
+    uiFrame(0),
+    uiOffset(0)
+  {
+
+  }
+
+  IndexEntry(uint64_t timestamp, uint64_t frame, uint64_t offset)
+    :uiTimestamp(timestamp),
+    uiFrame(frame),
+    uiOffset(offset)
+  {
+
+  }
+
+  uint64_t uiTimestamp;
+  uint64_t uiFrame;
+  uint64_t uiOffset;
+};
+
+/**
+ * Format of the sidecar index file <stream file>.idx:
+ * an 8 byte header consisting of the magic "CPIX" and a 32-bit version, followed by
+ * 24 byte records of 64-bit timestamp, frame number and byte offset. All values are big-endian.
+ * Records are ordered by timestamp, frame number and offset. A partial record at the end of
+ * the file, e.g. after a crash during recording, is ignored.
+ */
+namespace details {
+
+  const char INDEX_MAGIC[4] = { 'C', 'P', 'I', 'X' };
+  const uint32_t INDEX_VERSION = 1;
+  const uint32_t INDEX_HEADER_SIZE = 8;
+  const uint32_t INDEX_RECORD_SIZE = 24;
+
+  inline void writeIndexValue(uint8_t* pDestination, uint64_t uiValue, uint32_t uiBytes)
+  {
+    for (uint32_t i = 0; i < uiBytes; ++i)
+    {
+      pDestination[i] = static_cast<uint8_t>(uiValue >> (8 * (uiBytes - 1 - i)));
+    }
+  }
+
+  inline uint64_t readIndexValue(const uint8_t* pSource, uint32_t uiBytes)
+  {
+    uint64_t uiValue = 0;
+    for (uint32_t i = 0; i < uiBytes; ++i)
+    {
+      uiValue = (uiValue << 8) | pSource[i];
+    }
+    return uiValue;
+  }
+
+} // namespace details
+
+/**
+ * @brief Builds the sidecar index of a stream file while the stream is written.
+ * The writer of the stream calls add() with the byte offset of each frame, or at least of each
+ * frame a reader may want to seek to, before writing the frame. To keep the index small, entries
+ * less than uiMinTimestampDelta after the previous entry are skipped.
+ */
+class StreamIndexWriter : public boost::noncopyable
+{
+public:
+  static std::string getIndexFileName(const std::string& sStreamFile) { return sStreamFile + ".idx"; }
+
+  /**
+   * @brief StreamIndexWriter
+   * @param sIndexFile The index file, typically getIndexFileName(stream file)
+   * @param uiMinTimestampDelta The minimum timestamp difference between indexed frames
+   * @param uiFlushEntries The number of entries buffered before they are written to the file
+   */
+  explicit StreamIndexWriter(const std::string& sIndexFile, uint64_t uiMinTimestampDelta = 0, uint32_t uiFlushEntries = 64)
+    :m_sIndexFile(sIndexFile),
+    m_uiMinTimestampDelta(uiMinTimestampDelta),
+    m_uiFlushEntries(uiFlushEntries > 0 ? uiFlushEntries : 1),
+    m_bHasEntry(false),
+    m_uiEntries(0)
+  {
+
+  }
+
+  ~StreamIndexWriter()
+  {
+    close();
+  }
+
+  /// creates the index file, replacing an existing index
+  boost::system::error_code open()
+  {
+    m_out.open(m_sIndexFile.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!m_out.is_open())
+    {
+      LOG(WARNING) << "Failed to create index " << m_sIndexFile;
+      return boost::system::error_code(boost::system::errc::io_error, boost::system::generic_category());
+    }
+    uint8_t header[details::INDEX_HEADER_SIZE];
+    memcpy(header, details::INDEX_MAGIC, sizeof(details::INDEX_MAGIC));
+    details::writeIndexValue(header + 4, details::INDEX_VERSION, 4);
+    m_out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    m_bHasEntry = false;
+    m_uiEntries = 0;
+    return boost::system::error_code();
+  }
+
+  /**
+   * @brief add indexes a frame
+   * @return false if the entry was skipped because it is too close to the previous entry or
+   * because it is not ordered after the previous entry
+   */
+  bool add(uint64_t uiTimestamp, uint64_t uiFrame, uint64_t uiOffset)
+  {
+    if (m_bHasEntry)
+    {
+      if (uiTimestamp < m_last.uiTimestamp || uiFrame < m_last.uiFrame || uiOffset < m_last.uiOffset) return false;
+      if (uiTimestamp - m_last.uiTimestamp < m_uiMinTimestampDelta) return false;
+    }
+    m_last = IndexEntry(uiTimestamp, uiFrame, uiOffset);
+    m_bHasEntry = true;
+
+    size_t uiPos = m_vPending.size();
+    m_vPending.resize(uiPos + details::INDEX_RECORD_SIZE);
+    details::writeIndexValue(&m_vPending[uiPos], uiTimestamp, 8);
+    details::writeIndexValue(&m_vPending[uiPos + 8], uiFrame, 8);
+    details::writeIndexValue(&m_vPending[uiPos + 16], uiOffset, 8);
+    ++m_uiEntries;
+    if (m_vPending.size() >= m_uiFlushEntries * details::INDEX_RECORD_SIZE)
+    {
+      flush();
+    }
+    return true;
+  }
+
+  /// number of entries added
+  uint64_t getEntryCount() const { return m_uiEntries; }
+
+  boost::system::error_code flush()
+  {
+    if (!m_out.is_open())
+      return boost::system::error_code(boost::system::errc::bad_file_descriptor, boost::system::generic_category());
+    if (!m_vPending.empty())
+    {
+      m_out.write(reinterpret_cast<const char*>(&m_vPending[0]), m_vPending.size());
+      m_vPending.clear();
+    }
+    m_out.flush();
+    if (!m_out)
+    {
+      LOG(WARNING) << "Failed to write index " << m_sIndexFile;
+      return boost::system::error_code(boost::system::errc::io_error, boost::system::generic_category());
+    }
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code close()
+  {
+    if (!m_out.is_open()) return boost::system::error_code();
+    boost::system::error_code ec = flush();
+    m_out.close();
+    return ec;
+  }
+
+private:
+  const std::string m_sIndexFile;
+  const uint64_t m_uiMinTimestampDelta;
+  const uint32_t m_uiFlushEntries;
+  std::ofstream m_out;
+  std::vector<uint8_t> m_vPending;
+  IndexEntry m_last;
+  bool m_bHasEntry;
+  uint64_t m_uiEntries;
+};
+
+/**
+ * @brief Sidecar index of a stream file used to seek to a timestamp or frame without parsing
+ * the stream from the start. Lookups are binary searches over the entries in memory.
+ */
+class StreamIndex
+{
+public:
+  /// loads the index file, replacing the current entries
+  boost::system::error_code load(const std::string& sIndexFile)
+  {
+    m_vEntries.clear();
+    std::ifstream in(sIndexFile.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!in.is_open())
+    {
+      return boost::system::error_code(boost::system::errc::no_such_file_or_directory, boost::system::generic_category());
+    }
+    uint8_t header[details::INDEX_HEADER_SIZE];
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (in.gcount() != sizeof(header) || memcmp(header, details::INDEX_MAGIC, sizeof(details::INDEX_MAGIC)) != 0 ||
+        details::readIndexValue(header + 4, 4) != details::INDEX_VERSION)
+    {
+      LOG(WARNING) << "Invalid index " << sIndexFile;
+      return boost::system::error_code(boost::system::errc::illegal_byte_sequence, boost::system::generic_category());
+    }
+
+    std::vector<uint8_t> vRecords(details::INDEX_RECORD_SIZE * 4096);
+    for (;;)
+    {
+      in.read(reinterpret_cast<char*>(&vRecords[0]), vRecords.size());
+      size_t uiRead = static_cast<size_t>(in.gcount());
+      // a partial record at the end is ignored
+      for (size_t uiPos = 0; uiPos + details::INDEX_RECORD_SIZE <= uiRead; uiPos += details::INDEX_RECORD_SIZE)
+      {
+        m_vEntries.push_back(IndexEntry(details::readIndexValue(&vRecords[uiPos], 8),
+                                        details::readIndexValue(&vRecords[uiPos + 8], 8),
+                                        details::readIndexValue(&vRecords[uiPos + 16], 8)));
+      }
+      if (uiRead < vRecords.size()) break;
+    }
+    return boost::system::error_code();
+  }
+
+  size_t getEntryCount() const { return m_vEntries.size(); }
+  const std::vector<IndexEntry>& getEntries() const { return m_vEntries; }
+
+  /**
+   * @brief findByTimestamp finds the last indexed frame with a timestamp at or before uiTimestamp
+   * @return false if uiTimestamp is before the first indexed frame
+   */
+  bool findByTimestamp(uint64_t uiTimestamp, IndexEntry& entry) const
+  {
+    std::vector<IndexEntry>::const_iterator it = std::upper_bound(m_vEntries.begin(), m_vEntries.end(), uiTimestamp, compareTimestamp);
+    if (it == m_vEntries.begin()) return false;
+    entry = *(--it);
+    return true;
+  }
+
+  /**
+   * @brief findByFrame finds the last indexed frame at or before uiFrame
+   * @return false if uiFrame is before the first indexed frame
+   */
+  bool findByFrame(uint64_t uiFrame, IndexEntry& entry) const
+  {
+    std::vector<IndexEntry>::const_iterator it = std::upper_bound(m_vEntries.begin(), m_vEntries.end(), uiFrame, compareFrame);
+    if (it == m_vEntries.begin()) return false;
+    entry = *(--it);
+    return true;
+  }
+
+  /**
+   * @brief seekToTimestamp positions the stream at the last indexed frame at or before uiTimestamp.
+   * The caller parses forward from there to the exact frame.
+   * @param pEntry If set, receives the entry the stream was positioned at
+   */
+  bool seekToTimestamp(ChunkedIBitStream& stream, uint64_t uiTimestamp, IndexEntry* pEntry = nullptr) const
+  {
+    IndexEntry entry;
+    if (!findByTimestamp(uiTimestamp, entry) || !stream.seek(entry.uiOffset << 3)) return false;
+    if (pEntry) *pEntry = entry;
+    return true;
+  }
+
+  /// positions the stream at the last indexed frame at or before uiFrame
+  bool seekToFrame(ChunkedIBitStream& stream, uint64_t uiFrame, IndexEntry* pEntry = nullptr) const
+  {
+    IndexEntry entry;
+    if (!findByFrame(uiFrame, entry) || !stream.seek(entry.uiOffset << 3)) return false;
+    if (pEntry) *pEntry = entry;
+    return true;
+  }
+
+private:
+  static bool compareTimestamp(uint64_t uiTimestamp, const IndexEntry& entry)
+  {
+    return uiTimestamp < entry.uiTimestamp;
+  }
+
+  static bool compareFrame(uint64_t uiFrame, const IndexEntry& entry)
+  {
+    return uiFrame < entry.uiFrame;
+  }
+
+  std::vector<IndexEntry> m_vEntries;
+};
@@ -0,0 +1,270 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+typedef boost::function<void ()> Task_t;
+
+/// Determines what happens when a task is posted to a full queue
+enum ShedPolicy
+{
+  /// the new task is refused and the caller is informed
+  SP_REJECT,
+  /// the new task is dropped
+  SP_DROP_NEWEST,
+  /// the oldest queued task is dropped to make space for the new task
+  SP_DROP_OLDEST,
+  /// the new task replaces the most recently queued task (latest wins)
+  SP_COALESCE
+};
+
+/// Execution lanes of task queues. Workers always drain higher lanes first.
+enum TaskPriority
+{
+  /// latency-critical control traffic
+  TP_HIGH,
+  TP_NORMAL,
+  /// bulk work that may only occupy a limited share of the workers
+  TP_BACKGROUND,
+  TP_COUNT
+};
+
+/// Outcome of posting a task to a bounded queue
+enum AdmissionResult
+{
+  AR_ADMITTED,
+  AR_REJECTED,
+  AR_DROPPED_NEWEST,
+  AR_DROPPED_OLDEST,
+  AR_COALESCED
+};
+
+/// Queue depth gauges and counters
+struct TaskQueueStats
+{
+  TaskQueueStats()
+    :uiCapacity(0),
+    uiDepth(0),
+    uiHighWaterMark(0),
+    uiAdmitted(0),
+    uiRejected(0),
+    uiShed(0),
+    uiExecuted(0)
+  {
+
+  }
+
+  /// 0 if the queue is unbounded
+  uint32_t uiCapacity;
+  /// number of tasks currently queued
+  uint32_t uiDepth;
+  /// maximum depth observed
+  uint32_t uiHighWaterMark;
+  uint64_t uiAdmitted;
+  uint64_t uiRejected;
+  /// tasks dropped or replaced according to the shed policy
+  uint64_t uiShed;
+  uint64_t uiExecuted;
+};
+
+/**
+ * @brief Thread-safe FIFO of tasks with an optional capacity and shed policy.
+ * The queue does not execute tasks itself: the owner is responsible for
+ * scheduling one pop() per task that was admitted with AR_ADMITTED.
+ */
+class BoundedTaskQueue : public boost::noncopyable
+{
+public:
+  /**
+   * @brief BoundedTaskQueue
+   * @param sName The name of the queue e.g. the tag of the tasks
+   * @param uiCapacity The maximum number of queued tasks. 0 means unbounded.
+   * @param ePolicy The shed policy that is applied once the queue is full
+   */
+  BoundedTaskQueue(const std::string& sName = "", uint32_t uiCapacity = 0, ShedPolicy ePolicy = SP_REJECT)
+    :m_sName(sName),
+    m_ePolicy(ePolicy),
+    m_ePriority(TP_NORMAL)
+  {
+    m_stats.uiCapacity = uiCapacity;
+  }
+
+  const std::string& getName() const { return m_sName; }
+
+  /// the lane the owner drains the queue in
+  TaskPriority getPriority() const { return m_ePriority; }
+  void setPriority(TaskPriority ePriority) { m_ePriority = ePriority; }
+
+  void configure(uint32_t uiCapacity, ShedPolicy ePolicy)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    m_stats.uiCapacity = uiCapacity;
+    m_ePolicy = ePolicy;
+  }
+
+  /**
+   * @brief push admits the task subject to the capacity and shed policy
+   * @param task The task to be queued
+   * @param shedTask If a task is dropped or replaced, it is moved into shedTask
+   * @return the outcome of the admission. Only AR_ADMITTED increases the depth of the queue.
+   */
+  AdmissionResult push(const Task_t& task, Task_t& shedTask)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    AdmissionResult eResult = admit(task, shedTask);
+    updateDepth();
+    return eResult;
+  }
+
+  /**
+   * @brief pushBatch admits all tasks under a single lock, applying the shed policy to each task in turn
+   * @param vTasks The tasks to be queued
+   * @param vShedTasks Tasks that were dropped or replaced are appended to vShedTasks
+   * @param uiQueued The number of tasks of vTasks that were queued
+   * @return the increase in depth i.e. the number of additional pops the owner must schedule
+   */
+  uint32_t pushBatch(const std::vector<Task_t>& vTasks, std::vector<Task_t>& vShedTasks, uint32_t& uiQueued)
+  {
+    uint32_t uiAdmitted = 0;
+    uiQueued = 0;
+    boost::mutex::scoped_lock lock(m_mutex);
+    for (size_t i = 0; i < vTasks.size(); ++i)
+    {
+      Task_t shedTask;
+      switch (admit(vTasks[i], shedTask))
+      {
+        case AR_ADMITTED:
+        {
+          ++uiAdmitted;
+          ++uiQueued;
+          break;
+        }
+        case AR_DROPPED_OLDEST:
+        case AR_COALESCED:
+        {
+          ++uiQueued;
+          vShedTasks.push_back(Task_t());
+          vShedTasks.back().swap(shedTask);
+          break;
+        }
+        case AR_DROPPED_NEWEST:
+        {
+          vShedTasks.push_back(Task_t());
+          vShedTasks.back().swap(shedTask);
+          break;
+        }
+        case AR_REJECTED:
+        {
+          break;
+        }
+      }
+    }
+    updateDepth();
+    return uiAdmitted;
+  }
+
+  /// removes the oldest task. Returns false if the queue is empty.
+  bool pop(Task_t& task)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    if (m_queue.empty()) return false;
+    task.swap(m_queue.front());
+    m_queue.pop_front();
+    ++m_stats.uiExecuted;
+    m_stats.uiDepth = static_cast<uint32_t>(m_queue.size());
+    return true;
+  }
+
+  /// removes up to uiMax of the oldest tasks under a single lock and appends them to vTasks.
+  /// Returns the number of tasks removed.
+  uint32_t popBatch(std::vector<Task_t>& vTasks, uint32_t uiMax)
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    uint32_t uiCount = 0;
+    while (uiCount < uiMax && !m_queue.empty())
+    {
+      vTasks.push_back(Task_t());
+      vTasks.back().swap(m_queue.front());
+      m_queue.pop_front();
+      ++uiCount;
+    }
+    m_stats.uiExecuted += uiCount;
+    m_stats.uiDepth = static_cast<uint32_t>(m_queue.size());
+    return uiCount;
+  }
+
+  uint32_t getDepth() const
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    return static_cast<uint32_t>(m_queue.size());
+  }
+
+  TaskQueueStats getStats() const
+  {
+    boost::mutex::scoped_lock lock(m_mutex);
+    return m_stats;
+  }
+
+private:
+  /// applies capacity and shed policy. Must be called with m_mutex held.
+  AdmissionResult admit(const Task_t& task, Task_t& shedTask)
+  {
+    if (m_stats.uiCapacity == 0 || m_queue.size() < m_stats.uiCapacity)
+    {
+      m_queue.push_back(task);
+      ++m_stats.uiAdmitted;
+      return AR_ADMITTED;
+    }
+
+    switch (m_ePolicy)
+    {
+      case SP_DROP_NEWEST:
+      {
+        ++m_stats.uiShed;
+        shedTask = task;
+        return AR_DROPPED_NEWEST;
+      }
+      case SP_DROP_OLDEST:
+      {
+        shedTask.swap(m_queue.front());
+        m_queue.pop_front();
+        m_queue.push_back(task);
+        ++m_stats.uiShed;
+        ++m_stats.uiAdmitted;
+        return AR_DROPPED_OLDEST;
+      }
+      case SP_COALESCE:
+      {
+        shedTask.swap(m_queue.back());
+        m_queue.back() = task;
+        ++m_stats.uiShed;
+        ++m_stats.uiAdmitted;
+        return AR_COALESCED;
+      }
+      case SP_REJECT:
+      default:
+      {
+        ++m_stats.uiRejected;
+        return AR_REJECTED;
+      }
+    }
+  }
+
+  void updateDepth()
+  {
+    m_stats.uiDepth = static_cast<uint32_t>(m_queue.size());
+    if (m_stats.uiDepth > m_stats.uiHighWaterMark)
+      m_stats.uiHighWaterMark = m_stats.uiDepth;
+  }
+
+  const std::string m_sName;
+  mutable boost::mutex m_mutex;
+  std::deque<Task_t> m_queue;
+  ShedPolicy m_ePolicy;
+  TaskPriority m_ePriority;
+  TaskQueueStats m_stats;
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <boost/thread.hpp>
+#include <glog/logging.h>
+
+#ifndef _WIN32
+  #include <pthread.h>
+  #include <sched.h>
+#endif
+
+/**
+ * @brief Adaptive backoff parameters used by busy-polling loops.
+ * An idle loop first spins uiSpinCount times, then yields uiYieldCount times,
+ * after which it parks (blocks) until new work arrives.
+ */
+struct SpinPolicy
+{
+  SpinPolicy(uint32_t spinCount = 10000, uint32_t yieldCount = 100)
+    :uiSpinCount(spinCount),
+    uiYieldCount(yieldCount)
+  {
+
+  }
+
+  uint32_t uiSpinCount;
+  uint32_t uiYieldCount;
+};
+
+/**
+ * Thread utility functions
+ */
+class ThreadUtil
+{
+public:
+  /// hints to the CPU that the caller is in a spin-wait loop
+  static inline void cpuRelax()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+  }
+
+  /**
+   * @brief backoff performs one step of the adaptive backoff described by policy
+   * @param policy The spin policy
+   * @param uiIdleCount The number of consecutive idle iterations so far
+   * @return false if the spin and yield budgets are exhausted and the caller should park
+   */
+  static inline bool backoff(const SpinPolicy& policy, uint32_t uiIdleCount)
+  {
+    if (uiIdleCount < policy.uiSpinCount)
+    {
+      cpuRelax();
+      return true;
+    }
+    else if (uiIdleCount < policy.uiSpinCount + policy.uiYieldCount)
+    {
+      boost::this_thread::yield();
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * @brief setCurrentThreadAffinity pins the calling thread to the specified core
+   * @param uiCore The zero-based index of the core
+   * @return true if the affinity could be set
+   */
+  static bool setCurrentThreadAffinity(unsigned uiCore)
+  {
+#if defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(uiCore, &cpuset);
+    int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    if (res != 0)
+    {
+      LOG(WARNING) << "Failed to set affinity of thread " << boost::this_thread::get_id() << " to core " << uiCore << ": " << res;
+      return false;
+    }
+    VLOG(15) << "[" << boost::this_thread::get_id() << "] Pinned to core " << uiCore;
+    return true;
+#else
+    { uiCore; }
+    LOG(WARNING) << "Thread affinity not supported on this platform";
+    return false;
+#endif
+  }
+};
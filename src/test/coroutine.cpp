@@ -0,0 +1,112 @@
+#define BOOST_TEST_DYN_LINK
+
+#define BOOST_TEST_MODULE ts_coroutine coroutine_test_suite
+#include <boost/test/unit_test.hpp>
+
+#include <atomic>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "Clock.h"
+#include "Coroutine.h"
+#include "ServiceController.h"
+
+BOOST_AUTO_TEST_CASE( tc_test_frameAllocator )
+{
+  // frames of the same size class are recycled
+  void* p1 = coro::FrameAllocator::allocate(100);
+  coro::FrameAllocator::deallocate(p1, 100);
+  void* p2 = coro::FrameAllocator::allocate(120);
+  BOOST_CHECK_EQUAL(p1, p2);
+  // a different size class uses another free list
+  void* p3 = coro::FrameAllocator::allocate(1000);
+  BOOST_CHECK(p3 != p2);
+  coro::FrameAllocator::deallocate(p2, 120);
+  coro::FrameAllocator::deallocate(p3, 1000);
+  // large frames are not pooled
+  void* p4 = coro::FrameAllocator::allocate(coro::FrameAllocator::MAX_POOLED_SIZE + 1);
+  coro::FrameAllocator::deallocate(p4, coro::FrameAllocator::MAX_POOLED_SIZE + 1);
+}
+
+coro::ServiceTask countYields(ServiceController& controller, uint32_t uiYields, std::atomic<uint32_t>& uiCount, boost::thread::id& threadId)
+{
+  co_await coro::schedule(controller);
+  threadId = boost::this_thread::get_id();
+  for (uint32_t i = 0; i < uiYields; ++i)
+  {
+    ++uiCount;
+    co_await coro::yield(controller);
+  }
+  controller.stop();
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_scheduleAndYield )
+{
+  ServiceController controller(1000, 2);
+  std::atomic<uint32_t> uiCount(0);
+  boost::thread::id threadId = boost::this_thread::get_id();
+  const boost::thread::id callerId = threadId;
+  controller.setOnStartHandler([&]() { countYields(controller, 100, uiCount, threadId); });
+  BOOST_CHECK(!controller.start());
+  BOOST_CHECK_EQUAL(uiCount, 100);
+  // the coroutine continued on a worker thread
+  BOOST_CHECK(threadId != callerId);
+}
+
+coro::ServiceTask sleepTwice(ServiceController& controller, boost::system::error_code& ec, int64_t& iSleptUs)
+{
+  co_await coro::schedule(controller);
+  SimulatedClock_t elapsed;
+  ec = co_await coro::sleepFor(controller, boost::posix_time::hours(1));
+  if (!ec)
+  {
+    SimulatedDeadlineTimer_t timer(controller.getIoService());
+    ec = co_await coro::sleepFor(timer, boost::posix_time::minutes(30));
+  }
+  iSleptUs = static_cast<int64_t>(elapsed.seconds() * 1e6);
+  controller.stop();
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_sleepForSimulatedTime )
+{
+  SimulatedClock::setSimulated(true);
+  {
+    ServiceController controller(1000, 1);
+    boost::system::error_code ec(boost::system::errc::operation_canceled, boost::system::generic_category());
+    int64_t iSleptUs = 0;
+    SteadyClock_t realTime;
+    controller.setOnStartHandler([&]() { sleepTwice(controller, ec, iSleptUs); });
+    BOOST_CHECK(!controller.start());
+    BOOST_CHECK(!ec);
+    // the sleeps follow virtual time
+    BOOST_CHECK(iSleptUs >= 5400000000LL);
+    BOOST_CHECK(iSleptUs < 5401000000LL);
+    BOOST_CHECK(realTime.seconds() < 10.0);
+  }
+  SimulatedClock::setSimulated(false);
+}
+
+coro::ServiceTask sleepOnDeadlineTimer(boost::asio::io_service& ioService, boost::system::error_code& ec, uint32_t& uiSleeps)
+{
+  boost::asio::deadline_timer timer(ioService);
+  for (uint32_t i = 0; i < 3; ++i)
+  {
+    ec = co_await coro::sleepFor(timer, boost::posix_time::milliseconds(5));
+    if (ec) co_return;
+    ++uiSleeps;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_sleepForDeadlineTimer )
+{
+  boost::asio::io_service ioService;
+  boost::system::error_code ec;
+  uint32_t uiSleeps = 0;
+  SteadyClock_t realTime;
+  sleepOnDeadlineTimer(ioService, ec, uiSleeps);
+  ioService.run();
+  BOOST_CHECK(!ec);
+  BOOST_CHECK_EQUAL(uiSleeps, 3);
+  BOOST_CHECK(realTime.seconds() >= 0.015);
+}
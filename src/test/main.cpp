@@ -4,16 +4,43 @@
 #include <boost/test/unit_test.hpp>
 
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
 
 #include <boost/asio/io_service.hpp>
 #include <boost/chrono.hpp>
 
+#include "BitReader.h"
+#include "BlockCodec.h"
 #include "Buffer.h"
+#include "ChunkedIBitStream.h"
 #include "Clock.h"
 #include "Conversion.h"
+#include "FileUtil.h"
 #include "IBitStream.h"
+#include "Mailbox.h"
+#include "MakeService.h"
 #include "OBitStream.h"
+#include "Pacer.h"
+#include "ParallelAlgorithms.h"
+#include "PeriodicScheduler.h"
 #include "RunningAverageQueue.h"
+#include "ServiceGroup.h"
+#include "ServiceManager.h"
+#include "ServiceThread.h"
+#include "ShardedStrand.h"
+#include "StallWatchdog.h"
+#include "StreamIndex.h"
+#include "TaskQueue.h"
+
+#ifndef _WIN32
+// POSIX only
+#include <fcntl.h>
+#include "AsyncFileIo.h"
+#include "DurableWriter.h"
+#include "SegmentedRecorder.h"
+#endif
 
 using namespace std;
 using namespace boost::chrono;
@@ -188,4 +215,1465 @@ BOOST_AUTO_TEST_CASE( tc_test_runningAverageQueue )
   BOOST_CHECK_EQUAL(queue2.getAverage(), uiTotal/static_cast<double>(uiCount));
 }
 
+BOOST_AUTO_TEST_CASE( tc_test_mpscRing )
+{
+  MpscRing<uint32_t> ring(3);
+  BOOST_CHECK_EQUAL(ring.getCapacity(), 4);
+  BOOST_CHECK(ring.isEmpty());
+
+  for (uint32_t i = 0; i < 4; ++i)
+  {
+    BOOST_CHECK(ring.tryPush(i));
+  }
+  BOOST_CHECK(!ring.tryPush(4));
+
+  uint32_t uiValue = 0;
+  BOOST_CHECK(ring.tryPop(uiValue));
+  BOOST_CHECK_EQUAL(uiValue, 0);
+  BOOST_CHECK(ring.tryPush(4));
+
+  for (uint32_t i = 1; i < 5; ++i)
+  {
+    BOOST_CHECK(ring.tryPop(uiValue));
+    BOOST_CHECK_EQUAL(uiValue, i);
+  }
+  BOOST_CHECK(!ring.tryPop(uiValue));
+  BOOST_CHECK(ring.isEmpty());
+}
+
+/// sums the messages handled by a MailboxService
+struct MessageSum
+{
+  explicit MessageSum(uint64_t initial)
+    :uiTotal(initial),
+    uiMaxBatch(0)
+  {
+
+  }
+
+  void onMessages(std::vector<uint64_t>& vBatch)
+  {
+    uiMaxBatch = std::max<uint64_t>(uiMaxBatch, vBatch.size());
+    for (uint64_t uiValue : vBatch) uiTotal += uiValue;
+  }
+
+  uint64_t uiTotal;
+  uint64_t uiMaxBatch;
+};
+
+BOOST_AUTO_TEST_CASE( tc_test_mailboxService )
+{
+  for (int iRun = 0; iRun < 10; ++iRun)
+  {
+    ServiceThread<MailboxService<MessageSum, uint64_t> > service(boost::in_place_init, MailboxOptions(64, 8, SpinPolicy(100, 10)), 1000);
+    BOOST_REQUIRE(!service.start());
+    // producers keep posting while the service is stopped: every accepted message must be handled
+    std::atomic<uint64_t> uiAccepted(0);
+    boost::thread_group producers;
+    for (int i = 0; i < 3; ++i)
+    {
+      producers.create_thread([&service, &uiAccepted]()
+      {
+        for (uint64_t uiValue = 1; uiValue <= 20000; ++uiValue)
+        {
+          if (service.get()->post(uiValue)) uiAccepted += uiValue;
+          else if (service.isStopping() || !service.isRunning()) break;
+        }
+      });
+    }
+    boost::this_thread::sleep(boost::posix_time::microseconds(200 * iRun));
+    service.stop();
+    producers.join_all();
+
+    MessageSum& sum = service.get()->getImpl();
+    BOOST_CHECK_EQUAL(sum.uiTotal, 1000 + uiAccepted);
+    BOOST_CHECK(sum.uiMaxBatch <= 8);
+    BOOST_CHECK(!service.get()->post(uint64_t(1)));
+  }
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_simulatedClock )
+{
+  SimulatedClock::setSimulated(true);
+  SimulatedClock_t timer;
+  BOOST_CHECK_EQUAL(timer.seconds(), 0.0);
+  SimulatedClock::advance(seconds(5));
+  BOOST_CHECK_EQUAL(timer.seconds(), 5.0);
+
+  SimulatedClock::noteDeadline(SimulatedClock::now() + seconds(10));
+  SimulatedClock::noteDeadline(SimulatedClock::now() + seconds(2));
+  BOOST_CHECK(SimulatedClock::advanceToNextDeadline());
+  BOOST_CHECK_EQUAL(timer.seconds(), 7.0);
+  // the registered deadline has been reached
+  BOOST_CHECK(!SimulatedClock::advanceToNextDeadline());
+  SimulatedClock::setSimulated(false);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_mapFileIntoBuffer )
+{
+  const std::string sFile = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+  OBitStream ob(8);
+  ob.write(2, 2);
+  ob.write(96, 7);
+  ob.write(123456789, 32);
+  BOOST_CHECK(FileUtil::writeFile(sFile, ob.str(), true));
+
+  Buffer buffer = FileUtil::mapFileIntoBuffer(sFile);
+  BOOST_CHECK_EQUAL(buffer.getSize(), ob.str().getSize());
+  BOOST_CHECK_EQUAL(buffer.toStdString(), FileUtil::readFile(sFile, true));
+
+  IBitStream ib(buffer);
+  uint32_t uiVersion = 0, uiPayload = 0, uiTimestamp = 0;
+  ib.read(uiVersion, 2);
+  ib.read(uiPayload, 7);
+  ib.read(uiTimestamp, 32);
+  BOOST_CHECK_EQUAL(uiVersion, 2);
+  BOOST_CHECK_EQUAL(uiPayload, 96);
+  BOOST_CHECK_EQUAL(uiTimestamp, 123456789);
+
+  boost::filesystem::remove(sFile);
+  // the mapping outlives the file
+  BOOST_CHECK_EQUAL(buffer[0] >> 6, 2);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_chunkedIBitStream )
+{
+  const std::string sFile = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+  OBitStream ob(64);
+  for (uint32_t i = 0; i < 20; ++i)
+  {
+    ob.write(i & 0x7, 3);
+    ob.write(1000 + i, 13);
+    ob.write(0xABCDEF01, 32);
+  }
+  BOOST_CHECK(FileUtil::writeFile(sFile, ob.str(), true));
+
+  // a chunk size of 8 bytes forces fields across chunk boundaries
+  ChunkedIBitStream ib(boost::shared_ptr<ChunkSource>(new FileChunkSource(sFile)), 8);
+  BOOST_CHECK_EQUAL(ib.getBitsRemaining(), 20 * 48);
+  for (uint32_t i = 0; i < 20; ++i)
+  {
+    uint8_t uiType = 0;
+    uint16_t uiSeq = 0;
+    uint32_t uiMagic = 0;
+    BOOST_CHECK(ib.read(uiType, 3));
+    BOOST_CHECK(ib.read(uiSeq, 13));
+    BOOST_CHECK(ib.read(uiMagic, 32));
+    BOOST_CHECK_EQUAL(uiType, i & 0x7);
+    BOOST_CHECK_EQUAL(uiSeq, 1000 + i);
+    BOOST_CHECK_EQUAL(uiMagic, 0xABCDEF01);
+  }
+  uint8_t uiByte = 0;
+  BOOST_CHECK(!ib.read(uiByte, 1));
+  BOOST_CHECK(ib.isEof());
+
+  // seek back into an earlier chunk
+  BOOST_CHECK(ib.seek(7 * 48 + 3));
+  uint16_t uiSeq = 0;
+  BOOST_CHECK(ib.read(uiSeq, 13));
+  BOOST_CHECK_EQUAL(uiSeq, 1007);
+  // skip the rest of record 7 and all of record 8
+  BOOST_CHECK(ib.skipBytes(4 + 6));
+  uint64_t uiMagic = 0;
+  BOOST_CHECK(ib.skipBits(16));
+  BOOST_CHECK(ib.read(uiMagic, 32));
+  BOOST_CHECK_EQUAL(uiMagic, 0xABCDEF01);
+  BOOST_CHECK_EQUAL(ib.tell(), 10 * 48);
+  BOOST_CHECK(!ib.seek(20 * 48 + 1));
+  boost::filesystem::remove(sFile);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_64bitPositions )
+{
+  // sizes beyond 512 MB no longer overflow the bit counters
+  const uint64_t uiLength = 1ULL << 30;
+  uint8_t data[4] = { 0xF0, 0x0F, 0xAA, 0x55 };
+  BitReader reader(data, uiLength);
+  BOOST_CHECK_EQUAL(reader.getBitsRemaining(), uiLength << 3);
+  BOOST_CHECK_EQUAL(reader.getBytesRemaining(), uiLength);
+
+  IBitStream ib(std::string(reinterpret_cast<const char*>(data), 4));
+  BOOST_CHECK(ib.skipBits(12));
+  uint32_t uiBits = 0;
+  BOOST_CHECK(ib.read(uiBits, 12));
+  BOOST_CHECK_EQUAL(uiBits, 0xFAA);
+  BOOST_CHECK_EQUAL(ib.getBitsRemaining(), 8);
+
+  BitReader small(data, 4);
+  BOOST_CHECK(small.skipBits(3));
+  uint8_t uiValue = 0;
+  BOOST_CHECK(small.read(uiValue, 2));
+  BOOST_CHECK_EQUAL(uiValue, 2);
+  BOOST_CHECK(small.skipBits(11));
+  BOOST_CHECK(small.read(uiValue, 8));
+  BOOST_CHECK_EQUAL(uiValue, 0xAA);
+  BOOST_CHECK(!small.skipBits(9));
+  BOOST_CHECK(small.skipBits(8));
+  BOOST_CHECK_EQUAL(small.getBitsRemaining(), 0);
+
+  OBitStream ob(2);
+  ob.write(0xDEADBEEF, 32);
+  ob.write(5, 3);
+  BOOST_CHECK_EQUAL(ob.bytesUsed(), 5);
+}
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE( tc_test_segmentedRecorder )
+{
+  const boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  {
+    // segments of 1000 bytes, batches of 300 bytes
+    SegmentedRecorder recorder(dir.string(), "rec", SegmentPolicy(1000, 0, 300, 0.0));
+    BOOST_CHECK(!recorder.open());
+    std::string sExpected;
+    for (uint32_t i = 0; i < 25; ++i)
+    {
+      std::string sData(100, static_cast<char>('a' + i));
+      sExpected += sData;
+      BOOST_CHECK(!recorder.append(Buffer(reinterpret_cast<uint8_t*>(strdup(sData.c_str())), sData.length(), ::free)));
+    }
+    BOOST_CHECK_EQUAL(recorder.getCurrentOffset(), 500);
+    BOOST_CHECK(!recorder.close());
+    RecorderStats stats = recorder.getStats();
+    BOOST_CHECK_EQUAL(stats.uiSegmentsCreated, 3);
+    BOOST_CHECK_EQUAL(stats.uiBytesWritten, 2500);
+
+    std::vector<std::string> vSegments = recorder.getClosedSegments();
+    BOOST_CHECK_EQUAL(vSegments.size(), 3);
+    std::string sRecorded;
+    for (const std::string& sSegment : vSegments)
+    {
+      sRecorded += FileUtil::readFile(sSegment, true);
+    }
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(vSegments[0]), 1000);
+    BOOST_CHECK(sRecorded == sExpected);
+  }
+  {
+    // a threshold that can never be met deletes all closed segments, continuing the numbering
+    SegmentedRecorder recorder(dir.string(), "rec", SegmentPolicy(1000, 0, 300, 1.0));
+    BOOST_CHECK(!recorder.open());
+    BOOST_CHECK_EQUAL(recorder.getCurrentSegment(), (dir / SegmentedRecorder::getSegmentName("rec", 3)).string());
+    std::string sData(400, 'x');
+    BOOST_CHECK(!recorder.append(Buffer(reinterpret_cast<uint8_t*>(strdup(sData.c_str())), sData.length(), ::free)));
+    BOOST_CHECK_EQUAL(recorder.getStats().uiSegmentsDeleted, 3);
+    BOOST_CHECK(recorder.getClosedSegments().empty());
+  }
+  boost::filesystem::remove_all(dir);
+}
+#endif
+
+#ifdef __linux__
+BOOST_AUTO_TEST_CASE( tc_test_segmentedRecorderCloseFailure )
+{
+  const boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  {
+    // segments expire after 50ms
+    SegmentedRecorder recorder(dir.string(), "rec", SegmentPolicy(1000, 50, 300, 0.0));
+    BOOST_REQUIRE(!recorder.open());
+    // the second segment cannot be written or truncated
+    boost::filesystem::create_symlink("/dev/full", dir / SegmentedRecorder::getSegmentName("rec", 1));
+    std::string sData(100, 'x');
+    Buffer buffer(reinterpret_cast<uint8_t*>(strdup(sData.c_str())), sData.length(), ::free);
+    BOOST_CHECK(!recorder.append(buffer));
+    boost::this_thread::sleep(boost::posix_time::milliseconds(60));
+    BOOST_CHECK(!recorder.append(buffer));
+    BOOST_CHECK_EQUAL(recorder.getCurrentSegment(), (dir / SegmentedRecorder::getSegmentName("rec", 1)).string());
+    boost::this_thread::sleep(boost::posix_time::milliseconds(60));
+    // closing the second segment fails, but recording continues in the third
+    BOOST_CHECK(recorder.append(buffer));
+    BOOST_CHECK(recorder.isOpen());
+    BOOST_CHECK_EQUAL(recorder.getCurrentSegment(), (dir / SegmentedRecorder::getSegmentName("rec", 2)).string());
+    BOOST_CHECK(!recorder.append(buffer));
+    BOOST_CHECK(!recorder.close());
+  }
+  BOOST_CHECK_EQUAL(boost::filesystem::file_size(dir / SegmentedRecorder::getSegmentName("rec", 2)), 200);
+  boost::filesystem::remove_all(dir);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE( tc_test_scanDirectory )
+{
+  const boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+  boost::filesystem::create_directories(dir / "a" / "b");
+  boost::filesystem::create_directories(dir / "c");
+  BOOST_CHECK(FileUtil::writeFile((dir / "top.dat").string(), "1", true));
+  BOOST_CHECK(FileUtil::writeFile((dir / "a" / "b" / "deep.dat").string(), "12345", true));
+  BOOST_CHECK(FileUtil::writeFile((dir / "c" / "other.txt").string(), "12", true));
+
+  std::vector<FileInfo> vFiles = FileUtil::scanDirectory(dir.string(), "\\.dat$", 2);
+  BOOST_CHECK_EQUAL(vFiles.size(), 2);
+  BOOST_CHECK_EQUAL(vFiles[0].sPath, "a/b/deep.dat");
+  BOOST_CHECK_EQUAL(vFiles[0].uiSize, 5);
+  BOOST_CHECK_EQUAL(vFiles[1].sPath, "top.dat");
+  BOOST_CHECK(vFiles[1].tModified > 0);
+  BOOST_CHECK_EQUAL(FileUtil::scanDirectory(dir.string()).size(), 3);
+  // getFileList does not descend into subdirectories
+  BOOST_CHECK_EQUAL(FileUtil::getFileList(dir.string(), "\\.dat$").size(), 1);
+  boost::filesystem::remove_all(dir);
+}
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE( tc_test_writevAll )
+{
+  const std::string sFile = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+  int fd = ::open(sFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  BOOST_REQUIRE(fd >= 0);
+  // more buffers than a single writev call accepts
+  std::string sExpected;
+  std::vector<std::string> vData;
+  for (uint32_t i = 0; i < 3000; ++i)
+  {
+    vData.push_back(std::string(1 + i % 7, static_cast<char>('a' + i % 26)));
+    sExpected += vData.back();
+  }
+  std::vector<struct iovec> vIov;
+  for (const std::string& sData : vData)
+  {
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(sData.data());
+    iov.iov_len = sData.length();
+    vIov.push_back(iov);
+  }
+  uint64_t uiWritten = 0;
+  uint64_t uiCalls = 0;
+  BOOST_CHECK(!FileUtil::writevAll(fd, vIov, uiWritten, uiCalls));
+  ::close(fd);
+  BOOST_CHECK_EQUAL(uiWritten, sExpected.length());
+  BOOST_CHECK(uiCalls >= 3);
+  BOOST_CHECK(FileUtil::readFile(sFile, true) == sExpected);
+  boost::filesystem::remove(sFile);
+}
+#endif
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE( tc_test_durableWriter )
+{
+  const std::string sFile = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+  const uint32_t uiThreads = 4;
+  const uint32_t uiWrites = 25;
+  {
+    ServiceThread<DurableWriter> writer(boost::in_place_init, sFile);
+    BOOST_CHECK(!writer.start());
+    boost::thread_group threads;
+    for (uint32_t i = 0; i < uiThreads; ++i)
+    {
+      threads.create_thread([&writer, i]()
+      {
+        for (uint32_t j = 0; j < uiWrites; ++j)
+        {
+          Buffer buffer(new uint8_t[10], 10);
+          memset(&buffer[0], 'a' + i, 10);
+          BOOST_CHECK(!writer.get()->write(buffer));
+        }
+      });
+    }
+    threads.join_all();
+    DurableWriterStats stats = writer.get()->getStats();
+    BOOST_CHECK_EQUAL(stats.uiRequests, uiThreads * uiWrites);
+    BOOST_CHECK(stats.uiGroups <= stats.uiRequests);
+    writer.stop();
+  }
+  std::string sContent = FileUtil::readFile(sFile, true);
+  BOOST_CHECK_EQUAL(sContent.length(), uiThreads * uiWrites * 10);
+  BOOST_CHECK_EQUAL(std::count(sContent.begin(), sContent.end(), 'c'), uiWrites * 10);
+  boost::filesystem::remove(sFile);
+}
+#endif
+
+#ifdef __linux__
+BOOST_AUTO_TEST_CASE( tc_test_durableWriterFailure )
+{
+  // writes to /dev/full fail with ENOSPC
+  ServiceThread<DurableWriter> writer(boost::in_place_init, "/dev/full");
+  BOOST_REQUIRE(!writer.start());
+  Buffer buffer(new uint8_t[10], 10);
+  memset(&buffer[0], 'a', 10);
+  BOOST_CHECK(writer.get()->write(buffer) == boost::system::errc::no_space_on_device);
+  BOOST_CHECK(writer.get()->getError() == boost::system::errc::no_space_on_device);
+  // later writes fail with the first error without being written
+  BOOST_CHECK(writer.get()->write(buffer) == boost::system::errc::no_space_on_device);
+  BOOST_CHECK_EQUAL(writer.get()->getStats().uiGroups, 1);
+  writer.stop();
+  // a restart resets the error
+  BOOST_REQUIRE(!writer.start());
+  BOOST_CHECK(!writer.get()->getError());
+  writer.stop();
+}
+#endif
+
+BOOST_AUTO_TEST_CASE( tc_test_streamIndex )
+{
+  const std::string sFile = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+  const std::string sIndexFile = StreamIndexWriter::getIndexFileName(sFile);
+  // frames of 32-bit frame number, 32-bit timestamp and a variable size payload, 40ms apart
+  OBitStream ob(1024);
+  {
+    StreamIndexWriter indexWriter(sIndexFile, 200, 4);
+    BOOST_CHECK(!indexWriter.open());
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+      indexWriter.add(i * 40, i, ob.bytesUsed());
+      ob.write(i, 32);
+      ob.write(i * 40, 32);
+      for (uint32_t j = 0; j < i % 7; ++j) ob.write(j, 8);
+    }
+    // out of order entries are rejected
+    BOOST_CHECK(!indexWriter.add(0, 0, 0));
+    BOOST_CHECK_EQUAL(indexWriter.getEntryCount(), 20);
+  }
+  BOOST_CHECK(FileUtil::writeFile(sFile, ob.str(), true));
+
+  StreamIndex index;
+  BOOST_CHECK(!index.load(sIndexFile));
+  BOOST_CHECK_EQUAL(index.getEntryCount(), 20);
+  IndexEntry entry;
+  BOOST_CHECK(index.findByTimestamp(2010, entry));
+  BOOST_CHECK_EQUAL(entry.uiFrame, 50);
+  BOOST_CHECK(index.findByFrame(99, entry));
+  BOOST_CHECK_EQUAL(entry.uiFrame, 95);
+
+  ChunkedIBitStream ib(boost::shared_ptr<ChunkSource>(new FileChunkSource(sFile)), 16);
+  BOOST_CHECK(index.seekToFrame(ib, 57, &entry));
+  BOOST_CHECK_EQUAL(entry.uiFrame, 55);
+  // parse forward to the exact frame
+  uint32_t uiFrame = 0;
+  uint32_t uiTimestamp = 0;
+  for (;;)
+  {
+    BOOST_REQUIRE(ib.read(uiFrame, 32));
+    BOOST_REQUIRE(ib.read(uiTimestamp, 32));
+    if (uiFrame == 57) break;
+    ib.skipBytes(uiFrame % 7);
+  }
+  BOOST_CHECK_EQUAL(uiTimestamp, 57 * 40);
+
+  // a truncated trailing record is ignored
+  boost::filesystem::resize_file(sIndexFile, boost::filesystem::file_size(sIndexFile) - 5);
+  BOOST_CHECK(!index.load(sIndexFile));
+  BOOST_CHECK_EQUAL(index.getEntryCount(), 19);
+  BOOST_CHECK(index.load(sFile));
+  boost::filesystem::remove(sFile);
+  boost::filesystem::remove(sIndexFile);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_readFileSequentially )
+{
+  const std::string sFile = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+  std::string sContent(100000, '\0');
+  for (size_t i = 0; i < sContent.length(); ++i) sContent[i] = static_cast<char>(i % 251);
+  BOOST_CHECK(FileUtil::writeFile(sFile, sContent, true));
+
+  std::string sRead;
+  uint64_t uiRead = FileUtil::readFileSequentially(sFile, [&sRead](const uint8_t* pData, size_t uiSize)
+  {
+    sRead.append(reinterpret_cast<const char*>(pData), uiSize);
+    return true;
+  }, ReadaheadPolicy(8192, 4, true));
+  BOOST_CHECK_EQUAL(uiRead, sContent.length());
+  BOOST_CHECK(sRead == sContent);
+
+  // stop after the first chunk
+  uiRead = FileUtil::readFileSequentially(sFile, [](const uint8_t*, size_t) { return false; }, ReadaheadPolicy(4096));
+  BOOST_CHECK_EQUAL(uiRead, 4096);
+
+  ChunkedIBitStream ib(boost::shared_ptr<ChunkSource>(new FileChunkSource(sFile, ReadaheadPolicy(4096, 2, true))), 4096);
+  BOOST_CHECK(ib.seek(99990 * 8));
+  uint8_t uiByte = 0;
+  BOOST_CHECK(ib.read(uiByte, 8));
+  BOOST_CHECK_EQUAL(uiByte, 99990 % 251);
+  BOOST_CHECK(ib.seek(10 * 8));
+  BOOST_CHECK(ib.read(uiByte, 8));
+  BOOST_CHECK_EQUAL(uiByte, 10);
+  boost::filesystem::remove(sFile);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_blockCodec )
+{
+  const std::string sFile = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+  OBitStream ob(1024);
+  for (uint32_t i = 0; i < 5000; ++i)
+  {
+    ob.write(i, 32);
+    ob.write(0xCAFE, 16);
+    ob.write(i % 3, 8);
+  }
+  Buffer raw = ob.str();
+  Buffer compressed = BlockCodec::compress(raw, 4096);
+  BOOST_CHECK(compressed.getSize() < raw.getSize());
+
+  Buffer decompressed;
+  BOOST_CHECK(BlockCodec::decompress(compressed, decompressed));
+  BOOST_CHECK_EQUAL(decompressed.getSize(), raw.getSize());
+  BOOST_CHECK(memcmp(decompressed.data(), raw.data(), raw.getSize()) == 0);
+
+  // the hash table is reused between blocks, but entries of earlier blocks are never matched
+  Buffer again = BlockCodec::compress(raw, 4096);
+  BOOST_REQUIRE_EQUAL(again.getSize(), compressed.getSize());
+  BOOST_CHECK(memcmp(again.data(), compressed.data(), compressed.getSize()) == 0);
+  Buffer small(new uint8_t[100], 100);
+  memcpy(&small[0], raw.data() + 1000, 100);
+  BOOST_CHECK(BlockCodec::decompress(BlockCodec::compress(small), decompressed));
+  BOOST_REQUIRE_EQUAL(decompressed.getSize(), 100);
+  BOOST_CHECK(memcmp(decompressed.data(), small.data(), 100) == 0);
+
+  // the output of several compress calls forms one stream
+  BOOST_CHECK(FileUtil::writeFile(sFile, compressed.toStdString() + BlockCodec::compress(raw).toStdString(), true));
+  ChunkedIBitStream ib(boost::shared_ptr<ChunkSource>(
+    new BlockDecompressorSource(boost::shared_ptr<ChunkSource>(new FileChunkSource(sFile)))), 1000);
+  uint32_t uiValue = 0;
+  BOOST_CHECK(ib.seek(4999 * 56));
+  BOOST_CHECK(ib.read(uiValue, 32));
+  BOOST_CHECK_EQUAL(uiValue, 4999);
+  BOOST_CHECK(ib.seek(2 * raw.getSize() * 8 - 8));
+  BOOST_CHECK(ib.read(uiValue, 8));
+  BOOST_CHECK_EQUAL(uiValue, 4999 % 3);
+  BOOST_CHECK(ib.isEof());
+  // seek back into the first stream
+  BOOST_CHECK(ib.seek(1234 * 56 + 32));
+  BOOST_CHECK(ib.read(uiValue, 16));
+  BOOST_CHECK_EQUAL(uiValue, 0xCAFE);
+
+  // corrupt data is rejected
+  compressed[5] ^= 0xFF;
+  BOOST_CHECK(!BlockCodec::decompress(compressed, decompressed));
+  // a tiny block claiming the maximum block size is rejected before anything is allocated
+  const uint8_t bogus[] = { 'C', 'P', 'L', 'Z', 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00 };
+  Buffer bogusBlock(new uint8_t[sizeof(bogus)], sizeof(bogus));
+  memcpy(&bogusBlock[0], bogus, sizeof(bogus));
+  BOOST_CHECK(!BlockCodec::decompress(bogusBlock, decompressed));
+  boost::filesystem::remove(sFile);
+}
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE( tc_test_asyncFileIo )
+{
+  const std::string sFile = (boost::filesystem::temp_directory_path() / boost::filesystem::unique_path()).string();
+  // io_uring where available, and the thread pool
+  for (int iMode = 0; iMode < 2; ++iMode)
+  {
+    bool bUseIoUring = (iMode == 0);
+    boost::asio::io_service ioService;
+    boost::asio::io_service::work work(ioService);
+    int fd = ::open(sFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    BOOST_REQUIRE(fd >= 0);
+
+    uint32_t uiCompleted = 0;
+    size_t uiBytes = 0;
+    boost::system::error_code lastError;
+    FileIoHandler_t onComplete = [&](const boost::system::error_code& ec, size_t uiTransferred)
+    {
+      ++uiCompleted;
+      uiBytes += uiTransferred;
+      if (ec) lastError = ec;
+    };
+
+    ServiceThread<AsyncFileIo> fileIo(boost::in_place_init, boost::ref(ioService), 4, 2, bUseIoUring);
+    BOOST_REQUIRE(!fileIo.start());
+    if (!bUseIoUring) BOOST_CHECK(!fileIo.get()->isUsingIoUring());
+
+    // more writes than the queue depth, followed by a data sync
+    std::vector<FileIoRequest> vRequests;
+    for (uint32_t i = 0; i < 10; ++i)
+    {
+      Buffer buffer(new uint8_t[4096], 4096);
+      memset(&buffer[0], static_cast<int>(i), 4096);
+      vRequests.push_back(FileIoRequest(FIO_WRITE, fd, i * 4096ULL, buffer, onComplete));
+    }
+    fileIo.get()->submit(vRequests);
+    BOOST_CHECK(vRequests.empty());
+    while (uiCompleted < 10) ioService.run_one();
+    fileIo.get()->submit(FileIoRequest(FIO_DATASYNC, fd, 0, Buffer(), onComplete));
+    while (uiCompleted < 11) ioService.run_one();
+    BOOST_CHECK(!lastError);
+    BOOST_CHECK_EQUAL(uiBytes, 10 * 4096);
+
+    // a read across the end of the file completes with the bytes available
+    uiCompleted = 0;
+    uiBytes = 0;
+    Buffer data(new uint8_t[8192], 8192);
+    Buffer tail(new uint8_t[8192], 8192);
+    fileIo.get()->submit(FileIoRequest(FIO_READ, fd, 8 * 4096ULL, data, onComplete));
+    fileIo.get()->submit(FileIoRequest(FIO_READ, fd, 9 * 4096ULL + 100, tail, onComplete));
+    while (uiCompleted < 2) ioService.run_one();
+    BOOST_CHECK(!lastError);
+    BOOST_CHECK_EQUAL(uiBytes, 8192 + 4096 - 100);
+    BOOST_CHECK_EQUAL(data[0], 8);
+    BOOST_CHECK_EQUAL(data[4096], 9);
+    BOOST_CHECK_EQUAL(tail[0], 9);
+
+    // requests submitted before stop complete, later ones are aborted
+    uiCompleted = 0;
+    for (uint32_t i = 0; i < 20; ++i)
+    {
+      fileIo.get()->submit(FileIoRequest(FIO_READ, fd, 0, Buffer(new uint8_t[100], 100), onComplete));
+    }
+    fileIo.stop();
+    ioService.poll();
+    BOOST_CHECK_EQUAL(uiCompleted, 20);
+    BOOST_CHECK(!lastError);
+    fileIo.get()->submit(FileIoRequest(FIO_READ, fd, 0, Buffer(new uint8_t[100], 100), onComplete));
+    ioService.poll();
+    BOOST_CHECK_EQUAL(uiCompleted, 21);
+    BOOST_CHECK(lastError == boost::asio::error::operation_aborted);
+    ::close(fd);
+  }
+  boost::filesystem::remove(sFile);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE( tc_test_stallWatchdog )
+{
+  StallWatchdog watchdog(20, 5);
+  StallWatchdog other(20, 5);
+  boost::mutex mutex;
+  std::vector<StallReport> vReports;
+  watchdog.setStallHandler([&mutex, &vReports](const StallReport& report)
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    vReports.push_back(report);
+  });
+  watchdog.start();
+
+  BOOST_CHECK(watchdog.registerThread("test thread"));
+  // a thread can only be registered with one watchdog, and the other watchdog cannot deregister it
+  BOOST_CHECK(!other.registerThread("test thread"));
+  other.deregisterThread();
+  {
+    StallWatchdog::Scope scope("slow handler");
+    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+  }
+  watchdog.deregisterThread();
+  watchdog.stop();
+
+  boost::mutex::scoped_lock lock(mutex);
+  // reported once per handler invocation
+  BOOST_REQUIRE_EQUAL(vReports.size(), 1);
+  BOOST_CHECK_EQUAL(vReports[0].sTag, "slow handler");
+  BOOST_CHECK_EQUAL(vReports[0].sThreadName, "test thread");
+  BOOST_CHECK(vReports[0].uiElapsedUs >= 20000);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_stallWatchdogNestedScopes )
+{
+  StallWatchdog watchdog(20, 5);
+  boost::mutex mutex;
+  std::vector<StallReport> vReports;
+  watchdog.setStallHandler([&mutex, &vReports](const StallReport& report)
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    vReports.push_back(report);
+  });
+  watchdog.start();
+  BOOST_REQUIRE(watchdog.registerThread("test thread"));
+  {
+    StallWatchdog::Scope outer("outer");
+    boost::this_thread::sleep(boost::posix_time::milliseconds(80));
+    {
+      StallWatchdog::Scope inner("inner");
+      boost::this_thread::sleep(boost::posix_time::milliseconds(80));
+    }
+    // the outer handler continues to stall, but has already been reported
+    boost::this_thread::sleep(boost::posix_time::milliseconds(80));
+  }
+  watchdog.deregisterThread();
+  watchdog.stop();
+
+  boost::mutex::scoped_lock lock(mutex);
+  BOOST_REQUIRE_EQUAL(vReports.size(), 2);
+  BOOST_CHECK_EQUAL(vReports[0].sTag, "outer");
+  BOOST_CHECK_EQUAL(vReports[1].sTag, "inner");
+  // the elapsed time belongs to the reported scope
+  BOOST_CHECK(vReports[1].uiElapsedUs < 80000);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_stallWatchdogHeartbeat )
+{
+  // nothing runs the io_service, so the heartbeat probe stalls
+  boost::asio::io_service ioService;
+  StallWatchdog watchdog(20, 5);
+  boost::mutex mutex;
+  boost::condition_variable condition;
+  uint32_t uiReports = 0;
+  watchdog.setStallHandler([&](const StallReport& report)
+  {
+    BOOST_CHECK_EQUAL(report.sTag, "heartbeat");
+    // the handler can call back into the watchdog
+    watchdog.stopMonitoring(ioService);
+    boost::mutex::scoped_lock lock(mutex);
+    ++uiReports;
+    condition.notify_all();
+  });
+  watchdog.monitor(ioService);
+  watchdog.start();
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    condition.timed_wait(lock, boost::posix_time::seconds(5), [&uiReports]() { return uiReports > 0; });
+  }
+  watchdog.stop();
+  BOOST_CHECK_EQUAL(uiReports, 1);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_periodicScheduler )
+{
+  {
+    // ticks are numbered from 1 and the handler can stop the scheduler
+    boost::asio::io_service ioService;
+    PeriodicScheduler scheduler(ioService, 1000, MTP_CATCH_UP);
+    std::vector<uint64_t> vTicks;
+    BOOST_REQUIRE(!scheduler.start([&scheduler, &vTicks](uint64_t uiTick)
+    {
+      vTicks.push_back(uiTick);
+      if (uiTick == 5) scheduler.stop();
+    }));
+    BOOST_CHECK(scheduler.start([](uint64_t){}));
+    ioService.run();
+    BOOST_REQUIRE_EQUAL(vTicks.size(), 5);
+    for (size_t i = 0; i < vTicks.size(); ++i) BOOST_CHECK_EQUAL(vTicks[i], i + 1);
+    // one sample per wakeup: a late wakeup catches up several ticks
+    BOOST_CHECK(scheduler.getStatistics().getCount() >= 1);
+    BOOST_CHECK(scheduler.getStatistics().getCount() <= 5);
+    BOOST_CHECK(!scheduler.isRunning());
+  }
+  {
+    // the scheduler and the state of its handler are destroyed while the io_service runs a wait
+    boost::asio::io_service ioService;
+    boost::asio::io_service::work work(ioService);
+    boost::thread thread(boost::bind(&boost::asio::io_service::run, &ioService));
+    for (int i = 0; i < 20; ++i)
+    {
+      std::atomic<uint64_t> uiTicks(0);
+      {
+        PeriodicScheduler scheduler(ioService, 200);
+        BOOST_REQUIRE(!scheduler.start([&uiTicks](uint64_t){ ++uiTicks; }));
+        boost::this_thread::sleep(boost::posix_time::microseconds(500 + 100 * i));
+      }
+      // no tick may run after the scheduler was destroyed
+      uint64_t uiTicksAtStop = uiTicks;
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      BOOST_CHECK_EQUAL(uiTicks, uiTicksAtStop);
+    }
+    ioService.stop();
+    thread.join();
+  }
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_serviceManager )
+{
+  ServiceManager manager;
+  std::map<std::string, int> mStarts;
+  std::map<std::string, int> mStops;
+  auto makeStart = [&mStarts](const std::string& sName)
+  {
+    return ServiceManager::ServiceCb_t([&mStarts, sName]() { ++mStarts[sName]; return boost::system::error_code(); });
+  };
+  auto makeStop = [&mStops](const std::string& sName)
+  {
+    return ServiceManager::ServiceCb_t([&mStops, sName]() { ++mStops[sName]; return boost::system::error_code(); });
+  };
+
+  uint32_t uiA = 0, uiB = 0, uiSpawner = 0, uiSpawned = 0, uiC = 0;
+  BOOST_REQUIRE(manager.registerService(makeStart("a"), makeStop("a"), uiA));
+  BOOST_REQUIRE(manager.registerService(makeStart("b"), makeStop("b"), uiB, false));
+  // a start callback that reconfigures the manager while it is starting
+  BOOST_REQUIRE(manager.registerService([&]()
+  {
+    ++mStarts["spawner"];
+    manager.registerService(makeStart("spawned"), makeStop("spawned"), uiSpawned);
+    manager.deregisterService(uiA);
+    return boost::system::error_code();
+  }, makeStop("spawner"), uiSpawner));
+  BOOST_CHECK(manager.startService(uiB));
+
+  boost::thread thread([&manager]() { manager.start(); });
+  while (!manager.isRunning()) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  BOOST_CHECK_EQUAL(mStarts["a"], 1);
+  BOOST_CHECK_EQUAL(mStops["a"], 1);
+  BOOST_CHECK_EQUAL(mStarts["spawned"], 1);
+  BOOST_CHECK(!manager.isServiceRunning(uiA));
+  BOOST_CHECK(manager.isServiceRunning(uiSpawner));
+  BOOST_CHECK(manager.isServiceRunning(uiSpawned));
+  BOOST_CHECK(!manager.isServiceRunning(uiB));
+
+  // reconfiguration while running
+  BOOST_REQUIRE(manager.registerService(makeStart("c"), makeStop("c"), uiC));
+  BOOST_CHECK(manager.isServiceRunning(uiC));
+  BOOST_CHECK(!manager.startService(uiB));
+  BOOST_CHECK(!manager.stopService(uiC));
+  BOOST_CHECK(!manager.isServiceRunning(uiC));
+  BOOST_CHECK(!manager.startService(uiC));
+  BOOST_CHECK(manager.deregisterService(uiC));
+  BOOST_CHECK(!manager.deregisterService(uiC));
+  BOOST_CHECK_EQUAL(mStarts["c"], 2);
+  BOOST_CHECK_EQUAL(mStops["c"], 2);
+
+  manager.stop();
+  thread.join();
+  BOOST_CHECK_EQUAL(mStops["spawner"], 1);
+  BOOST_CHECK_EQUAL(mStops["spawned"], 1);
+  BOOST_CHECK_EQUAL(mStops["b"], 1);
+  BOOST_CHECK_EQUAL(mStops["a"], 1);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_elasticUtilization )
+{
+  ServiceController controller(50);
+  BOOST_REQUIRE(controller.setElasticThreads(1, 2, ElasticPolicy(10, 1000000, 0.25, 3)));
+  boost::thread thread([&controller]() { controller.start(); });
+  while (!controller.isRunning()) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+
+  // a worker that is busy for several sample intervals is fully utilized
+  std::atomic<bool> bDone(false);
+  controller.post([&bDone]()
+  {
+    boost::chrono::steady_clock::time_point end = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(100);
+    while (boost::chrono::steady_clock::now() < end) {}
+    bDone = true;
+  });
+  boost::this_thread::sleep(boost::posix_time::milliseconds(60));
+  BOOST_CHECK_GT(controller.getMeasuredUtilization(), 0.5);
+  while (!bDone) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+
+  // an idle worker is not
+  boost::this_thread::sleep(boost::posix_time::milliseconds(60));
+  BOOST_CHECK_LT(controller.getMeasuredUtilization(), 0.25);
+
+  controller.stop();
+  thread.join();
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_boundedTaskQueueShedPolicies )
+{
+  std::vector<int> vRun;
+  auto makeTask = [&vRun](int iId) { return Task_t([&vRun, iId]() { vRun.push_back(iId); }); };
+  const AdmissionResult aExpected[] = { AR_REJECTED, AR_DROPPED_NEWEST, AR_DROPPED_OLDEST, AR_COALESCED };
+  // the tasks left in the queue after pushing 1, 2, 3 into a queue of capacity 2, and the task that was shed
+  const int aiExpectedQueue[][2] = { { 1, 2 }, { 1, 2 }, { 2, 3 }, { 1, 3 } };
+  const int aiExpectedShed[] = { 0, 3, 1, 2 };
+  const ShedPolicy aePolicies[] = { SP_REJECT, SP_DROP_NEWEST, SP_DROP_OLDEST, SP_COALESCE };
+  for (int i = 0; i < 4; ++i)
+  {
+    BoundedTaskQueue queue("shed", 2, aePolicies[i]);
+    Task_t shedTask;
+    BOOST_CHECK_EQUAL(queue.push(makeTask(1), shedTask), AR_ADMITTED);
+    BOOST_CHECK_EQUAL(queue.push(makeTask(2), shedTask), AR_ADMITTED);
+    BOOST_CHECK_EQUAL(queue.push(makeTask(3), shedTask), aExpected[i]);
+    BOOST_CHECK_EQUAL(queue.getDepth(), 2);
+
+    vRun.clear();
+    if (shedTask) shedTask();
+    BOOST_CHECK_EQUAL(vRun.empty() ? 0 : vRun[0], aiExpectedShed[i]);
+
+    vRun.clear();
+    Task_t task;
+    while (queue.pop(task)) task();
+    BOOST_REQUIRE_EQUAL(vRun.size(), 2);
+    BOOST_CHECK_EQUAL(vRun[0], aiExpectedQueue[i][0]);
+    BOOST_CHECK_EQUAL(vRun[1], aiExpectedQueue[i][1]);
+
+    TaskQueueStats stats = queue.getStats();
+    BOOST_CHECK_EQUAL(stats.uiHighWaterMark, 2);
+    BOOST_CHECK_EQUAL(stats.uiRejected, aePolicies[i] == SP_REJECT ? 1 : 0);
+    BOOST_CHECK_EQUAL(stats.uiShed, aePolicies[i] == SP_REJECT ? 0 : 1);
+    BOOST_CHECK_EQUAL(stats.uiExecuted, 2);
+  }
+
+  // pushBatch reports the increase in depth and the number of queued tasks separately
+  BoundedTaskQueue queue("batch", 2, SP_DROP_OLDEST);
+  std::vector<Task_t> vTasks;
+  for (int i = 0; i < 5; ++i) vTasks.push_back(makeTask(i));
+  std::vector<Task_t> vShed;
+  uint32_t uiQueued = 0;
+  BOOST_CHECK_EQUAL(queue.pushBatch(vTasks, vShed, uiQueued), 2);
+  BOOST_CHECK_EQUAL(uiQueued, 5);
+  BOOST_CHECK_EQUAL(vShed.size(), 3);
+  std::vector<Task_t> vPopped;
+  BOOST_CHECK_EQUAL(queue.popBatch(vPopped, 10), 2);
+  vRun.clear();
+  for (size_t i = 0; i < vPopped.size(); ++i) vPopped[i]();
+  BOOST_REQUIRE_EQUAL(vRun.size(), 2);
+  BOOST_CHECK_EQUAL(vRun[0], 3);
+  BOOST_CHECK_EQUAL(vRun[1], 4);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_priorityLanes )
+{
+  {
+    // with a single worker, tasks queued before start run high lane first, then normal, then background
+    ServiceController controller(1000, 1);
+    std::vector<int> vOrder;
+    auto record = [&vOrder](int iId) { return Task_t([&vOrder, iId]() { vOrder.push_back(iId); }); };
+    for (int i = 0; i < 3; ++i) controller.post(TP_BACKGROUND, record(300 + i));
+    for (int i = 0; i < 3; ++i) controller.post(record(200 + i));
+    controller.setQueuePriority("control", TP_HIGH);
+    for (int i = 0; i < 3; ++i) controller.post("control", record(100 + i));
+    BOOST_CHECK_EQUAL(controller.getTotalQueueDepth(), 9);
+    BOOST_CHECK_EQUAL(controller.getQueueStats(TP_BACKGROUND).uiDepth, 3);
+
+    boost::thread thread([&controller]() { controller.start(); });
+    while (!controller.isRunning() || controller.getTotalQueueDepth() > 0) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    controller.stop();
+    thread.join();
+
+    const int aiExpected[] = { 100, 101, 102, 200, 201, 202, 300, 301, 302 };
+    BOOST_REQUIRE_EQUAL(vOrder.size(), 9);
+    for (size_t i = 0; i < vOrder.size(); ++i) BOOST_CHECK_EQUAL(vOrder[i], aiExpected[i]);
+  }
+  {
+    // the background share limits the number of workers running background tasks concurrently
+    ServiceController controller(1000, 3);
+    BOOST_REQUIRE(controller.setElasticThreads(3, 3));
+    controller.setBackgroundShare(1);
+    std::atomic<int> iRunning(0), iPeak(0), iDone(0);
+    boost::thread thread([&controller]() { controller.start(); });
+    while (!controller.isRunning()) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    for (int i = 0; i < 10; ++i)
+    {
+      controller.post(TP_BACKGROUND, [&iRunning, &iPeak, &iDone]()
+      {
+        int iNow = ++iRunning;
+        int iMax = iPeak;
+        while (iNow > iMax && !iPeak.compare_exchange_weak(iMax, iNow)) {}
+        boost::this_thread::sleep(boost::posix_time::milliseconds(2));
+        --iRunning;
+        ++iDone;
+      });
+    }
+    // a high priority task is not held up by the background backlog
+    std::atomic<bool> bHigh(false);
+    controller.post(TP_HIGH, [&bHigh, &iDone]() { bHigh = iDone < 10; });
+    while (iDone < 10) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    controller.stop();
+    thread.join();
+    BOOST_CHECK_EQUAL(iPeak, 1);
+    BOOST_CHECK(bHigh);
+  }
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_pacer )
+{
+  SimulatedClock::setSimulated(true);
+  const int64_t MS = 1000000;
+  boost::asio::io_service ioService;
+  Pacer pacer(ioService, 1000, 4);
+  std::vector<PacedPacket> vReleased;
+  pacer.setReleaseHandler([&vReleased](std::vector<PacedPacket>& vBatch)
+  {
+    vReleased.insert(vReleased.end(), vBatch.begin(), vBatch.end());
+  });
+  auto releasedAfter = [&pacer, &vReleased](int64_t iNs)
+  {
+    SimulatedClock::advance(boost::chrono::nanoseconds(iNs));
+    vReleased.clear();
+    pacer.releaseDue();
+    return vReleased.size();
+  };
+  const int64_t iStartNs = SimulatedClock::now().time_since_epoch().count();
 
+  // 1000 bytes per second with a 1500 byte bucket that starts full
+  pacer.addFlow(1, 1000, 1500);
+  for (int i = 0; i < 3; ++i) BOOST_CHECK(pacer.enqueue(1, Buffer(new uint8_t[1000], 1000)));
+  BOOST_CHECK_EQUAL(releasedAfter(0), 1);
+  // 500 tokens left: the next packet needs another 500ms
+  BOOST_CHECK_EQUAL(releasedAfter(400 * MS), 0);
+  BOOST_CHECK_EQUAL(releasedAfter(101 * MS), 1);
+  BOOST_CHECK_EQUAL(vReleased[0].uiFlowId, 1);
+
+  // a packet larger than the bucket is sent once the bucket is full and leaves a deficit
+  pacer.addFlow(2, 1000, 500);
+  BOOST_CHECK(pacer.enqueue(2, Buffer(new uint8_t[2000], 2000)));
+  BOOST_CHECK(pacer.enqueue(2, Buffer(new uint8_t[100], 100)));
+  BOOST_CHECK_EQUAL(releasedAfter(0), 1);
+  BOOST_CHECK_EQUAL(vReleased[0].buffer.getSize(), 2000);
+  BOOST_CHECK_EQUAL(releasedAfter(1500 * MS), 1);
+  BOOST_CHECK_EQUAL(vReleased[0].uiFlowId, 1);
+  BOOST_CHECK_EQUAL(releasedAfter(200 * MS), 1);
+  BOOST_CHECK_EQUAL(vReleased[0].uiFlowId, 2);
+
+  // packets of an unlimited flow are held until their send time
+  int64_t iNowNs = SimulatedClock::now().time_since_epoch().count();
+  pacer.addFlow(3, 0, 0);
+  BOOST_CHECK(pacer.enqueue(3, Buffer(new uint8_t[10], 10), iNowNs + 10 * MS));
+  BOOST_CHECK_EQUAL(releasedAfter(9 * MS), 0);
+
+  // removing the flow discards its packets; the heap entry of the removed flow is stale for the new flow
+  pacer.removeFlow(3);
+  BOOST_CHECK_EQUAL(pacer.getStats().uiQueued, 0);
+  pacer.addFlow(3, 0, 0);
+  BOOST_CHECK(pacer.enqueue(3, Buffer(new uint8_t[10], 10), iNowNs + 20 * MS));
+  BOOST_CHECK_EQUAL(releasedAfter(5 * MS), 0);
+  BOOST_CHECK_EQUAL(releasedAfter(6 * MS), 1);
+  BOOST_CHECK_EQUAL(releasedAfter(10 * MS), 0);
+
+  // the queue of a flow is bounded and unknown flows are refused
+  for (int i = 0; i < 4; ++i) BOOST_CHECK(pacer.enqueue(3, Buffer(new uint8_t[10], 10), iNowNs + 100 * MS));
+  BOOST_CHECK(!pacer.enqueue(3, Buffer(new uint8_t[10], 10)));
+  BOOST_CHECK(!pacer.enqueue(9, Buffer(new uint8_t[10], 10)));
+  pacer.removeFlow(3);
+
+  PacerStats stats = pacer.getStats();
+  BOOST_CHECK_EQUAL(stats.uiQueued, 0);
+  BOOST_CHECK_EQUAL(stats.uiReleased, 6);
+  BOOST_CHECK_EQUAL(stats.uiReleasedBytes, 3 * 1000 + 2000 + 100 + 10);
+  BOOST_CHECK_EQUAL(stats.uiDropped, 2);
+  BOOST_CHECK_EQUAL(stats.uiBatches, 6);
+  BOOST_CHECK(SimulatedClock::now().time_since_epoch().count() > iStartNs);
+
+  // while started, only the ticks release packets and the handler cannot be replaced
+  Pacer::OnRelease_t onRelease = [](std::vector<PacedPacket>&) {};
+  BOOST_CHECK(!pacer.start(onRelease));
+  BOOST_CHECK(pacer.start(onRelease));
+  BOOST_CHECK(!pacer.setReleaseHandler(onRelease));
+  BOOST_CHECK(!pacer.releaseDue());
+  pacer.stop();
+  BOOST_CHECK(pacer.setReleaseHandler(onRelease));
+  BOOST_CHECK(pacer.releaseDue());
+  SimulatedClock::setSimulated(false);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_parallelAlgorithms )
+{
+  ServiceController controller(1000, 3);
+  for (int iRun = 0; iRun < 2; ++iRun)
+  {
+    // the second run uses the worker threads of the running controller
+    boost::thread thread;
+    if (iRun == 1)
+    {
+      thread = boost::thread([&controller]() { controller.start(); });
+      while (!controller.isRunning()) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+
+    // every index is visited exactly once
+    std::vector<std::atomic<int> > vVisits(1000);
+    for (size_t i = 0; i < vVisits.size(); ++i) vVisits[i] = 0;
+    parallelFor(controller, 0, 1000, 7, [&vVisits](int i) { ++vVisits[i]; });
+    for (size_t i = 0; i < vVisits.size(); ++i) BOOST_CHECK_EQUAL(vVisits[i], 1);
+
+    // partial results are combined in chunk order, so a non-commutative combine is deterministic
+    std::string sDigits = parallelReduce(controller, 0, 26, 4, std::string(),
+                                         [](int iBegin, int iEnd)
+                                         {
+                                           std::string sPart;
+                                           for (int i = iBegin; i < iEnd; ++i) sPart += static_cast<char>('a' + i);
+                                           return sPart;
+                                         },
+                                         [](const std::string& a, const std::string& b) { return a + b; }, TP_HIGH);
+    BOOST_CHECK_EQUAL(sDigits, "abcdefghijklmnopqrstuvwxyz");
+
+    // the first exception is rethrown in the calling thread
+    BOOST_CHECK_THROW(parallelFor(controller, 0, 100, 1, [](int i) { if (i == 42) throw std::runtime_error("42"); }), std::runtime_error);
+
+    // tasks run after all tasks they depend on
+    TaskGraph graph;
+    boost::mutex mutex;
+    std::vector<int> vOrder;
+    auto record = [&mutex, &vOrder](int iId) { return Task_t([&mutex, &vOrder, iId]() { boost::mutex::scoped_lock lock(mutex); vOrder.push_back(iId); }); };
+    TaskGraph::TaskId_t a = graph.addTask(record(0));
+    TaskGraph::TaskId_t b = graph.addTask(record(1));
+    TaskGraph::TaskId_t c = graph.addTask(record(2));
+    TaskGraph::TaskId_t d = graph.addTask(record(3));
+    graph.addDependency(a, b);
+    graph.addDependency(a, c);
+    graph.addDependency(b, d);
+    graph.addDependency(c, d);
+    graph.run(controller);
+    BOOST_REQUIRE_EQUAL(vOrder.size(), 4);
+    BOOST_CHECK_EQUAL(vOrder.front(), 0);
+    BOOST_CHECK_EQUAL(vOrder.back(), 3);
+
+    // a cycle is rejected before any task runs
+    vOrder.clear();
+    graph.addDependency(d, a);
+    BOOST_CHECK_THROW(graph.run(controller), ExceptionBase);
+    BOOST_CHECK(vOrder.empty());
+    BOOST_CHECK_THROW(graph.addDependency(a, a), ExceptionBase);
+
+    if (iRun == 1)
+    {
+      controller.stop();
+      thread.join();
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_busyPollAffinity )
+{
+  ServiceController controller(1000, 2);
+  BOOST_REQUIRE(controller.setRunMode(ServiceController::RM_BUSY_POLL, SpinPolicy(1000, 10)));
+  BOOST_REQUIRE(controller.setCpuAffinity(std::vector<unsigned>(1, 0)));
+  std::atomic<int> iRan(0);
+  std::atomic<int> iPinned(0);
+  std::atomic<bool> bReconfigured(false);
+  controller.setOnStartHandler([&]()
+  {
+    // the mode and affinity cannot change while running
+    bReconfigured = controller.setRunMode(ServiceController::RM_BLOCKING) || controller.setCpuAffinity(std::vector<unsigned>());
+    for (int i = 0; i < 1000; ++i)
+    {
+      controller.post([&iRan, &iPinned]()
+      {
+        ++iRan;
+#if defined(__linux__)
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) == 0 && CPU_COUNT(&cpuset) == 1 && CPU_ISSET(0, &cpuset))
+          ++iPinned;
+#else
+        ++iPinned;
+#endif
+      });
+    }
+    // the workers drain the remaining handlers before start() returns
+    controller.post([&controller]() { boost::this_thread::sleep(boost::posix_time::milliseconds(20)); controller.stop(); });
+  });
+  BOOST_CHECK(!controller.start());
+  BOOST_CHECK(controller.isReady());
+  BOOST_CHECK_EQUAL(controller.getRunMode(), ServiceController::RM_BUSY_POLL);
+  BOOST_CHECK(!bReconfigured);
+  BOOST_CHECK_EQUAL(iRan, 1000);
+  BOOST_CHECK_EQUAL(iPinned, 1000);
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_postBatch )
+{
+  ServiceController controller(1000, 3);
+  controller.setQueueCapacity("batch", 900, SP_DROP_NEWEST);
+  std::atomic<int> iRan(0);
+  std::atomic<int> iShed(0);
+  uint32_t uiQueued = 0;
+  uint32_t uiQueuedDefault = 0;
+  controller.setShedHandler([&iShed](const std::string& sTag, Task_t&) { if (sTag == "batch") ++iShed; });
+  controller.setOnStartHandler([&]()
+  {
+    std::vector<Task_t> vTasks(1000, [&iRan]() { ++iRan; });
+    // the capacity is applied to the whole batch under one lock
+    uiQueued = controller.postBatch("batch", vTasks);
+    uiQueuedDefault = controller.postBatch(vTasks);
+    controller.post([&controller]() { controller.stop(); });
+  });
+  BOOST_CHECK(!controller.start());
+  BOOST_CHECK_EQUAL(uiQueued, 900);
+  BOOST_CHECK_EQUAL(uiQueuedDefault, 1000);
+  BOOST_CHECK_EQUAL(iShed, 100);
+  BOOST_CHECK_EQUAL(iRan, 1900);
+  TaskQueueStats stats = controller.getQueueStats("batch");
+  BOOST_CHECK_EQUAL(stats.uiExecuted, 900);
+  BOOST_CHECK_EQUAL(stats.uiShed, 100);
+  BOOST_CHECK_EQUAL(stats.uiHighWaterMark, 900);
+  BOOST_CHECK_EQUAL(controller.getTotalQueueDepth(), 0);
+}
+
+/// a service that can neither be copied nor moved, constructed from a move-only argument
+struct MoveOnlyArgService : public boost::noncopyable
+{
+  MoveOnlyArgService(int iId, const std::string& sName, std::unique_ptr<int> pValue)
+    :iId(iId),
+    sName(sName),
+    pValue(std::move(pValue)),
+    bStopped(false)
+  {
+
+  }
+
+  boost::system::error_code onStart() { return boost::system::error_code(); }
+
+  boost::system::error_code start()
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    while (!bStopped) condition.wait(lock);
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code stop()
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    bStopped = true;
+    condition.notify_all();
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code onComplete() { return boost::system::error_code(); }
+
+  int iId;
+  std::string sName;
+  std::unique_ptr<int> pValue;
+  bool bStopped;
+  boost::mutex mutex;
+  boost::condition_variable condition;
+};
+
+BOOST_AUTO_TEST_CASE( tc_test_makeService )
+{
+  std::unique_ptr<int> pValue(new int(42));
+  int* pRaw = pValue.get();
+  boost::shared_ptr<ServiceThread<MoveOnlyArgService> > pService = makeService<MoveOnlyArgService>(3, std::string("svc"), std::move(pValue));
+  BOOST_REQUIRE(pService);
+  // the argument was forwarded, not copied
+  BOOST_CHECK(!pValue);
+  BOOST_CHECK_EQUAL(pService->get()->iId, 3);
+  BOOST_CHECK_EQUAL(pService->get()->sName, "svc");
+  BOOST_CHECK_EQUAL(pService->get()->pValue.get(), pRaw);
+  BOOST_CHECK(!pService->start());
+  BOOST_CHECK(!pService->stop());
+  BOOST_CHECK(pService->get()->bStopped);
+}
+
+/// counts the periodic ticks of the manager
+class TickCountingManager : public ServiceManager
+{
+public:
+  TickCountingManager()
+    :uiTicks(0)
+  {
+
+  }
+
+  uint32_t uiTicks;
+
+protected:
+  virtual void doPeriodicTask()
+  {
+    ++uiTicks;
+  }
+};
+
+BOOST_AUTO_TEST_CASE( tc_test_simulatedServiceManager )
+{
+  {
+    // the periodic timer is armed on construction, before simulation is enabled
+    TickCountingManager manager;
+    SimulatedClock::setSimulated(true);
+    manager.setDurationMs(60 * 1000);
+    SteadyClock_t realTime;
+    BOOST_CHECK(!manager.start());
+    BOOST_CHECK(realTime.seconds() < 10.0);
+    BOOST_CHECK(manager.uiTicks >= 59);
+    SimulatedClock::setSimulated(false);
+  }
+  SimulatedClock::setSimulated(true);
+  {
+    // an hour of virtual time runs without waiting for the timers
+    TickCountingManager manager;
+    manager.setDurationMs(3600 * 1000);
+    SimulatedClock_t virtualTime;
+    SteadyClock_t realTime;
+    BOOST_CHECK(!manager.start());
+    BOOST_CHECK(virtualTime.seconds() >= 3600.0);
+    BOOST_CHECK(virtualTime.seconds() < 3601.0);
+    BOOST_CHECK(realTime.seconds() < 10.0);
+    // the end timer and the last periodic timer expire at the same virtual time
+    BOOST_CHECK(manager.uiTicks == 3599 || manager.uiTicks == 3600);
+  }
+  SimulatedClock::setSimulated(false);
+}
+
+/// a service instance that can fail on start or throw from its event loop
+struct GroupTestService : public boost::noncopyable
+{
+  GroupTestService(bool bFailOnStart, bool bThrow)
+    :bFailOnStart(bFailOnStart),
+    bThrow(bThrow),
+    bStopped(false)
+  {
+
+  }
+
+  boost::system::error_code onStart()
+  {
+    if (bFailOnStart) return boost::system::error_code(boost::system::errc::invalid_argument, boost::system::generic_category());
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code start()
+  {
+    if (bThrow) throw std::runtime_error("boom");
+    boost::mutex::scoped_lock lock(mutex);
+    while (!bStopped) condition.wait(lock);
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code stop()
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    bStopped = true;
+    condition.notify_all();
+    return boost::system::error_code();
+  }
+
+  boost::system::error_code onComplete() { return boost::system::error_code(); }
+
+  bool bFailOnStart;
+  bool bThrow;
+  bool bStopped;
+  boost::mutex mutex;
+  boost::condition_variable condition;
+};
+
+BOOST_AUTO_TEST_CASE( tc_test_serviceGroup )
+{
+  {
+    ServiceGroup<GroupTestService>::ptr pGroup = makeServiceGroup<GroupTestService>(3, false, false);
+    BOOST_REQUIRE_EQUAL(pGroup->size(), 3);
+    BOOST_CHECK(!pGroup->start());
+    BOOST_CHECK(!pGroup->stop());
+    for (size_t i = 0; i < pGroup->size(); ++i) BOOST_CHECK((*pGroup)[i]->get()->bStopped);
+  }
+  {
+    // the third instance fails to start: the started instances are stopped, one of them after throwing
+    std::vector<ServiceGroup<GroupTestService>::ServicePtr_t> vServices;
+    vServices.push_back(makeService<GroupTestService>(false, false));
+    vServices.push_back(makeService<GroupTestService>(false, true));
+    vServices.push_back(makeService<GroupTestService>(true, false));
+    ServiceGroup<GroupTestService> group(vServices, false);
+    BOOST_CHECK_EQUAL(group.start(), boost::system::errc::invalid_argument);
+    BOOST_CHECK(vServices[0]->get()->bStopped);
+    BOOST_CHECK(!vServices[0]->isRunning());
+  }
+  {
+    // an explicit stop rethrows the exception of a service thread
+    ServiceGroup<GroupTestService>::ptr pGroup = makeServiceGroup<GroupTestService>(2, false, true);
+    BOOST_CHECK(!pGroup->start());
+    BOOST_CHECK_THROW(pGroup->stop(), std::runtime_error);
+  }
+  {
+    // the destructor does not throw
+    ServiceGroup<GroupTestService>::ptr pGroup = makeServiceGroup<GroupTestService>(2, false, true);
+    BOOST_CHECK(!pGroup->start());
+  }
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_shardedStrand )
+{
+  boost::asio::io_service ioService;
+  ShardedStrand strands(ioService, 8);
+  BOOST_CHECK_EQUAL(strands.getShardCount(), 8);
+  // sequential keys spread over the shards
+  std::vector<uint32_t> vKeys;
+  std::set<uint32_t> sShards;
+  for (uint32_t uiKey = 0; uiKey < 16; ++uiKey)
+  {
+    if (sShards.insert(strands.getShardIndex(uiKey)).second && vKeys.size() < 4) vKeys.push_back(uiKey);
+  }
+  BOOST_CHECK(sShards.size() >= 6);
+  BOOST_REQUIRE_EQUAL(vKeys.size(), 4);
+
+  std::unique_ptr<boost::asio::io_service::work> pWork(new boost::asio::io_service::work(ioService));
+  boost::thread_group threads;
+  for (int i = 0; i < 4; ++i)
+  {
+    threads.create_thread([&ioService]() { ioService.run(); });
+  }
+
+  // handlers of different keys run concurrently: each waits for a handler of another key to be active
+  std::atomic<uint32_t> uiActive(0);
+  std::atomic<uint32_t> uiMaxActive(0);
+  for (uint32_t uiKey : vKeys)
+  {
+    strands.post(uiKey, [&uiActive, &uiMaxActive]()
+    {
+      uint32_t uiNow = ++uiActive;
+      uint32_t uiMax = uiMaxActive.load();
+      while (uiNow > uiMax && !uiMaxActive.compare_exchange_weak(uiMax, uiNow))
+      {
+      }
+      for (int i = 0; i < 2000 && uiMaxActive.load() < 2; ++i)
+      {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      }
+      --uiActive;
+    });
+  }
+
+  // handlers of the same key run in order and never concurrently, whether posted, dispatched or wrapped
+  const uint32_t uiTasks = 3000;
+  std::vector<std::vector<uint32_t> > vOrder(vKeys.size());
+  std::atomic<bool> abRunning[4];
+  std::atomic<uint32_t> uiOverlaps(0);
+  for (size_t k = 0; k < vKeys.size(); ++k) abRunning[k] = false;
+  for (uint32_t i = 0; i < uiTasks; ++i)
+  {
+    for (size_t k = 0; k < vKeys.size(); ++k)
+    {
+      std::function<void ()> handler = [&vOrder, &abRunning, &uiOverlaps, k, i]()
+      {
+        if (abRunning[k].exchange(true)) ++uiOverlaps;
+        vOrder[k].push_back(i);
+        abRunning[k] = false;
+      };
+      switch (i % 3)
+      {
+      case 0:
+        strands.post(vKeys[k], handler);
+        break;
+      case 1:
+        strands.dispatch(vKeys[k], handler);
+        break;
+      default:
+        strands.wrap(vKeys[k], handler)();
+        break;
+      }
+    }
+  }
+  pWork.reset();
+  threads.join_all();
+
+  BOOST_CHECK(uiMaxActive >= 2);
+  BOOST_CHECK_EQUAL(uiOverlaps, 0);
+  for (size_t k = 0; k < vKeys.size(); ++k)
+  {
+    BOOST_REQUIRE_EQUAL(vOrder[k].size(), uiTasks);
+    for (uint32_t i = 0; i < uiTasks; ++i)
+    {
+      if (vOrder[k][i] != i)
+      {
+        BOOST_ERROR("handler " << vOrder[k][i] << " of key " << vKeys[k] << " ran at position " << i);
+        break;
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( tc_test_parallelHelpersDoNotShedTasks )
+{
+  ServiceController controller(1000, 1);
+  // a full default queue drops the oldest task
+  controller.setQueueCapacity(1, SP_DROP_OLDEST);
+  std::atomic<int> iShed(0);
+  controller.setShedHandler([&iShed](const std::string&, Task_t&) { ++iShed; });
+  boost::thread thread([&controller]() { controller.start(); });
+  while (!controller.isRunning()) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+
+  // occupy the worker so that the next task stays queued
+  boost::mutex mutex;
+  boost::condition_variable condition;
+  bool bBlocked = false;
+  bool bRelease = false;
+  std::atomic<bool> bUserTaskRan(false);
+  controller.post([&]()
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    bBlocked = true;
+    condition.notify_all();
+    while (!bRelease) condition.wait(lock);
+  });
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    while (!bBlocked) condition.wait(lock);
+  }
+  BOOST_CHECK_EQUAL(controller.post([&bUserTaskRan]() { bUserTaskRan = true; }), AR_ADMITTED);
+
+  // the helper of the loop must not evict the queued task
+  std::atomic<int> iVisits(0);
+  parallelFor(controller, 0, 100, 1, [&iVisits](int) { ++iVisits; });
+  BOOST_CHECK_EQUAL(iVisits, 100);
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    bRelease = true;
+    condition.notify_all();
+  }
+  for (int i = 0; i < 5000 && !bUserTaskRan; ++i) boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  BOOST_CHECK(bUserTaskRan);
+  BOOST_CHECK_EQUAL(iShed, 0);
+  controller.stop();
+  thread.join();
+}